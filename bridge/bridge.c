@@ -39,7 +39,7 @@ static void usage(void)
 "where  OBJECT := { link | fdb | mdb | mst | vlan | vni | monitor }\n"
 "       OPTIONS := { -V[ersion] | -s[tatistics] | -d[etails] |\n"
 "                    -o[neline] | -t[imestamp] | -n[etns] name |\n"
-"                    -com[pressvlans] -c[olor] -p[retty] -j[son] }\n");
+"                    -com[pressvlans] -c[olor] -p[retty] -j[son] -cbor }\n");
 	exit(-1);
 }
 
@@ -159,6 +159,9 @@ main(int argc, char **argv)
 			++force;
 		} else if (matches(opt, "-json") == 0) {
 			++json;
+		} else if (strcmp(opt, "-cbor") == 0) {
+			++json;
+			++cbor;
 		} else if (matches(opt, "-pretty") == 0) {
 			++pretty;
 		} else if (matches(opt, "-batch") == 0) {
@@ -29,9 +29,19 @@
 #include "br_common.h"
 #include "rt_names.h"
 #include "utils.h"
+#include "hashtab.h"
 
 static unsigned int filter_index, filter_dynamic, filter_master,
-	filter_state, filter_vlan;
+	filter_state, filter_vlan, filter_flags;
+static __u32 filter_vni = ~0U;
+static inet_prefix filter_dst;
+
+enum {
+	FDB_COUNT_NONE,
+	FDB_COUNT_VLAN,
+	FDB_COUNT_PORT,
+	FDB_COUNT_STATE,
+};
 
 static void usage(void)
 {
@@ -43,7 +53,10 @@ static void usage(void)
 		"	       [ via DEV ] [ src_vni VNI ] [ activity_notify ]\n"
 		"	       [ inactive ] [ norefresh ]\n"
 		"       bridge fdb [ show [ br BRDEV ] [ brport DEV ] [ vlan VID ]\n"
-		"              [ state STATE ] [ dynamic ] ]\n"
+		"              [ state STATE ] [ dynamic ] [ vni VNI ] [ dst IPADDR ]\n"
+		"              [ self ] [ master ] ]\n"
+		"       bridge fdb count [ by { vlan | port | state } ] [ SHOW_FILTER ]\n"
+		"       bridge fdb import [ FILE ]\n"
 		"       bridge fdb get [ to ] LLADDR [ br BRDEV ] { brport | dev } DEV\n"
 		"              [ vlan VID ] [ vni VNI ] [ self ] [ master ] [ dynamic ]\n"
 		"       bridge fdb flush dev DEV [ brport DEV ] [ vlan VID ] [ src_vni VNI ]\n"
@@ -51,7 +64,7 @@ static void usage(void)
 		"	       [ master ] [ [no]permanent | [no]static | [no]dynamic ]\n"
 		"              [ [no]added_by_user ] [ [no]extern_learn ] [ [no]sticky ]\n"
 		"              [ [no]offloaded ] [ [no]router ]\n");
-	exit(-1);
+	parse_exit(-1);
 }
 
 static const char *state_n2a(unsigned int s)
@@ -161,6 +174,48 @@ static void fdb_print_ext_attrs(struct rtattr *nfea)
 	}
 }
 
+/* filters that only need the ndmsg header */
+static bool fdb_filter_hdr(const struct ndmsg *r)
+{
+	if (filter_index && filter_index != r->ndm_ifindex)
+		return false;
+
+	if (filter_state && !(r->ndm_state & filter_state))
+		return false;
+
+	if (filter_dynamic && (r->ndm_state & NUD_PERMANENT))
+		return false;
+
+	if (filter_flags && !(r->ndm_flags & filter_flags))
+		return false;
+
+	return true;
+}
+
+static bool fdb_filter_attrs(struct rtattr *tb[])
+{
+	__u16 vid = 0;
+
+	if (tb[NDA_VLAN])
+		vid = rta_getattr_u16(tb[NDA_VLAN]);
+
+	if (filter_vlan && filter_vlan != vid)
+		return false;
+
+	if (filter_vni != ~0U &&
+	    (!tb[NDA_VNI] || rta_getattr_u32(tb[NDA_VNI]) != filter_vni))
+		return false;
+
+	if (filter_dst.family &&
+	    (!tb[NDA_DST] ||
+	     RTA_PAYLOAD(tb[NDA_DST]) != filter_dst.bytelen ||
+	     memcmp(RTA_DATA(tb[NDA_DST]), filter_dst.data,
+		    filter_dst.bytelen)))
+		return false;
+
+	return true;
+}
+
 int print_fdb(struct nlmsghdr *n, void *arg)
 {
 	FILE *fp = arg;
@@ -185,28 +240,22 @@ int print_fdb(struct nlmsghdr *n, void *arg)
 	if (r->ndm_family != AF_BRIDGE)
 		return 0;
 
-	if (filter_index && filter_index != r->ndm_ifindex)
-		return 0;
-
-	if (filter_state && !(r->ndm_state & filter_state))
+	if (!fdb_filter_hdr(r))
 		return 0;
 
 	parse_rtattr_flags(tb, NDA_MAX, NDA_RTA(r),
 			   n->nlmsg_len - NLMSG_LENGTH(sizeof(*r)),
 			   NLA_F_NESTED);
 
+	if (!fdb_filter_attrs(tb))
+		return 0;
+
 	if (tb[NDA_FLAGS_EXT])
 		ext_flags = rta_getattr_u32(tb[NDA_FLAGS_EXT]);
 
 	if (tb[NDA_VLAN])
 		vid = rta_getattr_u16(tb[NDA_VLAN]);
 
-	if (filter_vlan && filter_vlan != vid)
-		return 0;
-
-	if (filter_dynamic && (r->ndm_state & NUD_PERMANENT))
-		return 0;
-
 	print_headers(fp, "[NEIGH]");
 
 	open_json_object(NULL);
@@ -350,12 +399,111 @@ static int fdb_dump_filter(struct nlmsghdr *nlh, int reqlen)
 	return 0;
 }
 
-static int fdb_show(int argc, char **argv)
+/*
+ * Aggregation for "bridge fdb count": entries are classified into a
+ * table of counters without being formatted.
+ */
+struct fdb_count {
+	int		by;
+	__u64		total;
+	struct hashtab	tbl;
+};
+
+static int count_fdb(struct nlmsghdr *n, void *arg)
 {
+	struct fdb_count *c = arg;
+	struct ndmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[NDA_MAX+1];
+	__u32 key = 0;
+
+	if (n->nlmsg_type != RTM_NEWNEIGH ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(*r)) ||
+	    r->ndm_family != AF_BRIDGE)
+		return 0;
+
+	if (!fdb_filter_hdr(r))
+		return 0;
+
+	if (filter_vlan || filter_vni != ~0U || filter_dst.family ||
+	    c->by == FDB_COUNT_VLAN) {
+		parse_rtattr_flags(tb, NDA_MAX, NDA_RTA(r),
+				   n->nlmsg_len - NLMSG_LENGTH(sizeof(*r)),
+				   NLA_F_NESTED);
+		if (!fdb_filter_attrs(tb))
+			return 0;
+	}
+
+	c->total++;
+
+	switch (c->by) {
+	case FDB_COUNT_VLAN:
+		key = tb[NDA_VLAN] ? rta_getattr_u16(tb[NDA_VLAN]) : 0;
+		break;
+	case FDB_COUNT_PORT:
+		key = r->ndm_ifindex;
+		break;
+	case FDB_COUNT_STATE:
+		key = r->ndm_state;
+		break;
+	default:
+		return 0;
+	}
+
+	if (hashtab_count(&c->tbl, key)) {
+		fprintf(stderr, "Not enough memory for fdb count\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void print_fdb_count(struct fdb_count *c)
+{
+	unsigned int i, n = hashtab_sort(&c->tbl, hashtab_counter_cmp);
+	struct hashtab_counter *counters = (void *)c->tbl.slots;
+
+	for (i = 0; i < n; i++) {
+		__u32 key = counters[i].key;
+		const char *state;
+
+		open_json_object(NULL);
+		switch (c->by) {
+		case FDB_COUNT_VLAN:
+			print_uint(PRINT_ANY, "vlan", "vlan %u ", key);
+			break;
+		case FDB_COUNT_PORT:
+			print_string(PRINT_FP, NULL, "dev ", NULL);
+			print_color_string(PRINT_ANY, COLOR_IFNAME,
+					   "ifname", "%s ",
+					   ll_index_to_name(key));
+			break;
+		case FDB_COUNT_STATE:
+			state = state_n2a(key);
+			print_string(PRINT_ANY, "state", "state %s ",
+				     *state ? state : "reachable");
+			break;
+		}
+		print_u64(PRINT_ANY, "count", "count %llu\n",
+			  counters[i].count);
+		close_json_object();
+	}
+
+	if (c->by == FDB_COUNT_NONE) {
+		open_json_object(NULL);
+		print_u64(PRINT_ANY, "count", "count %llu\n", c->total);
+		close_json_object();
+	} else {
+		print_u64(PRINT_FP, NULL, "total %llu\n", c->total);
+	}
+}
+
+static int __fdb_show(int argc, char **argv, bool count)
+{
+	struct fdb_count counts = {};
 	char *filter_dev = NULL;
 	char *br = NULL;
 	int rc;
 
+	hashtab_counter_init(&counts.tbl);
 	while (argc > 0) {
 		if ((strcmp(*argv, "brport") == 0) || strcmp(*argv, "dev") == 0) {
 			NEXT_ARG();
@@ -377,6 +525,32 @@ static int fdb_show(int argc, char **argv)
 			filter_state |= state;
 		} else if (strcmp(*argv, "dynamic") == 0) {
 			filter_dynamic = 1;
+		} else if (strcmp(*argv, "vni") == 0) {
+			NEXT_ARG();
+			if (filter_vni != ~0U)
+				duparg("vni", *argv);
+			if (get_u32(&filter_vni, *argv, 0) || filter_vni >= 1U << 24)
+				invarg("invalid vni", *argv);
+		} else if (strcmp(*argv, "dst") == 0) {
+			NEXT_ARG();
+			if (filter_dst.family)
+				duparg("dst", *argv);
+			get_addr(&filter_dst, *argv, preferred_family);
+		} else if (strcmp(*argv, "self") == 0) {
+			filter_flags |= NTF_SELF;
+		} else if (strcmp(*argv, "master") == 0) {
+			filter_flags |= NTF_MASTER;
+		} else if (count && strcmp(*argv, "by") == 0) {
+			NEXT_ARG();
+			if (strcmp(*argv, "vlan") == 0)
+				counts.by = FDB_COUNT_VLAN;
+			else if (strcmp(*argv, "port") == 0 ||
+				 strcmp(*argv, "dev") == 0)
+				counts.by = FDB_COUNT_PORT;
+			else if (strcmp(*argv, "state") == 0)
+				counts.by = FDB_COUNT_STATE;
+			else
+				invarg("invalid count key", *argv);
 		} else {
 			if (matches(*argv, "help") == 0)
 				usage();
@@ -401,6 +575,10 @@ static int fdb_show(int argc, char **argv)
 			return nodev(filter_dev);
 	}
 
+	/*
+	 * The kernel filters fdb dumps by bridge and bridge port only,
+	 * remaining filters are applied per entry as it is received.
+	 */
 	if (rth.flags & RTNL_HANDLE_F_STRICT_CHK)
 		rc = rtnl_neighdump_req(&rth, PF_BRIDGE, fdb_dump_filter);
 	else
@@ -411,15 +589,24 @@ static int fdb_show(int argc, char **argv)
 	}
 
 	new_json_obj(json);
-	if (rtnl_dump_filter(&rth, print_fdb, stdout) < 0) {
+	if (rtnl_dump_filter(&rth, count ? count_fdb : print_fdb,
+			     count ? (void *)&counts : stdout) < 0) {
 		fprintf(stderr, "Dump terminated\n");
 		exit(1);
 	}
+	if (count)
+		print_fdb_count(&counts);
 	delete_json_obj();
 
+	hashtab_free(&counts.tbl);
 	return 0;
 }
 
+static int fdb_show(int argc, char **argv)
+{
+	return __fdb_show(argc, argv, false);
+}
+
 static void fdb_add_ext_attrs(struct nlmsghdr *n, int maxlen,
 			      bool activity_notify, bool inactive,
 			      bool norefresh)
@@ -448,7 +635,8 @@ static void fdb_add_ext_attrs(struct nlmsghdr *n, int maxlen,
 	addattr_nest_end(n, nest);
 }
 
-static int fdb_modify(int cmd, int flags, int argc, char **argv)
+static int fdb_modify(int cmd, int flags, int argc, char **argv,
+		      struct rtnl_batch *batch)
 {
 	struct {
 		struct nlmsghdr	n;
@@ -520,7 +708,7 @@ static int fdb_modify(int cmd, int flags, int argc, char **argv)
 			NEXT_ARG();
 			via = ll_name_to_index(*argv);
 			if (!via)
-				exit(nodev(*argv));
+				parse_exit(nodev(*argv));
 		} else if (strcmp(*argv, "self") == 0) {
 			req.ndm.ndm_flags |= NTF_SELF;
 		} else if (matches(*argv, "master") == 0) {
@@ -620,12 +808,36 @@ static int fdb_modify(int cmd, int flags, int argc, char **argv)
 	fdb_add_ext_attrs(&req.n, sizeof(req), activity_notify, inactive,
 			  norefresh);
 
+	if (batch)
+		return rtnl_batch_add(batch, &req.n, cmdlineno);
+
 	if (rtnl_talk(&rth, &req.n, NULL) < 0)
 		return -1;
 
 	return 0;
 }
 
+static int fdb_import_cmd(int argc, char **argv, void *data)
+{
+	struct rtnl_batch *batch = data;
+
+	if (matches(*argv, "add") == 0)
+		return fdb_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_EXCL,
+				  argc-1, argv+1, batch);
+	if (matches(*argv, "append") == 0)
+		return fdb_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_APPEND,
+				  argc-1, argv+1, batch);
+	if (matches(*argv, "replace") == 0)
+		return fdb_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_REPLACE,
+				  argc-1, argv+1, batch);
+	if (matches(*argv, "delete") == 0)
+		return fdb_modify(RTM_DELNEIGH, 0, argc-1, argv+1, batch);
+
+	fprintf(stderr, "Command \"%s\" is not supported in fdb import\n",
+		*argv);
+	return -1;
+}
+
 static int fdb_get(int argc, char **argv)
 {
 	struct {
@@ -950,13 +1162,13 @@ int do_fdb(int argc, char **argv)
 
 	if (argc > 0) {
 		if (matches(*argv, "add") == 0)
-			return fdb_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_EXCL, argc-1, argv+1);
+			return fdb_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_EXCL, argc-1, argv+1, NULL);
 		if (matches(*argv, "append") == 0)
-			return fdb_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_APPEND, argc-1, argv+1);
+			return fdb_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_APPEND, argc-1, argv+1, NULL);
 		if (matches(*argv, "replace") == 0)
-			return fdb_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_REPLACE, argc-1, argv+1);
+			return fdb_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_REPLACE, argc-1, argv+1, NULL);
 		if (matches(*argv, "delete") == 0)
-			return fdb_modify(RTM_DELNEIGH, 0, argc-1, argv+1);
+			return fdb_modify(RTM_DELNEIGH, 0, argc-1, argv+1, NULL);
 		if (matches(*argv, "get") == 0)
 			return fdb_get(argc-1, argv+1);
 		if (matches(*argv, "show") == 0 ||
@@ -965,6 +1177,11 @@ int do_fdb(int argc, char **argv)
 			return fdb_show(argc-1, argv+1);
 		if (strcmp(*argv, "flush") == 0)
 			return fdb_flush(argc-1, argv+1);
+		if (strcmp(*argv, "count") == 0)
+			return __fdb_show(argc-1, argv+1, true);
+		if (strcmp(*argv, "import") == 0)
+			return do_batch_rtnl(&rth, argc > 1 ? argv[1] : "-",
+					     fdb_import_cmd);
 		if (matches(*argv, "help") == 0)
 			usage();
 	} else
@@ -39,8 +39,9 @@ static void usage(void)
 		"       bridge mdb {show} [ dev DEV ] [ vid VID ]\n"
 		"       bridge mdb get dev DEV grp GROUP [ src SOURCE ] [ vid VID ] [ src_vni SRC_VNI ]\n"
 		"       bridge mdb flush dev DEV [ port PORT ] [ vid VID ] [ src_vni SRC_VNI ] [ proto PROTO ]\n"
-		"              [ [no]permanent ] [ dst IPADDR ] [ dst_port DST_PORT ] [ vni VNI ]\n");
-	exit(-1);
+		"              [ [no]permanent ] [ dst IPADDR ] [ dst_port DST_PORT ] [ vni VNI ]\n"
+		"       bridge mdb import [ FILE ]\n");
+	parse_exit(-1);
 }
 
 static bool is_temp_mcast_rtr(__u8 type)
@@ -689,7 +690,8 @@ static int mdb_parse_dev(struct nlmsghdr *n, int maxlen, const char *dev)
 	return 0;
 }
 
-static int mdb_modify(int cmd, int flags, int argc, char **argv)
+static int mdb_modify(int cmd, int flags, int argc, char **argv,
+		      struct rtnl_batch *batch)
 {
 	struct {
 		struct nlmsghdr	n;
@@ -846,12 +848,33 @@ static int mdb_modify(int cmd, int flags, int argc, char **argv)
 		addattr_nest_end(&req.n, nest);
 	}
 
+	if (batch)
+		return rtnl_batch_add(batch, &req.n, cmdlineno);
+
 	if (rtnl_talk(&rth, &req.n, NULL) < 0)
 		return -1;
 
 	return 0;
 }
 
+static int mdb_import_cmd(int argc, char **argv, void *data)
+{
+	struct rtnl_batch *batch = data;
+
+	if (matches(*argv, "add") == 0)
+		return mdb_modify(RTM_NEWMDB, NLM_F_CREATE|NLM_F_EXCL,
+				  argc-1, argv+1, batch);
+	if (strcmp(*argv, "replace") == 0)
+		return mdb_modify(RTM_NEWMDB, NLM_F_CREATE|NLM_F_REPLACE,
+				  argc-1, argv+1, batch);
+	if (matches(*argv, "delete") == 0)
+		return mdb_modify(RTM_DELMDB, 0, argc-1, argv+1, batch);
+
+	fprintf(stderr, "Command \"%s\" is not supported in mdb import\n",
+		*argv);
+	return -1;
+}
+
 static int mdb_get(int argc, char **argv)
 {
 	struct {
@@ -1084,11 +1107,11 @@ int do_mdb(int argc, char **argv)
 
 	if (argc > 0) {
 		if (matches(*argv, "add") == 0)
-			return mdb_modify(RTM_NEWMDB, NLM_F_CREATE|NLM_F_EXCL, argc-1, argv+1);
+			return mdb_modify(RTM_NEWMDB, NLM_F_CREATE|NLM_F_EXCL, argc-1, argv+1, NULL);
 		if (strcmp(*argv, "replace") == 0)
-			return mdb_modify(RTM_NEWMDB, NLM_F_CREATE|NLM_F_REPLACE, argc-1, argv+1);
+			return mdb_modify(RTM_NEWMDB, NLM_F_CREATE|NLM_F_REPLACE, argc-1, argv+1, NULL);
 		if (matches(*argv, "delete") == 0)
-			return mdb_modify(RTM_DELMDB, 0, argc-1, argv+1);
+			return mdb_modify(RTM_DELMDB, 0, argc-1, argv+1, NULL);
 
 		if (matches(*argv, "show") == 0 ||
 		    matches(*argv, "lst") == 0 ||
@@ -1098,6 +1121,9 @@ int do_mdb(int argc, char **argv)
 			return mdb_get(argc-1, argv+1);
 		if (strcmp(*argv, "flush") == 0)
 			return mdb_flush(argc-1, argv+1);
+		if (strcmp(*argv, "import") == 0)
+			return do_batch_rtnl(&rth, argc > 1 ? argv[1] : "-",
+					     mdb_import_cmd);
 		if (matches(*argv, "help") == 0)
 			usage();
 	} else
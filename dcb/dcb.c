@@ -471,7 +471,7 @@ static void dcb_help(void)
 		"Usage: dcb [ OPTIONS ] OBJECT { COMMAND | help }\n"
 		"       dcb [ -f | --force ] { -b | --batch } filename [ -n | --netns ] netnsname\n"
 		"where  OBJECT := { app | apptrust | buffer | dcbx | ets | maxrate | pfc | rewr }\n"
-		"       OPTIONS := [ -V | --Version | -i | --iec | -j | --json\n"
+		"       OPTIONS := [ -V | --Version | -i | --iec | -j | --json | --cbor\n"
 		"                  | -N | --Numeric | -p | --pretty\n"
 		"                  | -s | --statistics | -v | --verbose]\n");
 }
@@ -515,6 +515,8 @@ static int dcb_batch(struct dcb *dcb, const char *name, bool force)
 	return do_batch(name, force, dcb_batch_cmd, dcb);
 }
 
+#define OPT_CBOR 256
+
 int main(int argc, char **argv)
 {
 	static const struct option long_options[] = {
@@ -523,6 +525,7 @@ int main(int argc, char **argv)
 		{ "batch",		required_argument,	NULL, 'b' },
 		{ "iec",		no_argument,		NULL, 'i' },
 		{ "json",		no_argument,		NULL, 'j' },
+		{ "cbor",		no_argument,		NULL, OPT_CBOR },
 		{ "Numeric",		no_argument,		NULL, 'N' },
 		{ "pretty",		no_argument,		NULL, 'p' },
 		{ "statistics",		no_argument,		NULL, 's' },
@@ -560,6 +563,10 @@ int main(int argc, char **argv)
 		case 'j':
 			dcb->json_output = true;
 			break;
+		case OPT_CBOR:
+			dcb->json_output = true;
+			cbor = 1;
+			break;
 		case 'N':
 			dcb->numeric = true;
 			break;
@@ -204,6 +204,8 @@ static int _mnlg_socket_group_add(struct mnlu_gen_socket *nlg,
 
 struct ifname_map {
 	struct list_head list;
+	struct hlist_node name_hash;
+	struct hlist_node port_hash;
 	char *bus_name;
 	char *dev_name;
 	uint32_t port_index;
@@ -240,18 +242,6 @@ static struct ifname_map *ifname_map_alloc(const char *bus_name,
 	return ifname_map;
 }
 
-static int ifname_map_update(struct ifname_map *ifname_map, const char *ifname)
-{
-	char *new_ifname;
-
-	new_ifname = strdup(ifname);
-	if (!new_ifname)
-		return -ENOMEM;
-	free(ifname_map->ifname);
-	ifname_map->ifname = new_ifname;
-	return 0;
-}
-
 #define DL_OPT_HANDLE		BIT(0)
 #define DL_OPT_HANDLEP		BIT(1)
 #define DL_OPT_PORT_TYPE	BIT(2)
@@ -385,9 +375,15 @@ struct dl_opts {
 	uint32_t port_fn_max_io_eqs;
 };
 
+#define IFNAME_MAP_SIZE	1024
+
 struct dl {
 	struct mnlu_gen_socket nlg;
 	struct list_head ifname_map_list;
+	struct hlist_head ifname_map_names[IFNAME_MAP_SIZE];
+	struct hlist_head ifname_map_ports[IFNAME_MAP_SIZE];
+	/* port notifications keeping the map valid across batch lines */
+	struct mnlu_gen_socket nlg_map;
 	int argc;
 	char **argv;
 	char *handle_argv;
@@ -400,6 +396,9 @@ struct dl {
 	bool hex;
 	bool use_iec;
 	bool map_loaded;
+	bool map_keep;
+	bool map_watch;
+	bool map_synced;
 	struct {
 		bool present;
 		char *bus_name;
@@ -804,22 +803,96 @@ static int function_attr_cb(const struct nlattr *attr, void *data)
 	return MNL_CB_OK;
 }
 
+static unsigned int ifname_map_port_hash(const char *bus_name,
+					 const char *dev_name,
+					 uint32_t port_index)
+{
+	unsigned int h = namehash(bus_name) * 31 + namehash(dev_name);
+
+	return (h * 31 + port_index) & (IFNAME_MAP_SIZE - 1);
+}
+
+static struct ifname_map *ifname_map_find(struct dl *dl, const char *bus_name,
+					  const char *dev_name,
+					  uint32_t port_index)
+{
+	unsigned int h = ifname_map_port_hash(bus_name, dev_name, port_index);
+	struct hlist_node *n;
+
+	hlist_for_each(n, &dl->ifname_map_ports[h]) {
+		struct ifname_map *ifname_map;
+
+		ifname_map = container_of(n, struct ifname_map, port_hash);
+		if (port_index == ifname_map->port_index &&
+		    strcmp(dev_name, ifname_map->dev_name) == 0 &&
+		    strcmp(bus_name, ifname_map->bus_name) == 0)
+			return ifname_map;
+	}
+	return NULL;
+}
+
+static struct ifname_map *ifname_map_find_name(struct dl *dl,
+					       const char *ifname)
+{
+	unsigned int h = namehash(ifname) & (IFNAME_MAP_SIZE - 1);
+	struct hlist_node *n;
+
+	hlist_for_each(n, &dl->ifname_map_names[h]) {
+		struct ifname_map *ifname_map;
+
+		ifname_map = container_of(n, struct ifname_map, name_hash);
+		if (strcmp(ifname, ifname_map->ifname) == 0)
+			return ifname_map;
+	}
+	return NULL;
+}
+
+static int ifname_map_update(struct dl *dl, struct ifname_map *ifname_map,
+			     const char *ifname)
+{
+	unsigned int h = namehash(ifname) & (IFNAME_MAP_SIZE - 1);
+	char *new_ifname;
+
+	if (strcmp(ifname, ifname_map->ifname) == 0)
+		return 0;
+
+	new_ifname = strdup(ifname);
+	if (!new_ifname)
+		return -ENOMEM;
+	free(ifname_map->ifname);
+	ifname_map->ifname = new_ifname;
+	hlist_del(&ifname_map->name_hash);
+	hlist_add_head(&ifname_map->name_hash, &dl->ifname_map_names[h]);
+	return 0;
+}
+
 static int ifname_map_add(struct dl *dl, const char *ifname,
 			  const char *bus_name, const char *dev_name,
 			  uint32_t port_index)
 {
 	struct ifname_map *ifname_map;
+	unsigned int h;
+
+	ifname_map = ifname_map_find(dl, bus_name, dev_name, port_index);
+	if (ifname_map)
+		return ifname_map_update(dl, ifname_map, ifname);
 
 	ifname_map = ifname_map_alloc(bus_name, dev_name, port_index, ifname);
 	if (!ifname_map)
 		return -ENOMEM;
 	list_add(&ifname_map->list, &dl->ifname_map_list);
+	h = namehash(ifname) & (IFNAME_MAP_SIZE - 1);
+	hlist_add_head(&ifname_map->name_hash, &dl->ifname_map_names[h]);
+	h = ifname_map_port_hash(bus_name, dev_name, port_index);
+	hlist_add_head(&ifname_map->port_hash, &dl->ifname_map_ports[h]);
 	return 0;
 }
 
 static void ifname_map_del(struct ifname_map *ifname_map)
 {
 	list_del(&ifname_map->list);
+	hlist_del(&ifname_map->name_hash);
+	hlist_del(&ifname_map->port_hash);
 	ifname_map_free(ifname_map);
 }
 
@@ -899,37 +972,54 @@ out:
 	return err;
 }
 
+/* Apply a port dump reply or a port notification to the map. */
+static int ifname_map_port_update(struct dl *dl, uint8_t cmd,
+				  struct nlattr **tb)
+{
+	struct ifname_map *ifname_map;
+	const char *bus_name;
+	const char *dev_name;
+	uint32_t port_index;
+
+	bus_name = mnl_attr_get_str(tb[DEVLINK_ATTR_BUS_NAME]);
+	dev_name = mnl_attr_get_str(tb[DEVLINK_ATTR_DEV_NAME]);
+	port_index = mnl_attr_get_u32(tb[DEVLINK_ATTR_PORT_INDEX]);
+
+	if (cmd == DEVLINK_CMD_PORT_NEW && tb[DEVLINK_ATTR_PORT_NETDEV_NAME])
+		return ifname_map_add(dl,
+				      mnl_attr_get_str(tb[DEVLINK_ATTR_PORT_NETDEV_NAME]),
+				      bus_name, dev_name, port_index);
+
+	/* port removed, or its netdevice went away */
+	ifname_map = ifname_map_find(dl, bus_name, dev_name, port_index);
+	if (ifname_map)
+		ifname_map_del(ifname_map);
+	return 0;
+}
+
 static int ifname_map_cb(const struct nlmsghdr *nlh, void *data)
 {
 	struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
 	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
 	struct dl *dl = data;
-	const char *bus_name;
-	const char *dev_name;
-	uint32_t port_index;
-	const char *port_ifname;
-	int err;
+
+	/* the notification socket gets every config event */
+	if (genl->cmd != DEVLINK_CMD_PORT_NEW &&
+	    genl->cmd != DEVLINK_CMD_PORT_DEL)
+		return MNL_CB_OK;
 
 	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
 	if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
 	    !tb[DEVLINK_ATTR_PORT_INDEX])
 		return MNL_CB_ERROR;
 
-	if (!tb[DEVLINK_ATTR_PORT_NETDEV_NAME])
-		return MNL_CB_OK;
-
-	bus_name = mnl_attr_get_str(tb[DEVLINK_ATTR_BUS_NAME]);
-	dev_name = mnl_attr_get_str(tb[DEVLINK_ATTR_DEV_NAME]);
-	port_index = mnl_attr_get_u32(tb[DEVLINK_ATTR_PORT_INDEX]);
-	port_ifname = mnl_attr_get_str(tb[DEVLINK_ATTR_PORT_NETDEV_NAME]);
-	err = ifname_map_add(dl, port_ifname, bus_name, dev_name, port_index);
-	if (err)
+	if (ifname_map_port_update(dl, genl->cmd, tb))
 		return MNL_CB_ERROR;
 
 	return MNL_CB_OK;
 }
 
-static void ifname_map_fini(struct dl *dl)
+static void ifname_map_clear(struct dl *dl)
 {
 	struct ifname_map *ifname_map, *tmp;
 
@@ -937,6 +1027,16 @@ static void ifname_map_fini(struct dl *dl)
 				 &dl->ifname_map_list, list) {
 		ifname_map_del(ifname_map);
 	}
+	dl->map_loaded = false;
+}
+
+static void ifname_map_fini(struct dl *dl)
+{
+	ifname_map_clear(dl);
+	if (dl->map_watch) {
+		mnlu_gen_socket_close(&dl->nlg_map);
+		dl->map_watch = false;
+	}
 }
 
 static void ifname_map_init(struct dl *dl)
@@ -944,45 +1044,97 @@ static void ifname_map_init(struct dl *dl)
 	INIT_LIST_HEAD(&dl->ifname_map_list);
 }
 
-static int ifname_map_load(struct dl *dl, const char *ifname)
+/*
+ * When the map outlives one command, listen to port notifications before
+ * anything is loaded, so that no change slips in between.
+ */
+static int ifname_map_watch(struct dl *dl)
 {
-	struct mnlu_gen_socket nlg_map;
-	struct nlmsghdr *nlh;
 	int err;
 
-	if (ifname) {
-		err = ifname_map_rtnl_init(dl, ifname);
-		if (!err)
-			return 0;
-		/* In case kernel does not support devlink port info passed over
-		 * RT netlink, fall-back to ports dump.
-		 */
-	}
+	if (!dl->map_keep || dl->map_watch)
+		return 0;
 
-	err = mnlu_gen_socket_open(&nlg_map, DEVLINK_GENL_NAME,
+	err = mnlu_gen_socket_open(&dl->nlg_map, DEVLINK_GENL_NAME,
 				   DEVLINK_GENL_VERSION);
 	if (err)
 		return err;
 
-	nlh = mnlu_gen_socket_cmd_prepare(&nlg_map, DEVLINK_CMD_PORT_GET,
+	err = _mnlg_socket_group_add(&dl->nlg_map,
+				     DEVLINK_GENL_MCGRP_CONFIG_NAME);
+	if (err) {
+		mnlu_gen_socket_close(&dl->nlg_map);
+		return err;
+	}
+	dl->map_watch = true;
+	return 0;
+}
+
+/* Apply the port notifications received so far. */
+static int ifname_map_sync(struct dl *dl)
+{
+	struct mnlu_gen_socket *nlg = &dl->nlg_map;
+	int len;
+
+	if (!dl->map_watch)
+		return 0;
+
+	for (;;) {
+		len = recv(mnl_socket_get_fd(nlg->nl), nlg->buf,
+			   MNL_SOCKET_BUFFER_SIZE, MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			if (errno == ENOBUFS) {
+				/* notifications were lost, start over */
+				ifname_map_clear(dl);
+				continue;
+			}
+			return -errno;
+		}
+		if (mnl_cb_run(nlg->buf, len, 0, 0, ifname_map_cb, dl) < 0)
+			return -errno;
+	}
+}
+
+static int ifname_map_load(struct dl *dl)
+{
+	struct mnlu_gen_socket nlg_map;
+	struct mnlu_gen_socket *nlg = &nlg_map;
+	struct nlmsghdr *nlh;
+	int err;
+
+	if (dl->map_watch) {
+		nlg = &dl->nlg_map;
+	} else {
+		err = mnlu_gen_socket_open(&nlg_map, DEVLINK_GENL_NAME,
+					   DEVLINK_GENL_VERSION);
+		if (err)
+			return err;
+	}
+
+	nlh = mnlu_gen_socket_cmd_prepare(nlg, DEVLINK_CMD_PORT_GET,
 			       NLM_F_REQUEST | NLM_F_ACK | NLM_F_DUMP);
 
-	err = mnlu_gen_socket_sndrcv(&nlg_map, nlh, ifname_map_cb, dl);
+	err = mnlu_gen_socket_sndrcv(nlg, nlh, ifname_map_cb, dl);
 	if (err)
-		ifname_map_fini(dl);
+		ifname_map_clear(dl);
 
-	mnlu_gen_socket_close(&nlg_map);
+	if (nlg == &nlg_map)
+		mnlu_gen_socket_close(&nlg_map);
 	return err;
 }
 
-static int ifname_map_check_load(struct dl *dl, const char *ifname)
+static int ifname_map_check_load(struct dl *dl)
 {
 	int err;
 
 	if (dl->map_loaded)
 		return 0;
 
-	err = ifname_map_load(dl, ifname);
+	err = ifname_map_load(dl);
 	if (err) {
 		pr_err("Failed to create index map\n");
 		return err;
@@ -991,6 +1143,31 @@ static int ifname_map_check_load(struct dl *dl, const char *ifname)
 	return 0;
 }
 
+/* Once per batch line, catch up with what changed since the last one. */
+static int ifname_map_prepare(struct dl *dl)
+{
+	int err;
+
+	err = ifname_map_watch(dl);
+	if (err || dl->map_synced)
+		return err;
+	dl->map_synced = true;
+	return ifname_map_sync(dl);
+}
+
+/*
+ * On a miss, the port may come from a request of an earlier line which
+ * is still queued; wait for those answers and their notifications.
+ */
+static int ifname_map_settle(struct dl *dl)
+{
+	if (!dl->map_watch || !dl->nlg.batch || !dl->nlg.batch->count)
+		return 0;
+
+	if (mnlu_gen_socket_batch_flush(&dl->nlg) < 0)
+		return -EIO;
+	return ifname_map_sync(dl);
+}
 
 static int ifname_map_lookup(struct dl *dl, const char *ifname,
 			     char **p_bus_name, char **p_dev_name,
@@ -999,19 +1176,35 @@ static int ifname_map_lookup(struct dl *dl, const char *ifname,
 	struct ifname_map *ifname_map;
 	int err;
 
-	err = ifname_map_check_load(dl, ifname);
+	err = ifname_map_prepare(dl);
 	if (err)
 		return err;
 
-	list_for_each_entry(ifname_map, &dl->ifname_map_list, list) {
-		if (strcmp(ifname, ifname_map->ifname) == 0) {
-			*p_bus_name = ifname_map->bus_name;
-			*p_dev_name = ifname_map->dev_name;
-			*p_port_index = ifname_map->port_index;
-			return 0;
+	ifname_map = ifname_map_find_name(dl, ifname);
+	if (!ifname_map) {
+		err = ifname_map_settle(dl);
+		if (err)
+			return err;
+		ifname_map = ifname_map_find_name(dl, ifname);
+	}
+	if (!ifname_map && !dl->map_loaded) {
+		/* In case kernel does not support devlink port info passed
+		 * over RT netlink, fall-back to ports dump.
+		 */
+		if (ifname_map_rtnl_init(dl, ifname)) {
+			err = ifname_map_check_load(dl);
+			if (err)
+				return err;
 		}
+		ifname_map = ifname_map_find_name(dl, ifname);
 	}
-	return -ENOENT;
+	if (!ifname_map)
+		return -ENOENT;
+
+	*p_bus_name = ifname_map->bus_name;
+	*p_dev_name = ifname_map->dev_name;
+	*p_port_index = ifname_map->port_index;
+	return 0;
 }
 
 static int ifname_map_rev_lookup(struct dl *dl, const char *bus_name,
@@ -1019,28 +1212,36 @@ static int ifname_map_rev_lookup(struct dl *dl, const char *bus_name,
 				 const char **p_ifname)
 {
 	struct ifname_map *ifname_map;
-
 	int err;
 
-	err = ifname_map_check_load(dl, NULL);
+	err = ifname_map_prepare(dl);
 	if (err)
 		return err;
 
-	list_for_each_entry(ifname_map, &dl->ifname_map_list, list) {
-		if (strcmp(bus_name, ifname_map->bus_name) == 0 &&
-		    strcmp(dev_name, ifname_map->dev_name) == 0 &&
-		    port_index == ifname_map->port_index) {
-			/* In case non-NULL ifname is passed, update the
-			 * looked-up entry.
-			 */
-			if (*p_ifname)
-				return ifname_map_update(ifname_map, *p_ifname);
-
-			*p_ifname = ifname_map->ifname;
-			return 0;
-		}
+	ifname_map = ifname_map_find(dl, bus_name, dev_name, port_index);
+	if (!ifname_map) {
+		err = ifname_map_settle(dl);
+		if (err)
+			return err;
+		ifname_map = ifname_map_find(dl, bus_name, dev_name,
+					     port_index);
 	}
-	return -ENOENT;
+	if (!ifname_map && !dl->map_loaded) {
+		err = ifname_map_check_load(dl);
+		if (err)
+			return err;
+		ifname_map = ifname_map_find(dl, bus_name, dev_name,
+					     port_index);
+	}
+	if (!ifname_map)
+		return -ENOENT;
+
+	/* In case non-NULL ifname is passed, update the looked-up entry. */
+	if (*p_ifname)
+		return ifname_map_update(dl, ifname_map, *p_ifname);
+
+	*p_ifname = ifname_map->ifname;
+	return 0;
 }
 
 static int ident_str_validate(char *str, unsigned int expected)
@@ -4625,6 +4826,11 @@ static int cmd_dev_flash(struct dl *dl)
 	if (err)
 		return err;
 
+	/* the child sends on the same socket, nothing queued may be left */
+	err = mnlu_gen_socket_batch_flush(&dl->nlg);
+	if (err < 0)
+		return err;
+
 	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, DEVLINK_CMD_FLASH_UPDATE,
 			       NLM_F_REQUEST | NLM_F_ACK);
 
@@ -4659,6 +4865,7 @@ static int cmd_dev_flash(struct dl *dl)
 		int cc;
 
 		close(pipe_r);
+		dl->nlg.batch = NULL;
 		err = _mnlg_socket_send(&dl->nlg, nlh);
 		cc = write(pipe_w, &err, sizeof(err));
 		close(pipe_w);
@@ -7188,6 +7395,9 @@ static int cmd_mon_show_cb(const struct nlmsghdr *nlh, void *data)
 		if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
 		    !tb[DEVLINK_ATTR_PORT_INDEX])
 			return MNL_CB_ERROR;
+		if (dl->map_loaded &&
+		    ifname_map_port_update(dl, genl->cmd, tb))
+			return MNL_CB_ERROR;
 		pr_out_mon_header(genl->cmd);
 		pr_out_port(dl, tb);
 		pr_out_mon_footer();
@@ -10349,7 +10559,7 @@ static void help(void)
 	pr_err("Usage: devlink [ OPTIONS ] OBJECT { COMMAND | help }\n"
 	       "       devlink [ -f[orce] ] -b[atch] filename -N[etns] netnsname\n"
 	       "where  OBJECT := { dev | port | lc | sb | monitor | dpipe | resource | region | health | trap }\n"
-	       "       OPTIONS := { -V[ersion] | -n[o-nice-names] | -j[son] | -p[retty] | -v[erbose] -s[tatistics] -[he]x }\n");
+	       "       OPTIONS := { -V[ersion] | -n[o-nice-names] | -j[son] | --cbor | -p[retty] | -v[erbose] -s[tatistics] -[he]x }\n");
 }
 
 static int dl_cmd(struct dl *dl, int argc, char **argv)
@@ -10439,14 +10649,62 @@ static int dl_batch_cmd(int argc, char *argv[], void *data)
 {
 	struct dl *dl = data;
 
+	dl->map_synced = false;
+
 	return dl_cmd(dl, argc, argv);
 }
 
+static int dl_batch_report(struct rtnl_batch *b, __u32 cookie, int error,
+			   struct nlmsghdr *n, void *arg)
+{
+	if (!error)
+		return 0;
+
+	fprintf(stderr, "%s:%u: ", (const char *)arg, cookie);
+	if (!nl_dump_ext_ack(n, NULL))
+		fprintf(stderr, "devlink answers: %s\n", strerror(-error));
+	return 0;
+}
+
 static int dl_batch(struct dl *dl, const char *name, bool force)
 {
-	return do_batch(name, force, dl_batch_cmd, dl);
+	struct rtnl_handle rth = {};
+	struct rtnl_batch batch;
+	int ret;
+
+	dl->map_keep = true;
+
+	/*
+	 * Without -force the batch stops at the first failing line, so
+	 * every request has to be answered before the next one is read.
+	 */
+	if (!force)
+		return do_batch(name, force, dl_batch_cmd, dl);
+
+	/* requests without a reply to print are only waited for in bulk */
+	rth.fd = mnl_socket_get_fd(dl->nlg.nl);
+	rth.local.nl_pid = mnl_socket_get_portid(dl->nlg.nl);
+	if (rtnl_batch_init(&batch, &rth, dl_batch_report, (void *)name) < 0)
+		return EXIT_FAILURE;
+
+	dl->nlg.batch = &batch;
+	ret = do_batch(name, force, dl_batch_cmd, dl);
+	if (mnlu_gen_socket_batch_flush(&dl->nlg) < 0)
+		ret = EXIT_FAILURE;
+	dl->nlg.batch = NULL;
+
+	if (batch.errors) {
+		fprintf(stderr, "%s: %llu of %llu requests failed\n", name,
+			(unsigned long long)batch.errors,
+			(unsigned long long)batch.sent);
+		ret = EXIT_FAILURE;
+	}
+	rtnl_batch_free(&batch);
+	return ret;
 }
 
+#define OPT_CBOR 256
+
 int main(int argc, char **argv)
 {
 	static const struct option long_options[] = {
@@ -10455,6 +10713,7 @@ int main(int argc, char **argv)
 		{ "batch",		required_argument,	NULL, 'b' },
 		{ "no-nice-names",	no_argument,		NULL, 'n' },
 		{ "json",		no_argument,		NULL, 'j' },
+		{ "cbor",		no_argument,		NULL, OPT_CBOR },
 		{ "pretty",		no_argument,		NULL, 'p' },
 		{ "verbose",		no_argument,		NULL, 'v' },
 		{ "statistics",		no_argument,		NULL, 's' },
@@ -10496,6 +10755,10 @@ int main(int argc, char **argv)
 		case 'j':
 			dl->json_output = true;
 			break;
+		case OPT_CBOR:
+			dl->json_output = true;
+			cbor = 1;
+			break;
 		case 'p':
 			pretty = true;
 			break;
@@ -481,7 +481,8 @@ static void help(void)
 {
 	pr_err("Usage: dpll [ OPTIONS ] OBJECT { COMMAND | help }\n"
 	       "where  OBJECT := { device | pin | monitor }\n"
-	       "       OPTIONS := { -V | --Version | -j | --json | -p | --pretty }\n");
+	       "       OPTIONS := { -V | --Version | -j | --json | --cbor |\n"
+	       "                  -p | --pretty }\n");
 }
 
 static int cmd_device(struct dpll *dpll);
@@ -539,11 +540,14 @@ static void dpll_free(struct dpll *dpll)
 	free(dpll);
 }
 
+#define OPT_CBOR 256
+
 int main(int argc, char **argv)
 {
 	static const struct option long_options[] = {
 		{ "Version", no_argument, NULL, 'V' },
 		{ "json", no_argument, NULL, 'j' },
+		{ "cbor", no_argument, NULL, OPT_CBOR },
 		{ "pretty", no_argument, NULL, 'p' },
 		{ NULL, 0, NULL, 0 }
 	};
@@ -567,6 +571,10 @@ int main(int argc, char **argv)
 		case 'j':
 			json = 1;
 			break;
+		case OPT_CBOR:
+			json = 1;
+			cbor = 1;
+			break;
 		case 'p':
 			pretty = true;
 			break;
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+#ifndef __HASHTAB_H__
+#define __HASHTAB_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/types.h>
+
+/*
+ * Open addressing hash table of fixed size records, keyed by their first
+ * key_len bytes.  Any padding inside the key must be zeroed.  The table
+ * is power of two sized and kept at most half full.
+ */
+struct hashtab {
+	char		*slots;
+	__u8		*busy;
+	size_t		elem_size;
+	size_t		key_len;
+	unsigned int	size;
+	unsigned int	used;
+};
+
+/* record of a table made by hashtab_counter_init() */
+struct hashtab_counter {
+	__u32	key;
+	__u64	count;
+};
+
+void hashtab_init(struct hashtab *t, size_t elem_size, size_t key_len);
+void hashtab_counter_init(struct hashtab *t);
+void hashtab_reset(struct hashtab *t);
+void hashtab_free(struct hashtab *t);
+
+void *hashtab_lookup(const struct hashtab *t, const void *key);
+void *hashtab_insert(struct hashtab *t, const void *key, bool *found);
+void *hashtab_next(const struct hashtab *t, unsigned int *pos);
+unsigned int hashtab_sort(struct hashtab *t,
+			  int (*cmp)(const void *a, const void *b));
+
+int hashtab_count(struct hashtab *t, __u32 key);
+int hashtab_counter_cmp(const void *a, const void *b);
+
+#define hashtab_for_each(t, pos, e)					\
+	for ((pos) = 0; ((e) = hashtab_next((t), &(pos))) != NULL; )
+
+#endif /* __HASHTAB_H__ */
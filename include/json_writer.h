@@ -25,6 +25,9 @@ void jsonw_destroy(json_writer_t **self_p);
 /* Cause output to have pretty whitespace */
 void jsonw_pretty(json_writer_t *self, bool on);
 
+/* Produce CBOR instead of JSON text */
+void jsonw_cbor(json_writer_t *self, bool on);
+
 /* Add property name */
 void jsonw_name(json_writer_t *self, const char *name);
 
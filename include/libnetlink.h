@@ -118,7 +118,9 @@ int rtnl_tunneldump_req(struct rtnl_handle *rth, int family, int ifindex,
 	__attribute__((warn_unused_result));
 
 struct rtnl_ctrl_data {
-	int	nsid;
+	int			nsid;
+	/* when the message was read off the socket, NULL if not known */
+	const struct timeval	*tstamp;
 };
 
 typedef int (*rtnl_filter_t)(struct nlmsghdr *n, void *);
@@ -147,6 +149,13 @@ typedef int (*rtnl_err_hndlr_t)(struct nlmsghdr *n, void *);
 typedef int (*rtnl_listen_filter_t)(struct rtnl_ctrl_data *,
 				    struct nlmsghdr *n, void *);
 
+/**
+ * rtnl periodic callback called from rtnl_listen_timed() once per
+ * interval with the number of socket overruns (ENOBUFS) seen since the
+ * previous call.
+ */
+typedef int (*rtnl_listen_tick_t)(unsigned int overruns, void *);
+
 typedef int (*nl_ext_ack_fn_t)(const char *errmsg, uint32_t off,
 			       const struct nlmsghdr *inner_nlh);
 
@@ -301,12 +310,122 @@ static inline int rta_type(const struct rtattr *rta)
 	return rta->rta_type & NLA_TYPE_MASK;
 }
 
+/* growable buffer of netlink messages, e.g. requests queued for a batch */
+struct rtnl_msgbuf {
+	char		*buf;
+	size_t		len;
+	size_t		size;
+	__u64		count;
+};
+
+struct nlmsghdr *rtnl_msgbuf_reserve(struct rtnl_msgbuf *mb, unsigned int len);
+void rtnl_msgbuf_commit(struct rtnl_msgbuf *mb, struct nlmsghdr *n);
+int rtnl_msgbuf_add(struct rtnl_msgbuf *mb, const struct nlmsghdr *n);
+void rtnl_msgbuf_free(struct rtnl_msgbuf *mb);
+
+#define rtnl_msgbuf_for_each(mb, n)					\
+	for (n = (struct nlmsghdr *)(mb)->buf;				\
+	     (char *)(n) < (mb)->buf + (mb)->len;				\
+	     n = (struct nlmsghdr *)((char *)(n) + NLMSG_ALIGN((n)->nlmsg_len)))
+
+struct rtnl_batch;
+
+/**
+ * rtnl batch callback, called for every failed request with a negative
+ * errno and its NLMSG_ERROR message, and for every reply with error 0.
+ * Returning a negative value aborts the batch.
+ */
+typedef int (*rtnl_batch_cb_t)(struct rtnl_batch *b, __u32 cookie,
+			       int error, struct nlmsghdr *n, void *arg);
+
+struct rtnl_batch {
+	struct rtnl_handle	*rth;
+	rtnl_batch_cb_t		cb;
+	void			*arg;
+
+	char			*buf;
+	unsigned int		len;
+	unsigned int		max_len;
+	__u32			*cookies;
+	unsigned int		count;
+	unsigned int		max_msgs;
+	__u32			seq;
+	char			*rbuf;
+
+	__u64			sent;
+	__u64			acked;
+	__u64			errors;
+};
+
+int rtnl_batch_init(struct rtnl_batch *b, struct rtnl_handle *rth,
+		    rtnl_batch_cb_t cb, void *arg)
+	__attribute__((warn_unused_result));
+int rtnl_batch_add(struct rtnl_batch *b, struct nlmsghdr *n, __u32 cookie);
+int rtnl_batch_flush(struct rtnl_batch *b);
+void rtnl_batch_free(struct rtnl_batch *b);
+void rtnl_print_ack_error(struct nlmsghdr *n);
+int rtnl_batch_report_line(struct rtnl_batch *b, __u32 cookie, int error,
+			   struct nlmsghdr *n, void *arg);
+
 int rtnl_listen_all_nsid(struct rtnl_handle *);
 int rtnl_listen(struct rtnl_handle *, rtnl_listen_filter_t handler,
 		void *jarg);
+int rtnl_listen_timed(struct rtnl_handle *, rtnl_listen_filter_t handler,
+		      rtnl_listen_tick_t tick, unsigned int interval_ms,
+		      void *jarg);
+int rtnl_listen_threaded(struct rtnl_handle *, rtnl_listen_filter_t handler,
+			 size_t ring_size, void *jarg);
 int rtnl_from_file(FILE *, rtnl_listen_filter_t handler,
 		   void *jarg);
 
+/*
+ * Block format of the rtmon log: a struct rtmon_log_hdr, then blocks
+ * each holding a run of the plain capture format (messages and
+ * NLMSG_TSTAMP records, starting with a stamp), zlib compressed if
+ * RTMON_BLOCK_ZLIB is set.  The block header tells the time span and
+ * message types inside, so a reader can skip blocks it is not after.
+ */
+#define RTMON_LOG_MAGIC		0x474f4c52	/* "RLOG" */
+#define RTMON_LOG_VERSION	1
+#define RTMON_BLOCK_MAGIC	0x4b4c4252	/* "RBLK" */
+#define RTMON_BLOCK_ZLIB	0x1
+
+struct rtmon_log_hdr {
+	__u32	magic;
+	__u32	version;
+};
+
+struct rtmon_block_hdr {
+	__u32	magic;
+	__u32	flags;
+	__u32	len;		/* stored bytes following the header */
+	__u32	raw_len;	/* bytes after decompression */
+	__u32	count;		/* messages, not counting stamps */
+	__u32	first_sec;	/* first and last stamp in the block */
+	__u32	last_sec;
+	__u32	types[4];	/* message types, see rtnl_log_type_set() */
+};
+
+/* messages read back by rtnl_from_file_filter() */
+struct rtnl_log_filter {
+	__u32	from;		/* first and last second, both included */
+	__u32	to;
+	__u32	types[4];	/* message types, none set matches any */
+	/* if set, gets the link messages filtered out */
+	rtnl_listen_filter_t link;
+};
+
+/* types past 127 share the last bit */
+static inline void rtnl_log_type_set(__u32 *types, __u16 type)
+{
+	if (type > 127)
+		type = 127;
+	types[type / 32] |= 1U << (type % 32);
+}
+
+int rtnl_from_file_filter(FILE *, const struct rtnl_log_filter *filter,
+			  rtnl_listen_filter_t handler, void *jarg);
+
 #define NLMSG_TAIL(nmsg) \
 	((struct rtattr *) (((void *) (nmsg)) + NLMSG_ALIGN((nmsg)->nlmsg_len)))
 
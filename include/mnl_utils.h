@@ -2,6 +2,25 @@
 #ifndef __MNL_UTILS_H__
 #define __MNL_UTILS_H__ 1
 
+#include <linux/genetlink.h>
+
+#define MNLU_GENL_MAX_GROUPS	16
+
+/* what CTRL_CMD_GETFAMILY tells about a generic netlink family */
+struct mnlu_genl_family {
+	char name[GENL_NAMSIZ];
+	uint16_t id;
+	uint32_t version;
+	uint32_t maxattr;
+	unsigned int ngroups;
+	struct {
+		char name[GENL_NAMSIZ];
+		uint32_t id;
+	} groups[MNLU_GENL_MAX_GROUPS];
+};
+
+struct rtnl_batch;
+
 struct mnlu_gen_socket {
 	struct mnl_socket *nl;
 	char *buf;
@@ -9,6 +28,9 @@ struct mnlu_gen_socket {
 	uint32_t maxattr;
 	unsigned int seq;
 	uint8_t version;
+	const struct mnlu_genl_family *fam;
+	/* if set, requests expecting only an ack are queued here */
+	struct rtnl_batch *batch;
 };
 
 int mnlu_gen_socket_open(struct mnlu_gen_socket *nlg, const char *family_name,
@@ -22,6 +44,7 @@ struct nlmsghdr *mnlu_gen_socket_cmd_prepare(struct mnlu_gen_socket *nlg,
 					     uint8_t cmd, uint16_t flags);
 int mnlu_gen_socket_sndrcv(struct mnlu_gen_socket *nlg, const struct nlmsghdr *nlh,
 			   mnl_cb_t data_cb, void *data);
+int mnlu_gen_socket_batch_flush(struct mnlu_gen_socket *nlg);
 
 struct mnl_socket *mnlu_socket_open(int bus);
 int mnl_add_nl_group(struct mnl_socket *nl, unsigned int group);
@@ -32,6 +55,8 @@ int mnlu_socket_recv_run(struct mnl_socket *nl, unsigned int seq, void *buf, siz
 int mnlu_gen_socket_recv_run(struct mnlu_gen_socket *nlg, mnl_cb_t cb,
 			     void *data);
 int mnlu_gen_cmd_dump_policy(struct mnlu_gen_socket *nlg, uint8_t cmd);
+int mnlu_genl_family_group(const struct mnlu_genl_family *fam,
+			   const char *name, uint32_t *id);
 
 #ifndef HAVE_MNL_ATTR_GET_UINT
 uint64_t mnl_attr_get_uint(const struct nlattr *attr);
@@ -12,6 +12,7 @@ struct db_entry {
 
 struct db_names {
 	unsigned int size;
+	unsigned int count;
 	struct db_entry *cached;
 	struct db_entry **hash;
 	int max;
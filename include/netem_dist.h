@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __NETEM_DIST_H__
+#define __NETEM_DIST_H__
+
+/*
+ * Binary netem distribution table, as written by "maketable -b" and
+ * read by tc from $(LIBDIR)/tc/NAME.bdist.
+ *
+ * All fields are little endian.  The header is followed by 'size'
+ * signed 16 bit entries scaled by NETEM_DIST_SCALE; 'csum' is the
+ * FNV-1a hash of those entries as stored on disk.
+ */
+
+#include <stdint.h>
+
+#define NETEM_BDIST_MAGIC	0x5444424e	/* "NBDT" */
+#define NETEM_BDIST_VERSION	1
+
+struct netem_bdist_hdr {
+	uint32_t	magic;
+	uint16_t	version;
+	uint16_t	reserved;
+	uint32_t	size;
+	uint32_t	csum;
+};
+
+static inline uint32_t netem_bdist_csum(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint32_t h = 2166136261u;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+#endif /* __NETEM_DIST_H__ */
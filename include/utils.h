@@ -29,6 +29,7 @@ extern int oneline;
 extern int brief;
 extern int json;
 extern int pretty;
+extern int cbor;
 extern int timestamp;
 extern int timestamp_short;
 extern const char * _SL_;
@@ -186,6 +187,7 @@ const char *rt_addr_n2a(int af, int len, const void *addr);
 int read_family(const char *name);
 const char *family_name(int family);
 
+void parse_exit(int status) __attribute__((noreturn));
 void missarg(const char *) __attribute__((noreturn));
 void invarg(const char *, const char *) __attribute__((noreturn));
 void duparg(const char *, const char *) __attribute__((noreturn));
@@ -250,9 +252,28 @@ static inline void __jiffies_to_tv(struct timeval *tv, unsigned long jiffies)
 	tv->tv_usec = tvusec - 1000000 * tv->tv_sec;
 }
 
+static inline void timespec_add_ms(struct timespec *ts, unsigned int ms)
+{
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (ms % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+/* milliseconds from b to a, negative if a is earlier */
+static inline long timespec_diff_ms(const struct timespec *a,
+				    const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000L +
+	       (a->tv_nsec - b->tv_nsec) / 1000000L;
+}
+
 void print_escape_buf(const __u8 *buf, size_t len, const char *escape);
 
 int print_timestamp(FILE *fp);
+int print_timestamp_tv(FILE *fp, const struct timeval *tv);
 void print_nlmsg_timestamp(FILE *fp, const struct nlmsghdr *n);
 
 unsigned int print_name_and_link(const char *fmt,
@@ -331,6 +352,26 @@ void print_num(FILE *fp, unsigned int width, uint64_t count);
 
 int do_batch(const char *name, bool force,
 	     int (*cmd)(int argc, char *argv[], void *user), void *user);
+int do_batch_fp(FILE *in, const char *name, bool force,
+		int (*cmd)(int argc, char *argv[], void *user), void *user);
+int do_batch_fp_rtnl(FILE *fp, const char *name,
+		     int (*cmd)(int argc, char *argv[], void *data),
+		     void *data);
+int batch_report(const char *name, const char *what, __u64 failed,
+		 __u64 total);
+int do_batch_rtnl(struct rtnl_handle *rth, const char *name,
+		  int (*cmd)(int argc, char *argv[], void *batch));
+
+/* progress and rate reporting on stderr for long running bulk operations */
+struct bulk_progress {
+	const char	*what;
+	struct timespec	start;
+	struct timespec	last;
+};
+
+void bulk_progress_init(struct bulk_progress *p, const char *what);
+void bulk_progress_update(struct bulk_progress *p, __u64 done, __u64 total);
+void bulk_progress_done(struct bulk_progress *p, __u64 done, __u64 failed);
 
 int parse_one_of(const char *msg, const char *realval, const char * const *list,
 		 size_t len, int *p_err);
@@ -32,6 +32,10 @@ struct link_filter {
 	int vfinfo;
 };
 
+/* magic heading "ip route save" and "ip rule save" streams */
+#define IP_ROUTE_DUMP_MAGIC	0x45311224
+#define IP_RULE_DUMP_MAGIC	0x71706986
+
 const char *get_ip_lib_dir(void);
 
 int get_operstate(const char *name);
@@ -51,6 +55,7 @@ void ipneigh_reset_filter(int ifindex);
 void ipnetconf_reset_filter(int ifindex);
 
 int print_route(struct nlmsghdr *n, void *arg);
+int iproute_lookup(int argc, char **argv);
 int print_mroute(struct nlmsghdr *n, void *arg);
 int print_prefix(struct nlmsghdr *n, void *arg);
 int print_rule(struct nlmsghdr *n, void *arg);
@@ -16,9 +16,11 @@
 #include <string.h>
 #include <time.h>
 
+#include "rt_names.h"
 #include "utils.h"
 #include "ip_common.h"
 #include "nh_common.h"
+#include "hashtab.h"
 
 static void usage(void) __attribute__((noreturn));
 static int prefix_banner;
@@ -30,10 +32,12 @@ static void usage(void)
 {
 	fprintf(stderr,
 		"Usage: ip monitor [ all | OBJECTS ] [ FILE ] [ label ] [ all-nsid ]\n"
-		"                  [ dev DEVICE ]\n"
+		"                  [ dev DEVICE ] [ threaded [ ring SIZE ] ]\n"
+		"                  [ summary [ interval MSECS ] [ coalesce ] ]\n"
 		"OBJECTS :=  address | link | mroute | maddress | acaddress | neigh |\n"
 		"            netconf | nexthop | nsid | prefix | route | rule | stats\n"
-		"FILE := file FILENAME\n");
+		"FILE := file FILENAME [ from TIME ] [ to TIME ]\n"
+		"TIME := { SECONDS | YYYY-MM-DD[ HH:MM[:SS]] }\n");
 	exit(-1);
 }
 
@@ -42,8 +46,13 @@ void print_headers(FILE *fp, const char *label)
 	if (!do_monitor)
 		return;
 
-	if (timestamp)
-		print_timestamp(fp);
+	if (timestamp) {
+		/* the threaded monitor may print events well after they came */
+		if (ctrl_data && ctrl_data->tstamp)
+			print_timestamp_tv(fp, ctrl_data->tstamp);
+		else
+			print_timestamp(fp);
+	}
 
 	if (listen_all_nsid) {
 		if (ctrl_data == NULL || ctrl_data->nsid < 0)
@@ -175,6 +184,348 @@ static int accept_msg(struct rtnl_ctrl_data *ctrl,
 	return 0;
 }
 
+/*
+ * Summary mode: instead of printing every event, classify it into
+ * per-type, per-table, per-protocol and per-device counters, which are
+ * printed and reset once per interval.  With "coalesce", repeated
+ * updates of the same object (route prefix, neighbour, address, link)
+ * within an interval are counted once.
+ */
+enum {
+	MON_LINK,
+	MON_ADDR,
+	MON_ROUTE,
+	MON_NEIGH,
+	MON_RULE,
+	MON_NEXTHOP,
+	MON_NETCONF,
+	MON_OTHER,
+	MON_KIND_MAX,
+};
+
+static const char * const mon_kind_names[MON_KIND_MAX] = {
+	[MON_LINK]	= "link",
+	[MON_ADDR]	= "address",
+	[MON_ROUTE]	= "route",
+	[MON_NEIGH]	= "neigh",
+	[MON_RULE]	= "rule",
+	[MON_NEXTHOP]	= "nexthop",
+	[MON_NETCONF]	= "netconf",
+	[MON_OTHER]	= "other",
+};
+
+struct mon_obj {
+	__u32	kind;
+	__s32	ifindex;
+	__u32	table;
+	__u32	metric;
+	__u8	family;
+	__u8	len;
+	__u8	tos;
+	__u8	pad;
+	__u8	addr[16];
+	__u32	count;	/* not part of the key */
+};
+
+struct mon_summary {
+	unsigned int	interval;
+	bool		coalesce;
+	int		ifindex;
+	__u64		events;
+	__u64		coalesced;
+	__u64		overruns;
+	__u64		new[MON_KIND_MAX];
+	__u64		del[MON_KIND_MAX];
+
+	struct hashtab	objs;
+	struct hashtab	devs;
+	struct hashtab	tables;
+	struct hashtab	protos;
+};
+
+static void mon_summary_init(struct mon_summary *s)
+{
+	hashtab_init(&s->objs, sizeof(struct mon_obj),
+		     offsetof(struct mon_obj, count));
+	hashtab_counter_init(&s->devs);
+	hashtab_counter_init(&s->tables);
+	hashtab_counter_init(&s->protos);
+}
+
+static void mon_oom(void)
+{
+	fprintf(stderr, "ip monitor: out of memory\n");
+	exit(1);
+}
+
+static void mon_obj_add(struct mon_summary *s, const struct mon_obj *key)
+{
+	struct mon_obj *slot;
+	bool found;
+
+	slot = hashtab_insert(&s->objs, key, &found);
+	if (!slot)
+		mon_oom();
+	if (found)
+		s->coalesced++;
+	slot->count++;
+}
+
+static void mon_counter_inc(struct hashtab *t, __u32 key)
+{
+	if (hashtab_count(t, key))
+		mon_oom();
+}
+
+static void mon_summary_reset(struct mon_summary *s)
+{
+	s->events = s->coalesced = s->overruns = 0;
+	memset(s->new, 0, sizeof(s->new));
+	memset(s->del, 0, sizeof(s->del));
+	hashtab_reset(&s->objs);
+	hashtab_reset(&s->devs);
+	hashtab_reset(&s->tables);
+	hashtab_reset(&s->protos);
+}
+
+static void mon_obj_addr(struct mon_obj *key, const struct rtattr *rta)
+{
+	if (rta)
+		memcpy(key->addr, RTA_DATA(rta),
+		       min((int)RTA_PAYLOAD(rta), (int)sizeof(key->addr)));
+}
+
+/*
+ * Fill in the object key of an event and return the route protocol,
+ * 0 for other events, or -1 for events that are not counted.
+ */
+static int mon_classify(struct nlmsghdr *n, struct mon_obj *key)
+{
+	struct rtattr *tb[RTA_MAX + 1];
+
+	switch (n->nlmsg_type) {
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE: {
+		struct rtmsg *r = NLMSG_DATA(n);
+		int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+
+		if (len < 0 || (r->rtm_flags & RTM_F_CLONED))
+			return -1;
+		parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+		key->kind = MON_ROUTE;
+		key->family = r->rtm_family;
+		key->len = r->rtm_dst_len;
+		key->tos = r->rtm_tos;
+		key->table = rtm_get_table(r, tb);
+		if (tb[RTA_PRIORITY])
+			key->metric = rta_getattr_u32(tb[RTA_PRIORITY]);
+		if (tb[RTA_OIF])
+			key->ifindex = rta_getattr_u32(tb[RTA_OIF]);
+		mon_obj_addr(key, tb[RTA_DST]);
+		return r->rtm_protocol;
+	}
+	case RTM_NEWADDR:
+	case RTM_DELADDR: {
+		struct ifaddrmsg *ifa = NLMSG_DATA(n);
+		int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa));
+
+		if (len < 0)
+			return -1;
+		parse_rtattr(tb, IFA_MAX, IFA_RTA(ifa), len);
+		key->kind = MON_ADDR;
+		key->family = ifa->ifa_family;
+		key->len = ifa->ifa_prefixlen;
+		key->ifindex = ifa->ifa_index;
+		mon_obj_addr(key, tb[IFA_LOCAL] ? : tb[IFA_ADDRESS]);
+		return 0;
+	}
+	case RTM_NEWNEIGH:
+	case RTM_DELNEIGH: {
+		struct ndmsg *r = NLMSG_DATA(n);
+		int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+
+		if (len < 0)
+			return -1;
+		if (preferred_family && r->ndm_family != preferred_family)
+			return -1;
+		parse_rtattr(tb, NDA_MAX, NDA_RTA(r), len);
+		key->kind = MON_NEIGH;
+		key->family = r->ndm_family;
+		key->ifindex = r->ndm_ifindex;
+		mon_obj_addr(key, tb[NDA_DST]);
+		return 0;
+	}
+	case RTM_NEWLINK:
+	case RTM_DELLINK: {
+		struct ifinfomsg *ifi = NLMSG_DATA(n);
+
+		if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+			return -1;
+		ll_remember_index(n, NULL);
+		key->kind = MON_LINK;
+		key->ifindex = ifi->ifi_index;
+		return 0;
+	}
+	case RTM_NEWRULE:
+	case RTM_DELRULE:
+		key->kind = MON_RULE;
+		return 0;
+	case RTM_NEWNEXTHOP:
+	case RTM_DELNEXTHOP:
+	case RTM_NEWNEXTHOPBUCKET:
+	case RTM_DELNEXTHOPBUCKET:
+		key->kind = MON_NEXTHOP;
+		return 0;
+	case RTM_NEWNETCONF:
+	case RTM_DELNETCONF:
+		key->kind = MON_NETCONF;
+		return 0;
+	case NLMSG_ERROR:
+	case NLMSG_NOOP:
+	case NLMSG_DONE:
+	case NLMSG_TSTAMP:
+		return -1;
+	default:
+		key->kind = MON_OTHER;
+		return 0;
+	}
+}
+
+static int accept_msg_summary(struct rtnl_ctrl_data *ctrl,
+			      struct nlmsghdr *n, void *arg)
+{
+	struct mon_summary *s = arg;
+	struct mon_obj key = {};
+	int proto;
+
+	proto = mon_classify(n, &key);
+	if (proto < 0)
+		return 0;
+	if (s->ifindex && key.ifindex != s->ifindex)
+		return 0;
+
+	s->events++;
+	switch (n->nlmsg_type) {
+	case RTM_DELROUTE:
+	case RTM_DELADDR:
+	case RTM_DELNEIGH:
+	case RTM_DELLINK:
+	case RTM_DELRULE:
+	case RTM_DELNEXTHOP:
+	case RTM_DELNEXTHOPBUCKET:
+	case RTM_DELNETCONF:
+	case RTM_DELNSID:
+	case RTM_DELMULTICAST:
+	case RTM_DELANYCAST:
+	case RTM_DELADDRLABEL:
+		s->del[key.kind]++;
+		break;
+	default:
+		s->new[key.kind]++;
+	}
+
+	if (key.ifindex)
+		mon_counter_inc(&s->devs, key.ifindex);
+	if (key.kind == MON_ROUTE) {
+		mon_counter_inc(&s->tables, key.table);
+		mon_counter_inc(&s->protos, proto);
+	}
+
+	if (s->coalesce && key.kind <= MON_NEIGH)
+		mon_obj_add(s, &key);
+	return 0;
+}
+
+static const char *mon_dev_n2a(__u32 key, char *buf, int len)
+{
+	return ll_index_to_name(key);
+}
+
+static const char *mon_proto_n2a(__u32 key, char *buf, int len)
+{
+	return rtnl_rtprot_n2a(key, buf, len);
+}
+
+/* sorted by key, which leaves the table empty */
+static void print_mon_counters(struct hashtab *t, const char *name,
+			       const char *(*n2a)(__u32 key, char *buf,
+						  int len))
+{
+	struct hashtab_counter *c = (struct hashtab_counter *)t->slots;
+	unsigned int n = hashtab_sort(t, hashtab_counter_cmp);
+
+	open_json_array(PRINT_JSON, name);
+	for (; n; n--, c++) {
+		SPRINT_BUF(b1);
+
+		open_json_object(NULL);
+		print_string(PRINT_FP, NULL, "  %s ", name);
+		print_string(PRINT_ANY, name, "%s:",
+			     n2a(c->key, b1, sizeof(b1)));
+		print_u64(PRINT_ANY, "events", " %llu", c->count);
+		print_nl();
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+}
+
+static void print_mon_summary(struct mon_summary *s)
+{
+	unsigned int i;
+
+	new_json_obj_plain(json);
+	open_json_object(NULL);
+
+	if (timestamp)
+		print_timestamp(stdout);
+
+	/* 0 for the summary of a whole file */
+	if (s->interval)
+		print_uint(PRINT_ANY, "interval_ms", "interval %ums ",
+			   s->interval);
+	print_u64(PRINT_ANY, "events", "events %llu", s->events);
+	if (s->coalesce) {
+		print_u64(PRINT_ANY, "objects", " objects %llu",
+			  s->events - s->coalesced);
+		print_u64(PRINT_ANY, "coalesced", " coalesced %llu",
+			  s->coalesced);
+	}
+	print_u64(PRINT_ANY, "overruns", " overruns %llu", s->overruns);
+	if (s->overruns)
+		print_string(PRINT_FP, NULL, "%s", " (events lost)");
+	print_nl();
+
+	open_json_object("types");
+	for (i = 0; i < MON_KIND_MAX; i++) {
+		if (!s->new[i] && !s->del[i])
+			continue;
+		open_json_object(mon_kind_names[i]);
+		print_string(PRINT_FP, NULL, "  %s:", mon_kind_names[i]);
+		print_u64(PRINT_ANY, "new", " new %llu", s->new[i]);
+		print_u64(PRINT_ANY, "del", " del %llu", s->del[i]);
+		print_nl();
+		close_json_object();
+	}
+	close_json_object();
+
+	print_mon_counters(&s->tables, "table", rtnl_rttable_n2a);
+	print_mon_counters(&s->protos, "proto", mon_proto_n2a);
+	print_mon_counters(&s->devs, "dev", mon_dev_n2a);
+
+	close_json_object();
+	delete_json_obj_plain();
+}
+
+static int tick_msg_summary(unsigned int overruns, void *arg)
+{
+	struct mon_summary *s = arg;
+
+	s->overruns += overruns;
+	print_mon_summary(s);
+	mon_summary_reset(s);
+	return 0;
+}
+
 #define IPMON_LLINK		BIT(0)
 #define IPMON_LADDR		BIT(1)
 #define IPMON_LROUTE		BIT(2)
@@ -191,21 +542,112 @@ static int accept_msg(struct rtnl_ctrl_data *ctrl,
 
 #define IPMON_L_ALL		(~0)
 
+/* default ring for "threaded", enough for a few 100k route changes */
+#define IPMON_RING_SIZE		(64 << 20)
+
+/* message types recorded for each of the OBJECTS, to filter a file */
+static const struct {
+	unsigned int	lmask;
+	__u16		type[2];
+} ipmon_file_types[] = {
+	{ IPMON_LLINK,		{ RTM_NEWLINK, RTM_DELLINK } },
+	{ IPMON_LADDR,		{ RTM_NEWADDR, RTM_DELADDR } },
+	{ IPMON_LROUTE,		{ RTM_NEWROUTE, RTM_DELROUTE } },
+	{ IPMON_LMROUTE,	{ RTM_NEWROUTE, RTM_DELROUTE } },
+	{ IPMON_LPREFIX,	{ RTM_NEWPREFIX, RTM_NEWPREFIX } },
+	{ IPMON_LNEIGH,		{ RTM_NEWNEIGH, RTM_DELNEIGH } },
+	{ IPMON_LNETCONF,	{ RTM_NEWNETCONF, RTM_DELNETCONF } },
+	{ IPMON_LSTATS,		{ RTM_NEWSTATS, RTM_NEWSTATS } },
+	{ IPMON_LRULE,		{ RTM_NEWRULE, RTM_DELRULE } },
+	{ IPMON_LNSID,		{ RTM_NEWNSID, RTM_DELNSID } },
+	{ IPMON_LNEXTHOP,	{ RTM_NEWNEXTHOP, RTM_DELNEXTHOP } },
+	{ IPMON_LMADDR,		{ RTM_NEWMULTICAST, RTM_DELMULTICAST } },
+	{ IPMON_LACADDR,	{ RTM_NEWANYCAST, RTM_DELANYCAST } },
+};
+
+static void ipmon_file_filter(struct rtnl_log_filter *f, unsigned int lmask)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ipmon_file_types); i++) {
+		if (!(lmask & ipmon_file_types[i].lmask))
+			continue;
+		rtnl_log_type_set(f->types, ipmon_file_types[i].type[0]);
+		rtnl_log_type_set(f->types, ipmon_file_types[i].type[1]);
+	}
+}
+
+/* links of the capture filtered out, so names are not taken from the host */
+static int ipmon_file_link(struct rtnl_ctrl_data *ctrl,
+			   struct nlmsghdr *n, void *arg)
+{
+	ll_remember_index(n, NULL);
+	return 0;
+}
+
+/* seconds since the epoch, or local "YYYY-MM-DD[ HH:MM[:SS]]" */
+static int get_mon_time(__u32 *t, const char *arg)
+{
+	static const char * const fmts[] = {
+		"%Y-%m-%d %H:%M:%S",
+		"%Y-%m-%dT%H:%M:%S",
+		"%Y-%m-%d %H:%M",
+		"%Y-%m-%d",
+	};
+	int i;
+
+	if (get_u32(t, arg, 10) == 0)
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(fmts); i++) {
+		struct tm tm = {};
+		const char *end;
+		time_t sec;
+
+		end = strptime(arg, fmts[i], &tm);
+		if (!end || *end)
+			continue;
+		tm.tm_isdst = -1;
+		sec = mktime(&tm);
+		if (sec < 0 || sec > UINT32_MAX)
+			return -1;
+		*t = sec;
+		return 0;
+	}
+	return -1;
+}
+
 int do_ipmonitor(int argc, char **argv)
 {
 	unsigned int groups = 0, lmask = 0;
 	/* "needed" mask, failure to enable is an error */
 	unsigned int nmask;
+	unsigned int ring_size = IPMON_RING_SIZE;
+	struct mon_summary summary = { .interval = 1000 };
+	bool threaded = false, do_summary = false;
+	struct rtnl_log_filter filter = { .to = UINT32_MAX };
+	bool do_filter = false;
 	char *file = NULL;
 	int ifindex = 0;
 
 	rtnl_close(&rth);
 	do_monitor = 1;
+	mon_summary_init(&summary);
 
 	while (argc > 0) {
 		if (matches(*argv, "file") == 0) {
 			NEXT_ARG();
 			file = *argv;
+		} else if (strcmp(*argv, "from") == 0) {
+			NEXT_ARG();
+			if (get_mon_time(&filter.from, *argv))
+				invarg("invalid time", *argv);
+			do_filter = true;
+		} else if (strcmp(*argv, "to") == 0) {
+			NEXT_ARG();
+			if (get_mon_time(&filter.to, *argv))
+				invarg("invalid time", *argv);
+			do_filter = true;
 		} else if (matches(*argv, "label") == 0) {
 			prefix_banner = 1;
 		} else if (matches(*argv, "link") == 0) {
@@ -238,6 +680,22 @@ int do_ipmonitor(int argc, char **argv)
 			prefix_banner = 1;
 		} else if (matches(*argv, "all-nsid") == 0) {
 			listen_all_nsid = 1;
+		} else if (strcmp(*argv, "threaded") == 0) {
+			threaded = true;
+		} else if (strcmp(*argv, "ring") == 0) {
+			NEXT_ARG();
+			if (get_size(&ring_size, *argv))
+				invarg("invalid ring size", *argv);
+			threaded = true;
+		} else if (strcmp(*argv, "summary") == 0) {
+			do_summary = true;
+		} else if (strcmp(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&summary.interval, *argv, 0) ||
+			    !summary.interval)
+				invarg("invalid interval", *argv);
+		} else if (strcmp(*argv, "coalesce") == 0) {
+			summary.coalesce = true;
 		} else if (matches(*argv, "help") == 0) {
 			usage();
 		} else if (strcmp(*argv, "dev") == 0) {
@@ -253,6 +711,13 @@ int do_ipmonitor(int argc, char **argv)
 		argc--;	argv++;
 	}
 
+	/* summary reads and counts in one go, there is nothing to offload */
+	if (threaded && do_summary) {
+		fprintf(stderr,
+			"\"threaded\" cannot be used with \"summary\".\n");
+		exit(-1);
+	}
+
 	ipaddr_reset_filter(1, ifindex);
 	iproute_reset_filter(ifindex);
 	ipmroute_reset_filter(ifindex);
@@ -310,16 +775,37 @@ int do_ipmonitor(int argc, char **argv)
 		groups |= nl_mgrp(RTNLGRP_NSID);
 	}
 
+	if (do_filter && !file) {
+		fprintf(stderr, "\"from\" and \"to\" need a \"file\"\n");
+		exit(-1);
+	}
+
 	if (file) {
+		struct rtnl_log_filter *f = NULL;
 		FILE *fp;
 		int err;
 
+		if (nmask)
+			ipmon_file_filter(&filter, nmask);
+		if (nmask || do_filter) {
+			filter.link = ipmon_file_link;
+			f = &filter;
+		}
+
 		fp = fopen(file, "r");
 		if (fp == NULL) {
 			perror("Cannot fopen");
 			exit(-1);
 		}
-		err = rtnl_from_file(fp, accept_msg, stdout);
+		if (do_summary) {
+			summary.ifindex = ifindex;
+			err = rtnl_from_file_filter(fp, f, accept_msg_summary,
+						    &summary);
+			summary.interval = 0;
+			print_mon_summary(&summary);
+		} else {
+			err = rtnl_from_file_filter(fp, f, accept_msg, stdout);
+		}
 		fclose(fp);
 		return err;
 	}
@@ -379,8 +865,18 @@ int do_ipmonitor(int argc, char **argv)
 	netns_nsid_socket_init();
 	netns_map_init();
 
-	if (rtnl_listen(&rth, accept_msg, stdout) < 0)
+	if (do_summary) {
+		summary.ifindex = ifindex;
+		if (rtnl_listen_timed(&rth, accept_msg_summary,
+				      tick_msg_summary, summary.interval,
+				      &summary) < 0)
+			exit(2);
+	} else if (threaded) {
+		if (rtnl_listen_threaded(&rth, accept_msg, ring_size, stdout) < 0)
+			exit(2);
+	} else if (rtnl_listen(&rth, accept_msg, stdout) < 0) {
 		exit(2);
+	}
 
 	return 0;
 }
@@ -10,6 +10,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -19,9 +20,25 @@
 #include "utils.h"
 #include "ip_common.h"
 #include "json_print.h"
+#include "hashtab.h"
 
 #define NUD_VALID	(NUD_PERMANENT|NUD_NOARP|NUD_REACHABLE|NUD_PROBE|NUD_STALE|NUD_DELAY)
-#define MAX_ROUNDS	10
+
+enum {
+	NEIGH_COUNT_NONE,
+	NEIGH_COUNT_DEV,
+	NEIGH_COUNT_STATE,
+};
+
+/*
+ * Aggregation for "ip neigh count": entries are classified into a
+ * table of counters without being formatted.
+ */
+struct neigh_count {
+	int		by;
+	__u64		total;
+	struct hashtab	tbl;
+};
 
 static struct
 {
@@ -30,10 +47,8 @@ static struct
 	int state;
 	int unused_only;
 	inet_prefix pfx;
-	int flushed;
-	char *flushb;
-	int flushp;
-	int flushe;
+	struct rtnl_msgbuf *flush;
+	struct neigh_count *count;
 	int master;
 	int protocol;
 	__u8 ndm_flags;
@@ -51,6 +66,9 @@ static void usage(void)
 		"\n"
 		"	ip neigh { show | flush } [ proxy ] [ to PREFIX ] [ dev DEV ] [ nud STATE ]\n"
 		"				  [ vrf NAME ] [ nomaster ]\n"
+		"	ip neigh count [ by { dev | state } ] [ proxy ] [ to PREFIX ] [ dev DEV ]\n"
+		"		       [ nud STATE ] [ vrf NAME ] [ nomaster ]\n"
+		"	ip neigh import [ FILE ]\n"
 		"	ip neigh get { ADDR | proxy ADDR } dev DEV\n"
 		"\n"
 		"STATE := { delay | failed | incomplete | noarp | none |\n"
@@ -87,18 +105,8 @@ static int nud_state_a2n(unsigned int *state, const char *arg)
 	return 0;
 }
 
-static int flush_update(void)
-{
-	if (rtnl_send_check(&rth, filter.flushb, filter.flushp) < 0) {
-		perror("Failed to send flush request");
-		return -1;
-	}
-	filter.flushp = 0;
-	return 0;
-}
-
-
-static int ipneigh_modify(int cmd, int flags, int argc, char **argv)
+static int ipneigh_modify(int cmd, int flags, int argc, char **argv,
+			  struct rtnl_batch *batch)
 {
 	struct {
 		struct nlmsghdr	n;
@@ -182,6 +190,8 @@ static int ipneigh_modify(int cmd, int flags, int argc, char **argv)
 	}
 	if (!dev_ok || !dst_ok || dst.family == AF_UNSPEC) {
 		fprintf(stderr, "Device and destination are required arguments.\n");
+		if (batch)
+			return -1;
 		exit(-1);
 	}
 	req.ndm.ndm_family = dst.family;
@@ -211,6 +221,9 @@ static int ipneigh_modify(int cmd, int flags, int argc, char **argv)
 			return nodev(dev);
 	}
 
+	if (batch)
+		return rtnl_batch_add(batch, &req.n, cmdlineno);
+
 	if (rtnl_talk(&rth, &req.n, NULL) < 0)
 		exit(2);
 
@@ -302,6 +315,95 @@ static int print_neigh_brief(FILE *fp, struct ndmsg *r, struct rtattr *tb[])
 	return 0;
 }
 
+/* queue a delete request carrying only the key of the entry */
+static int flush_queue_neigh(struct rtnl_msgbuf *mb, struct nlmsghdr *n,
+			     struct rtattr *dst)
+{
+	struct nlmsghdr *fn;
+
+	fn = rtnl_msgbuf_reserve(mb, n->nlmsg_len);
+	if (!fn) {
+		fprintf(stderr, "Not enough memory to flush neighbours\n");
+		return -1;
+	}
+
+	fn->nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg));
+	fn->nlmsg_type = RTM_DELNEIGH;
+	fn->nlmsg_flags = NLM_F_REQUEST;
+	memcpy(NLMSG_DATA(fn), NLMSG_DATA(n), sizeof(struct ndmsg));
+	if (dst)
+		addattr_l(fn, n->nlmsg_len, NDA_DST,
+			  RTA_DATA(dst), RTA_PAYLOAD(dst));
+
+	rtnl_msgbuf_commit(mb, fn);
+	return 0;
+}
+
+static int neigh_count_inc(struct neigh_count *c, const struct ndmsg *r)
+{
+	__u32 key;
+
+	c->total++;
+
+	switch (c->by) {
+	case NEIGH_COUNT_DEV:
+		key = r->ndm_ifindex;
+		break;
+	case NEIGH_COUNT_STATE:
+		key = r->ndm_state;
+		break;
+	default:
+		return 0;
+	}
+
+	if (hashtab_count(&c->tbl, key)) {
+		fprintf(stderr, "Not enough memory for neigh count\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void print_neigh_count(struct neigh_count *c)
+{
+	unsigned int i, n = hashtab_sort(&c->tbl, hashtab_counter_cmp);
+	struct hashtab_counter *counters = (void *)c->tbl.slots;
+
+	for (i = 0; i < n; i++) {
+		__u32 key = counters[i].key;
+
+		open_json_object(NULL);
+		switch (c->by) {
+		case NEIGH_COUNT_DEV:
+			print_string(PRINT_FP, NULL, "dev ", NULL);
+			print_color_string(PRINT_ANY, COLOR_IFNAME,
+					   "dev", "%s ",
+					   ll_index_to_name(key));
+			break;
+		case NEIGH_COUNT_STATE:
+			print_string(PRINT_FP, NULL, "state ", NULL);
+			if (key) {
+				print_neigh_state(key);
+			} else {
+				open_json_array(PRINT_JSON, "state");
+				print_string(PRINT_ANY, NULL, "%s ", "NONE");
+				close_json_array(PRINT_JSON, NULL);
+			}
+			break;
+		}
+		print_u64(PRINT_ANY, "count", "count %llu\n",
+			  counters[i].count);
+		close_json_object();
+	}
+
+	if (c->by == NEIGH_COUNT_NONE) {
+		open_json_object(NULL);
+		print_u64(PRINT_ANY, "count", "count %llu\n", c->total);
+		close_json_object();
+	} else {
+		print_u64(PRINT_FP, NULL, "total %llu\n", c->total);
+	}
+}
+
 int print_neigh(struct nlmsghdr *n, void *arg)
 {
 	FILE *fp = (FILE *)arg;
@@ -325,7 +427,7 @@ int print_neigh(struct nlmsghdr *n, void *arg)
 		return -1;
 	}
 
-	if (filter.flushb && n->nlmsg_type != RTM_NEWNEIGH)
+	if ((filter.flush || filter.count) && n->nlmsg_type != RTM_NEWNEIGH)
 		return 0;
 
 	if (filter.family && filter.family != r->ndm_family)
@@ -366,20 +468,12 @@ int print_neigh(struct nlmsghdr *n, void *arg)
 			return 0;
 	}
 
-	if (filter.flushb) {
-		struct nlmsghdr *fn;
+	if (filter.count)
+		return neigh_count_inc(filter.count, r);
 
-		if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
-			if (flush_update())
-				return -1;
-		}
-		fn = (struct nlmsghdr *)(filter.flushb + NLMSG_ALIGN(filter.flushp));
-		memcpy(fn, n, n->nlmsg_len);
-		fn->nlmsg_type = RTM_DELNEIGH;
-		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
-		filter.flushp = (((char *)fn) + n->nlmsg_len) - filter.flushb;
-		filter.flushed++;
+	if (filter.flush) {
+		if (flush_queue_neigh(filter.flush, n, tb[NDA_DST]))
+			return -1;
 		if (show_stats < 2)
 			return 0;
 	}
@@ -503,11 +597,102 @@ static int ipneigh_dump_filter(struct nlmsghdr *nlh, int reqlen)
 	return 0;
 }
 
-static int do_show_or_flush(int argc, char **argv, int flush)
+static int flush_error(struct rtnl_batch *b, __u32 cookie, int error,
+		       struct nlmsghdr *n, void *arg)
+{
+	__u64 *failed = arg;
+
+	/* already gone, e.g. expired or together with its device */
+	if (error == -ENOENT)
+		return 0;
+
+	(*failed)++;
+	rtnl_print_ack_error(n);
+	return 0;
+}
+
+/*
+ * Neighbours matching the filter are collected from a single dump and
+ * then deleted in pipelined batches.
+ */
+static int ipneigh_flush(void)
 {
+	struct rtnl_msgbuf flush = {};
+	struct bulk_progress progress;
+	struct rtnl_batch batch;
+	struct nlmsghdr *n;
+	__u64 failed = 0;
+	__u32 idx = 0;
+	int ret;
+
+	filter.flush = &flush;
+
+	if (rtnl_neighdump_req(&rth, filter.family, ipneigh_dump_filter) < 0) {
+		perror("Cannot send dump request");
+		exit(1);
+	}
+	if (rtnl_dump_filter(&rth, print_neigh, stdout) < 0) {
+		fprintf(stderr, "Flush terminated\n");
+		exit(1);
+	}
+
+	if (flush.count == 0) {
+		if (show_stats)
+			printf("Nothing to flush.\n");
+		fflush(stdout);
+		ret = 0;
+		goto out;
+	}
+
+	if (rtnl_batch_init(&batch, &rth, flush_error, &failed) < 0) {
+		ret = 1;
+		goto out;
+	}
+
+	if (show_stats) {
+		printf("\n*** Deleting %llu entries ***\n", flush.count);
+		fflush(stdout);
+		bulk_progress_init(&progress, "Flushing neighbours");
+	}
+
+	ret = 0;
+	rtnl_msgbuf_for_each(&flush, n) {
+		if (rtnl_batch_add(&batch, n, idx++) < 0) {
+			ret = 1;
+			break;
+		}
+		if (show_stats)
+			bulk_progress_update(&progress, batch.acked,
+					     flush.count);
+	}
+	if (rtnl_batch_flush(&batch) < 0)
+		ret = 1;
+	rtnl_batch_free(&batch);
+
+	if (show_stats) {
+		__u64 deleted = batch.acked - batch.errors;
+
+		bulk_progress_done(&progress, deleted, failed);
+		printf("*** Flush is complete, %llu entries deleted ***\n",
+		       deleted);
+		fflush(stdout);
+	}
+	if (failed)
+		ret = 1;
+out:
+	filter.flush = NULL;
+	rtnl_msgbuf_free(&flush);
+	return ret;
+}
+
+static int do_show_or_flush(int argc, char **argv, int flush, bool count)
+{
+	struct neigh_count counts = {};
 	char *filter_dev = NULL;
 	int state_given = 0;
+	int ret;
 
+	hashtab_counter_init(&counts.tbl);
 	ipneigh_reset_filter(0);
 
 	if (!filter.family)
@@ -570,6 +755,14 @@ static int do_show_or_flush(int argc, char **argv, int flush)
 			filter.state |= state;
 		} else if (strcmp(*argv, "proxy") == 0) {
 			filter.ndm_flags = NTF_PROXY;
+		} else if (count && strcmp(*argv, "by") == 0) {
+			NEXT_ARG();
+			if (strcmp(*argv, "dev") == 0)
+				counts.by = NEIGH_COUNT_DEV;
+			else if (strcmp(*argv, "state") == 0)
+				counts.by = NEIGH_COUNT_STATE;
+			else
+				invarg("invalid count key", *argv);
 		} else if (matches(*argv, "protocol") == 0) {
 			__u32 prot;
 
@@ -602,48 +795,11 @@ static int do_show_or_flush(int argc, char **argv, int flush)
 			return nodev(filter_dev);
 	}
 
-	if (flush) {
-		int round = 0;
-		char flushb[4096-512];
-
-		filter.flushb = flushb;
-		filter.flushp = 0;
-		filter.flushe = sizeof(flushb);
-
-		while (round < MAX_ROUNDS) {
-			if (rtnl_neighdump_req(&rth, filter.family,
-					       ipneigh_dump_filter) < 0) {
-				perror("Cannot send dump request");
-				exit(1);
-			}
-			filter.flushed = 0;
-			if (rtnl_dump_filter(&rth, print_neigh, stdout) < 0) {
-				fprintf(stderr, "Flush terminated\n");
-				exit(1);
-			}
-			if (filter.flushed == 0) {
-				if (show_stats) {
-					if (round == 0)
-						printf("Nothing to flush.\n");
-					else
-						printf("*** Flush is complete after %d round%s ***\n", round, round > 1?"s":"");
-				}
-				fflush(stdout);
-				return 0;
-			}
-			round++;
-			if (flush_update() < 0)
-				exit(1);
-			if (show_stats) {
-				printf("\n*** Round %d, deleting %d entries ***\n", round, filter.flushed);
-				fflush(stdout);
-			}
-			filter.state &= ~NUD_FAILED;
-		}
-		printf("*** Flush not complete bailing out after %d rounds\n",
-			MAX_ROUNDS);
-		return 1;
-	}
+	if (flush)
+		return ipneigh_flush();
+
+	if (count)
+		filter.count = &counts;
 
 	if (rtnl_neighdump_req(&rth, filter.family, ipneigh_dump_filter) < 0) {
 		perror("Cannot send dump request");
@@ -651,15 +807,43 @@ static int do_show_or_flush(int argc, char **argv, int flush)
 	}
 
 	new_json_obj(json);
-	if (rtnl_dump_filter(&rth, print_neigh, stdout) < 0) {
+	ret = rtnl_dump_filter(&rth, print_neigh, stdout);
+	if (ret >= 0 && count)
+		print_neigh_count(&counts);
+	delete_json_obj();
+
+	filter.count = NULL;
+	hashtab_free(&counts.tbl);
+	if (ret < 0) {
 		fprintf(stderr, "Dump terminated\n");
 		exit(1);
 	}
-	delete_json_obj();
 
 	return 0;
 }
 
+static int ipneigh_import_cmd(int argc, char **argv, void *data)
+{
+	struct rtnl_batch *batch = data;
+
+	if (matches(*argv, "add") == 0)
+		return ipneigh_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_EXCL,
+				      argc-1, argv+1, batch);
+	if (matches(*argv, "change") == 0 ||
+	    strcmp(*argv, "chg") == 0)
+		return ipneigh_modify(RTM_NEWNEIGH, NLM_F_REPLACE,
+				      argc-1, argv+1, batch);
+	if (matches(*argv, "replace") == 0)
+		return ipneigh_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_REPLACE,
+				      argc-1, argv+1, batch);
+	if (matches(*argv, "delete") == 0)
+		return ipneigh_modify(RTM_DELNEIGH, 0, argc-1, argv+1, batch);
+
+	fprintf(stderr, "Command \"%s\" is not supported in neigh import\n",
+		*argv);
+	return -1;
+}
+
 static int ipneigh_get(int argc, char **argv)
 {
 	struct {
@@ -745,26 +929,31 @@ int do_ipneigh(int argc, char **argv)
 {
 	if (argc > 0) {
 		if (matches(*argv, "add") == 0)
-			return ipneigh_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_EXCL, argc-1, argv+1);
+			return ipneigh_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_EXCL, argc-1, argv+1, NULL);
 		if (matches(*argv, "change") == 0 ||
 		    strcmp(*argv, "chg") == 0)
-			return ipneigh_modify(RTM_NEWNEIGH, NLM_F_REPLACE, argc-1, argv+1);
+			return ipneigh_modify(RTM_NEWNEIGH, NLM_F_REPLACE, argc-1, argv+1, NULL);
 		if (matches(*argv, "replace") == 0)
-			return ipneigh_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_REPLACE, argc-1, argv+1);
+			return ipneigh_modify(RTM_NEWNEIGH, NLM_F_CREATE|NLM_F_REPLACE, argc-1, argv+1, NULL);
 		if (matches(*argv, "delete") == 0)
-			return ipneigh_modify(RTM_DELNEIGH, 0, argc-1, argv+1);
+			return ipneigh_modify(RTM_DELNEIGH, 0, argc-1, argv+1, NULL);
 		if (matches(*argv, "get") == 0)
 			return ipneigh_get(argc-1, argv+1);
 		if (matches(*argv, "show") == 0 ||
 		    matches(*argv, "lst") == 0 ||
 		    matches(*argv, "list") == 0)
-			return do_show_or_flush(argc-1, argv+1, 0);
+			return do_show_or_flush(argc-1, argv+1, 0, false);
 		if (matches(*argv, "flush") == 0)
-			return do_show_or_flush(argc-1, argv+1, 1);
+			return do_show_or_flush(argc-1, argv+1, 1, false);
+		if (strcmp(*argv, "count") == 0)
+			return do_show_or_flush(argc-1, argv+1, 0, true);
+		if (strcmp(*argv, "import") == 0)
+			return do_batch_rtnl(&rth, argc > 1 ? argv[1] : "-",
+					     ipneigh_import_cmd);
 		if (matches(*argv, "help") == 0)
 			usage();
 	} else
-		return do_show_or_flush(0, NULL, 0);
+		return do_show_or_flush(0, NULL, 0, false);
 
 	fprintf(stderr, "Command \"%s\" is unknown, try \"ip neigh help\".\n", *argv);
 	exit(-1);
@@ -17,7 +17,6 @@
 #include "nh_common.h"
 
 static struct {
-	unsigned int flushed;
 	unsigned int groups;
 	unsigned int ifindex;
 	unsigned int master;
@@ -36,7 +35,9 @@ enum {
 #define RTM_NHA(h)  ((struct rtattr *)(((char *)(h)) + \
 			NLMSG_ALIGN(sizeof(struct nhmsg))))
 
-static struct hlist_head nh_cache[NH_CACHE_SIZE];
+static struct hlist_head *nh_cache;
+static unsigned int nh_cache_size;
+static unsigned int nh_cache_count;
 static struct rtnl_handle nh_cache_rth = { .fd = -1 };
 
 static void usage(void) __attribute__((noreturn));
@@ -159,11 +160,27 @@ static int delete_nexthop(__u32 id)
 	return 0;
 }
 
+struct nh_flush {
+	struct rtnl_msgbuf	groups;
+	struct rtnl_msgbuf	nexthops;
+	__u64			failed;
+};
+
 static int flush_nexthop(struct nlmsghdr *nlh, void *arg)
 {
 	struct nhmsg *nhm = NLMSG_DATA(nlh);
+	struct nh_flush *nf = arg;
 	struct rtattr *tb[NHA_MAX+1];
-	__u32 id = 0;
+	struct {
+		struct nlmsghdr	n;
+		struct nhmsg	nhm;
+		char		buf[64];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct nhmsg)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = RTM_DELNEXTHOP,
+		.nhm.nh_family = AF_UNSPEC,
+	};
 	int len;
 
 	len = nlh->nlmsg_len - NLMSG_SPACE(sizeof(*nhm));
@@ -176,54 +193,98 @@ static int flush_nexthop(struct nlmsghdr *nlh, void *arg)
 		return 0;
 
 	parse_rtattr(tb, NHA_MAX, RTM_NHA(nhm), len);
-	if (tb[NHA_ID])
-		id = rta_getattr_u32(tb[NHA_ID]);
+	if (!tb[NHA_ID] || !rta_getattr_u32(tb[NHA_ID]))
+		return 0;
+
+	addattr32(&req.n, sizeof(req), NHA_ID, rta_getattr_u32(tb[NHA_ID]));
 
-	if (id && !delete_nexthop(id))
-		filter.flushed++;
+	/* groups are removed before the nexthops they reference */
+	return rtnl_msgbuf_add(tb[NHA_GROUP] ? &nf->groups : &nf->nexthops,
+			       &req.n);
+}
+
+static int flush_nexthop_error(struct rtnl_batch *b, __u32 cookie, int error,
+			       struct nlmsghdr *n, void *arg)
+{
+	struct nh_flush *nf = arg;
+
+	/* removed along with its device or its last group member */
+	if (error == -ENOENT)
+		return 0;
 
+	nf->failed++;
+	rtnl_print_ack_error(n);
 	return 0;
 }
 
 static int ipnh_flush(unsigned int all)
 {
-	int rc = -2;
+	struct rtnl_msgbuf *queues[2];
+	struct bulk_progress progress;
+	struct nh_flush nf = {};
+	struct rtnl_batch batch;
+	__u64 total, deleted;
+	__u32 idx = 0;
+	int i, rc = -2;
 
 	if (all) {
-		filter.groups = 1;
+		filter.groups = 0;
 		filter.ifindex = 0;
 		filter.master = 0;
 	}
 
-	if (rtnl_open(&rth_del, 0) < 0) {
-		fprintf(stderr, "Cannot open rtnetlink\n");
-		return EXIT_FAILURE;
-	}
-again:
 	if (rtnl_nexthopdump_req(&rth, preferred_family, nh_dump_filter) < 0) {
 		perror("Cannot send dump request");
 		goto out;
 	}
 
-	if (rtnl_dump_filter(&rth, flush_nexthop, stdout) < 0) {
+	if (rtnl_dump_filter(&rth, flush_nexthop, &nf) < 0) {
 		fprintf(stderr, "Dump terminated. Failed to flush nexthops\n");
 		goto out;
 	}
 
-	/* if deleting all, then remove groups first */
-	if (all && filter.groups) {
-		filter.groups = 0;
-		goto again;
+	total = nf.groups.count + nf.nexthops.count;
+	if (!total) {
+		printf("Nothing to flush\n");
+		rc = 0;
+		goto out;
 	}
 
+	if (rtnl_batch_init(&batch, &rth, flush_nexthop_error, &nf) < 0)
+		goto out;
+
+	if (show_stats)
+		bulk_progress_init(&progress, "Flushing nexthops");
+
 	rc = 0;
+	queues[0] = &nf.groups;
+	queues[1] = &nf.nexthops;
+	for (i = 0; i < ARRAY_SIZE(queues) && !rc; i++) {
+		struct nlmsghdr *n;
+
+		rtnl_msgbuf_for_each(queues[i], n) {
+			if (rtnl_batch_add(&batch, n, idx++) < 0) {
+				rc = -2;
+				break;
+			}
+			if (show_stats)
+				bulk_progress_update(&progress, batch.acked,
+						     total);
+		}
+	}
+	if (rtnl_batch_flush(&batch) < 0)
+		rc = -2;
+	rtnl_batch_free(&batch);
+
+	deleted = batch.acked - batch.errors;
+	if (show_stats)
+		bulk_progress_done(&progress, deleted, nf.failed);
+	printf("Flushed %llu nexthops\n", deleted);
+	if (nf.failed)
+		rc = -2;
 out:
-	rtnl_close(&rth_del);
-	if (!filter.flushed)
-		printf("Nothing to flush\n");
-	else
-		printf("Flushed %d nexthops\n", filter.flushed);
-
+	rtnl_msgbuf_free(&nf.groups);
+	rtnl_msgbuf_free(&nf.nexthops);
 	return rc;
 }
 
@@ -644,32 +705,81 @@ static int  __ipnh_get_id(struct rtnl_handle *rthp, __u32 nh_id,
 	return rtnl_talk(rthp, &req.n, answer);
 }
 
-static struct hlist_head *ipnh_cache_head(__u32 nh_id)
+static unsigned int ipnh_cache_hash(__u32 nh_id, unsigned int size)
 {
 	nh_id ^= nh_id >> 20;
 	nh_id ^= nh_id >> 10;
 
-	return &nh_cache[nh_id % NH_CACHE_SIZE];
+	return nh_id & (size - 1);
 }
 
-static void ipnh_cache_link_entry(struct nh_entry *nhe)
+static struct hlist_head *ipnh_cache_head(__u32 nh_id)
+{
+	return &nh_cache[ipnh_cache_hash(nh_id, nh_cache_size)];
+}
+
+/* keep the average chain length at most one as the cache grows */
+static int ipnh_cache_resize(unsigned int size)
 {
-	struct hlist_head *head = ipnh_cache_head(nhe->nh_id);
+	struct hlist_head *cache;
+	struct hlist_node *n, *tmp;
+	unsigned int i;
 
+	cache = calloc(size, sizeof(*cache));
+	if (!cache)
+		return -1;
+
+	for (i = 0; i < nh_cache_size; i++) {
+		hlist_for_each_safe(n, tmp, &nh_cache[i]) {
+			struct nh_entry *nhe;
+
+			nhe = container_of(n, struct nh_entry, nh_hash);
+			hlist_add_head(n, &cache[ipnh_cache_hash(nhe->nh_id,
+								 size)]);
+		}
+	}
+
+	free(nh_cache);
+	nh_cache = cache;
+	nh_cache_size = size;
+	return 0;
+}
+
+static int ipnh_cache_link_entry(struct nh_entry *nhe)
+{
+	struct hlist_head *head;
+
+	if (!nh_cache_size) {
+		if (ipnh_cache_resize(NH_CACHE_SIZE))
+			return -ENOMEM;
+	} else if (nh_cache_count >= nh_cache_size) {
+		/* if growing fails, longer chains in the current table do */
+		ipnh_cache_resize(nh_cache_size * 2);
+	}
+
+	head = ipnh_cache_head(nhe->nh_id);
 	hlist_add_head(&nhe->nh_hash, head);
+	nh_cache_count++;
+	return 0;
 }
 
 static void ipnh_cache_unlink_entry(struct nh_entry *nhe)
 {
 	hlist_del(&nhe->nh_hash);
+	nh_cache_count--;
 }
 
 static struct nh_entry *ipnh_cache_get(__u32 nh_id)
 {
-	struct hlist_head *head = ipnh_cache_head(nh_id);
+	struct hlist_head *head;
 	struct nh_entry *nhe;
 	struct hlist_node *n;
 
+	if (!nh_cache_size)
+		return NULL;
+
+	head = ipnh_cache_head(nh_id);
+
 	hlist_for_each(n, head) {
 		nhe = container_of(n, struct nh_entry, nh_hash);
 		if (nhe->nh_id == nh_id)
@@ -719,7 +829,10 @@ static struct nh_entry *ipnh_cache_add(__u32 nh_id)
 	if (__ipnh_cache_parse_nlmsg(answer, nhe))
 		goto out_free_nhe;
 
-	ipnh_cache_link_entry(nhe);
+	if (ipnh_cache_link_entry(nhe)) {
+		ipnh_destroy_entry(nhe);
+		goto out_free_nhe;
+	}
 
 out:
 	free(answer);
@@ -768,7 +881,11 @@ static int ipnh_cache_process_nlmsg(const struct nlmsghdr *n,
 			ipnh_destroy_entry(nhe);
 		}
 		memcpy(nhe, new_nhe, sizeof(*nhe));
-		ipnh_cache_link_entry(nhe);
+		if (ipnh_cache_link_entry(nhe)) {
+			ipnh_destroy_entry(nhe);
+			free(nhe);
+			return -1;
+		}
 		break;
 	}
 
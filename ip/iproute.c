@@ -24,6 +24,7 @@
 #include "utils.h"
 #include "ip_common.h"
 #include "nh_common.h"
+#include "hashtab.h"
 
 #ifndef RTAX_RTTVAR
 #define RTAX_RTTVAR RTAX_HOPS
@@ -60,7 +61,11 @@ static void usage(void)
 		"Usage: ip route { list | flush } SELECTOR\n"
 		"       ip route save SELECTOR\n"
 		"       ip route restore\n"
+		"       ip route sync [ table TABLE ] [ proto RTPROTO ] [ diff ] [ FILE ]\n"
 		"       ip route showdump\n"
+		"       ip route lookup dump FILE [ rules FILE ] [ table TABLE ]\n"
+		"                       [ from ADDRESS ] [ mark MARK ] [ iif NAME ]\n"
+		"                       { ADDRESS ... | batch [ FILE ] }\n"
 		"       ip route get [ ROUTE_GET_FLAGS ] [ to ] ADDRESS\n"
 		"                            [ from ADDRESS iif STRING ]\n"
 		"                            [ oif STRING ] [ tos TOS ]\n"
@@ -68,6 +73,7 @@ static void usage(void)
 		"                            [ uid NUMBER ] [ ipproto PROTOCOL ]\n"
 		"                            [ sport NUMBER ] [ dport NUMBER ]\n"
 		"                            [ as ADDRESS ] [ flowlabel FLOWLABEL ]\n"
+		"       ip route get batch [ FILE ]\n"
 		"       ip route { add | del | change | append | replace } ROUTE\n"
 		"SELECTOR := [ root PREFIX ] [ match PREFIX ] [ exact PREFIX ]\n"
 		"            [ table TABLE_ID ] [ vrf NAME ] [ proto RTPROTO ]\n"
@@ -123,10 +129,7 @@ static struct
 {
 	unsigned int tb;
 	int cloned;
-	int flushed;
-	char *flushb;
-	int flushp;
-	int flushe;
+	struct rtnl_msgbuf *flush;
 	int protocol, protocolmask;
 	int scope, scopemask;
 	__u64 typemask;
@@ -144,15 +147,8 @@ static struct
 	inet_prefix msrc;
 } filter;
 
-static int flush_update(void)
-{
-	if (rtnl_send_check(&rth, filter.flushb, filter.flushp) < 0) {
-		perror("Failed to send flush request");
-		return -2;
-	}
-	filter.flushp = 0;
-	return 0;
-}
+/* when set, iproute_modify() queues its request here instead of sending */
+static struct rtnl_msgbuf *route_queue;
 
 static bool filter_multipath(const struct rtattr *rta)
 {
@@ -354,7 +350,7 @@ static int filter_nlmsg(struct nlmsghdr *n, struct rtattr **tb, int host_len)
 		if ((metric ^ filter.metric) & filter.metricmask)
 			return 0;
 	}
-	if (filter.flushb &&
+	if (filter.flush &&
 	    r->rtm_family == AF_INET6 &&
 	    r->rtm_dst_len == 0 &&
 	    r->rtm_type == RTN_UNREACHABLE &&
@@ -765,6 +761,58 @@ static void print_rta_multipath(FILE *fp, const struct rtmsg *r,
 	close_json_array(PRINT_JSON, NULL);
 }
 
+/*
+ * Only the attributes identifying a route are kept in the queued
+ * RTM_DELROUTE, which keeps the queue compact for very large tables.
+ */
+static const unsigned short route_key_attrs[] = {
+	RTA_DST, RTA_SRC, RTA_TABLE, RTA_PRIORITY, RTA_NH_ID,
+};
+
+/* the kernel refuses these along with a nexthop id */
+static const unsigned short route_nh_attrs[] = {
+	RTA_OIF, RTA_GATEWAY, RTA_VIA, RTA_MULTIPATH,
+};
+
+static void flush_copy_attrs(struct nlmsghdr *fn, int maxlen,
+			     struct rtattr **tb, const unsigned short *attrs,
+			     int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		struct rtattr *rta = tb[attrs[i]];
+
+		if (rta)
+			addattr_l(fn, maxlen, rta->rta_type,
+				  RTA_DATA(rta), RTA_PAYLOAD(rta));
+	}
+}
+
+static int flush_queue_route(struct rtnl_msgbuf *mb, struct nlmsghdr *n,
+			     struct rtattr **tb)
+{
+	struct nlmsghdr *fn;
+
+	fn = rtnl_msgbuf_reserve(mb, n->nlmsg_len);
+	if (!fn)
+		return -1;
+
+	fn->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	fn->nlmsg_type = RTM_DELROUTE;
+	fn->nlmsg_flags = NLM_F_REQUEST;
+	memcpy(NLMSG_DATA(fn), NLMSG_DATA(n), sizeof(struct rtmsg));
+
+	flush_copy_attrs(fn, n->nlmsg_len, tb, route_key_attrs,
+			 ARRAY_SIZE(route_key_attrs));
+	if (!tb[RTA_NH_ID])
+		flush_copy_attrs(fn, n->nlmsg_len, tb, route_nh_attrs,
+				 ARRAY_SIZE(route_nh_attrs));
+
+	rtnl_msgbuf_commit(mb, fn);
+	return 0;
+}
+
 int print_route(struct nlmsghdr *n, void *arg)
 {
 	FILE *fp = (FILE *)arg;
@@ -773,7 +821,6 @@ int print_route(struct nlmsghdr *n, void *arg)
 	struct rtattr *tb[RTA_MAX+1];
 	int family, color, host_len;
 	__u32 table;
-	int ret;
 
 	SPRINT_BUF(b1);
 	SPRINT_BUF(b2);
@@ -783,7 +830,7 @@ int print_route(struct nlmsghdr *n, void *arg)
 			n->nlmsg_len, n->nlmsg_type, n->nlmsg_flags);
 		return -1;
 	}
-	if (filter.flushb && n->nlmsg_type != RTM_NEWROUTE)
+	if (filter.flush && n->nlmsg_type != RTM_NEWROUTE)
 		return 0;
 	len -= NLMSG_LENGTH(sizeof(*r));
 	if (len < 0) {
@@ -799,21 +846,9 @@ int print_route(struct nlmsghdr *n, void *arg)
 	if (!filter_nlmsg(n, tb, host_len))
 		return 0;
 
-	if (filter.flushb) {
-		struct nlmsghdr *fn;
-
-		if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
-			ret = flush_update();
-			if (ret < 0)
-				return ret;
-		}
-		fn = (struct nlmsghdr *)(filter.flushb + NLMSG_ALIGN(filter.flushp));
-		memcpy(fn, n, n->nlmsg_len);
-		fn->nlmsg_type = RTM_DELROUTE;
-		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
-		filter.flushp = (((char *)fn) + n->nlmsg_len) - filter.flushb;
-		filter.flushed++;
+	if (filter.flush) {
+		if (flush_queue_route(filter.flush, n, tb) < 0)
+			return -1;
 		if (show_stats < 2)
 			return 0;
 	}
@@ -1633,6 +1668,9 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 	if (!type_ok && req.r.rtm_family == AF_MPLS)
 		req.r.rtm_type = RTN_UNICAST;
 
+	if (route_queue)
+		return rtnl_msgbuf_add(route_queue, &req.n);
+
 	if (echo_request)
 		ret = rtnl_echo_talk(&rth, &req.n, json, print_route);
 	else
@@ -1669,7 +1707,7 @@ static int iproute_flush_cache(void)
 	return 0;
 }
 
-static __u32 route_dump_magic = 0x45311224;
+static __u32 route_dump_magic = IP_ROUTE_DUMP_MAGIC;
 
 static int save_route(struct nlmsghdr *n, void *arg)
 {
@@ -1737,11 +1775,32 @@ static int iproute_dump_filter(struct nlmsghdr *nlh, int reqlen)
 	return 0;
 }
 
+static int flush_error(struct rtnl_batch *b, __u32 cookie, int error,
+		       struct nlmsghdr *n, void *arg)
+{
+	__u64 *failed = arg;
+
+	/* already gone, e.g. together with its device or a sibling */
+	if (error == -ESRCH || error == -ENOENT)
+		return 0;
+
+	(*failed)++;
+	rtnl_print_ack_error(n);
+	return 0;
+}
+
+/*
+ * Routes matching the filter are collected from a single dump and then
+ * deleted in pipelined batches, so no re-dump or time limit is needed.
+ */
 static int iproute_flush(int family, rtnl_filter_t filter_fn)
 {
-	time_t start = time(0);
-	char flushb[4096-512];
-	int round = 0;
+	struct rtnl_msgbuf flush = {};
+	struct bulk_progress progress;
+	struct rtnl_batch batch;
+	struct nlmsghdr *n;
+	__u64 failed = 0;
+	__u32 idx = 0;
 	int ret;
 
 	if (filter.cloned) {
@@ -1757,50 +1816,610 @@ static int iproute_flush(int family, rtnl_filter_t filter_fn)
 			return 0;
 	}
 
-	filter.flushb = flushb;
-	filter.flushp = 0;
-	filter.flushe = sizeof(flushb);
+	filter.flush = &flush;
 
-	for (;;) {
-		if (rtnl_routedump_req(&rth, family, iproute_dump_filter) < 0) {
-			perror("Cannot send dump request");
-			return -2;
+	if (rtnl_routedump_req(&rth, family, iproute_dump_filter) < 0) {
+		perror("Cannot send dump request");
+		ret = -2;
+		goto out;
+	}
+	if (rtnl_dump_filter(&rth, filter_fn, stdout) < 0) {
+		fprintf(stderr, "Flush terminated\n");
+		ret = -2;
+		goto out;
+	}
+
+	if (flush.count == 0) {
+		if (show_stats && (!filter.cloned || family == AF_INET6))
+			printf("Nothing to flush.\n");
+		fflush(stdout);
+		ret = 0;
+		goto out;
+	}
+
+	if (rtnl_batch_init(&batch, &rth, flush_error, &failed) < 0) {
+		ret = -2;
+		goto out;
+	}
+
+	if (show_stats) {
+		printf("\n*** Deleting %llu entries ***\n", flush.count);
+		fflush(stdout);
+		bulk_progress_init(&progress, "Flushing routes");
+	}
+
+	ret = 0;
+	rtnl_msgbuf_for_each(&flush, n) {
+		if (rtnl_batch_add(&batch, n, idx++) < 0) {
+			ret = -2;
+			break;
 		}
-		filter.flushed = 0;
-		if (rtnl_dump_filter(&rth, filter_fn, stdout) < 0) {
-			fprintf(stderr, "Flush terminated\n");
-			return -2;
+		if (show_stats)
+			bulk_progress_update(&progress, batch.acked,
+					     flush.count);
+	}
+	if (rtnl_batch_flush(&batch) < 0)
+		ret = -2;
+	rtnl_batch_free(&batch);
+
+	if (show_stats) {
+		__u64 deleted = batch.acked - batch.errors;
+
+		bulk_progress_done(&progress, deleted, failed);
+		printf("*** Flush is complete, %llu entries deleted ***\n",
+		       deleted);
+		fflush(stdout);
+	}
+	if (failed)
+		ret = -2;
+out:
+	filter.flush = NULL;
+	rtnl_msgbuf_free(&flush);
+	return ret;
+}
+
+/*
+ * ip route sync: converge one table to the routes listed in a file.
+ * Routes are identified by family, table, destination, tos and metric;
+ * only the differences are sent, in pipelined batches.  Routes sharing
+ * a key, e.g. added with "ip route append", are told apart by instance.
+ */
+struct sync_key {
+	int		family;
+	__u32		table;
+	__u32		metric;
+	unsigned int	instance;
+	__u8		dst_len;
+	__u8		tos;
+	__u8		dst[16];
+};
+
+struct sync_entry {
+	struct sync_key		key;	/* first, the hash table key */
+	struct nlmsghdr		*n;
+	bool			seen;
+};
+
+struct route_sync {
+	__u32			table;
+	int			protocol;	/* -1: all but kernel routes */
+	__u64			families;	/* BIT(family) of the input */
+	bool			diff;
+	struct rtnl_msgbuf	current;
+	struct rtnl_msgbuf	desired;
+	struct hashtab		index;		/* of sync_entry */
+	__u64			failed;
+};
+
+static void sync_route_key(struct nlmsghdr *n, struct sync_key *key)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[RTA_MAX+1];
+
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r),
+		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+
+	memset(key, 0, sizeof(*key));
+	key->family = r->rtm_family;
+	key->table = rtm_get_table(r, tb);
+	key->dst_len = r->rtm_dst_len;
+	key->tos = r->rtm_tos;
+	if (tb[RTA_DST])
+		memcpy(key->dst, RTA_DATA(tb[RTA_DST]),
+		       min(RTA_PAYLOAD(tb[RTA_DST]), sizeof(key->dst)));
+	if (tb[RTA_PRIORITY])
+		key->metric = rta_getattr_u32(tb[RTA_PRIORITY]);
+	else if (r->rtm_family == AF_INET6)
+		key->metric = 1024;	/* IP6_RT_PRIO_USER */
+}
+
+static int sync_index_current(struct route_sync *rs)
+{
+	struct nlmsghdr *n;
+
+	hashtab_init(&rs->index, sizeof(struct sync_entry),
+		     sizeof(struct sync_key));
+
+	rtnl_msgbuf_for_each(&rs->current, n) {
+		struct sync_entry *e;
+		struct sync_key key;
+		bool found;
+
+		sync_route_key(n, &key);
+		while ((e = hashtab_insert(&rs->index, &key, &found)) && found)
+			key.instance++;
+		if (!e)
+			return -1;
+		e->n = n;
+	}
+	return 0;
+}
+
+/* attributes that make two routes with the same key differ */
+static const unsigned short sync_cmp_attrs[] = {
+	RTA_SRC, RTA_GATEWAY, RTA_PREFSRC,
+	RTA_NH_ID, RTA_METRICS, RTA_ENCAP_TYPE, RTA_ENCAP, RTA_VIA,
+	RTA_NEWDST, RTA_FLOW,
+};
+
+/* attributes that make two nexthops of a multipath route differ */
+static const unsigned short sync_nh_cmp_attrs[] = {
+	RTA_GATEWAY, RTA_VIA, RTA_FLOW, RTA_ENCAP_TYPE, RTA_ENCAP,
+};
+
+static bool sync_attrs_equal(struct rtattr **ta, struct rtattr **tb,
+			     const unsigned short *attrs, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		struct rtattr *x = ta[attrs[i]];
+		struct rtattr *y = tb[attrs[i]];
+
+		if (!x && !y)
+			continue;
+		if (!x || !y || RTA_PAYLOAD(x) != RTA_PAYLOAD(y) ||
+		    memcmp(RTA_DATA(x), RTA_DATA(y), RTA_PAYLOAD(x)))
+			return false;
+	}
+	return true;
+}
+
+/* a is a current nexthop, b a desired one */
+static bool sync_nexthop_equal(struct rtnexthop *a, struct rtnexthop *b)
+{
+	struct rtattr *ta[RTA_MAX+1], *tb[RTA_MAX+1];
+
+	if (a->rtnh_hops != b->rtnh_hops ||
+	    (a->rtnh_flags & RTNH_F_ONLINK) != (b->rtnh_flags & RTNH_F_ONLINK))
+		return false;
+	/* the kernel resolves the device of a gateway */
+	if (b->rtnh_ifindex && a->rtnh_ifindex != b->rtnh_ifindex)
+		return false;
+
+	parse_rtattr(ta, RTA_MAX, RTNH_DATA(a), a->rtnh_len - sizeof(*a));
+	parse_rtattr(tb, RTA_MAX, RTNH_DATA(b), b->rtnh_len - sizeof(*b));
+	return sync_attrs_equal(ta, tb, sync_nh_cmp_attrs,
+				ARRAY_SIZE(sync_nh_cmp_attrs));
+}
+
+static int sync_nexthops(struct rtattr *mp, struct rtnexthop **nh, int max)
+{
+	struct rtnexthop *rtnh = RTA_DATA(mp);
+	int len = RTA_PAYLOAD(mp), count = 0;
+
+	while (len >= (int)sizeof(*rtnh) && rtnh->rtnh_len >= sizeof(*rtnh) &&
+	       rtnh->rtnh_len <= len) {
+		if (count == max)
+			return -1;
+		nh[count++] = rtnh;
+		len -= NLMSG_ALIGN(rtnh->rtnh_len);
+		rtnh = RTNH_NEXT(rtnh);
+	}
+	return count;
+}
+
+#define SYNC_MAX_NEXTHOPS	256
+
+/* the kernel may list the nexthops in another order than the file */
+static bool sync_multipath_equal(struct rtattr *x, struct rtattr *y)
+{
+	struct rtnexthop *a[SYNC_MAX_NEXTHOPS], *b[SYNC_MAX_NEXTHOPS];
+	bool used[SYNC_MAX_NEXTHOPS] = {};
+	int na, nb, i, j;
+
+	if (!x || !y)
+		return !x && !y;
+
+	na = sync_nexthops(x, a, SYNC_MAX_NEXTHOPS);
+	nb = sync_nexthops(y, b, SYNC_MAX_NEXTHOPS);
+	if (na < 0 || na != nb)
+		return false;
+
+	for (i = 0; i < nb; i++) {
+		for (j = 0; j < na; j++) {
+			if (!used[j] && sync_nexthop_equal(a[j], b[i]))
+				break;
 		}
-		if (filter.flushed == 0) {
-			if (show_stats) {
-				if (round == 0 &&
-				    (!filter.cloned || family == AF_INET6))
-					printf("Nothing to flush.\n");
-				else
-					printf("*** Flush is complete after %d round%s ***\n",
-					       round, round > 1 ? "s" : "");
-			}
-			fflush(stdout);
-			return 0;
+		if (j == na)
+			return false;
+		used[j] = true;
+	}
+	return true;
+}
+
+/* a is the current route, b the desired one */
+static bool sync_route_equal(struct nlmsghdr *a, struct nlmsghdr *b)
+{
+	struct rtmsg *ra = NLMSG_DATA(a), *rb = NLMSG_DATA(b);
+	struct rtattr *ta[RTA_MAX+1], *tb[RTA_MAX+1];
+
+	if (ra->rtm_type != rb->rtm_type ||
+	    ra->rtm_scope != rb->rtm_scope ||
+	    ra->rtm_protocol != rb->rtm_protocol ||
+	    ra->rtm_src_len != rb->rtm_src_len ||
+	    (ra->rtm_flags & RTNH_F_ONLINK) != (rb->rtm_flags & RTNH_F_ONLINK))
+		return false;
+
+	parse_rtattr(ta, RTA_MAX, RTM_RTA(ra),
+		     a->nlmsg_len - NLMSG_LENGTH(sizeof(*ra)));
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(rb),
+		     b->nlmsg_len - NLMSG_LENGTH(sizeof(*rb)));
+
+	if (!sync_attrs_equal(ta, tb, sync_cmp_attrs,
+			      ARRAY_SIZE(sync_cmp_attrs)) ||
+	    !sync_multipath_equal(ta[RTA_MULTIPATH], tb[RTA_MULTIPATH]))
+		return false;
+
+	/* the kernel resolves the device of a gateway */
+	if (tb[RTA_OIF] &&
+	    (!ta[RTA_OIF] ||
+	     rta_getattr_u32(ta[RTA_OIF]) != rta_getattr_u32(tb[RTA_OIF])))
+		return false;
+
+	/* the kernel reports the default preference explicitly */
+	return (ta[RTA_PREF] ? rta_getattr_u8(ta[RTA_PREF]) : 0) ==
+	       (tb[RTA_PREF] ? rta_getattr_u8(tb[RTA_PREF]) : 0);
+}
+
+/*
+ * Find the current route a desired one stands for: an unused instance of
+ * its key equal to it, else the only instance if the key has just one,
+ * which is then replaced.  *instances is set to the number of instances.
+ */
+static struct sync_entry *sync_match(struct route_sync *rs,
+				     struct nlmsghdr *n, bool *equal,
+				     unsigned int *instances)
+{
+	struct sync_entry *e, *only = NULL;
+	struct sync_key key;
+
+	*equal = false;
+	sync_route_key(n, &key);
+	while ((e = hashtab_lookup(&rs->index, &key))) {
+		if (!e->seen && sync_route_equal(e->n, n)) {
+			*equal = true;
+			break;
 		}
-		round++;
-		ret = flush_update();
-		if (ret < 0)
-			return ret;
-
-		if (time(0) - start > 30) {
-			printf("\n*** Flush not completed after %ld seconds, %d entries remain ***\n",
-			       (long)(time(0) - start), filter.flushed);
-			fflush(stdout);
+		only = key.instance ? NULL : e;
+		key.instance++;
+	}
+	*instances = key.instance;
+	if (*equal)
+		return e;
+	return only && !only->seen ? only : NULL;
+}
+
+/* does a route belong to the part of the table being synced */
+static bool sync_route_selected(struct route_sync *rs, struct nlmsghdr *n)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[RTA_MAX+1];
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+
+	if (n->nlmsg_type != RTM_NEWROUTE || len < 0)
+		return false;
+	if (r->rtm_family != AF_INET && r->rtm_family != AF_INET6)
+		return false;
+	if (preferred_family != AF_UNSPEC && r->rtm_family != preferred_family)
+		return false;
+	if (r->rtm_flags & RTM_F_CLONED)
+		return false;
+	if (rs->protocol >= 0 ? r->rtm_protocol != rs->protocol :
+				r->rtm_protocol == RTPROT_KERNEL)
+		return false;
+
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+	return rtm_get_table(r, tb) == rs->table;
+}
+
+static int sync_dump_route(struct nlmsghdr *n, void *arg)
+{
+	struct route_sync *rs = arg;
+	struct rtmsg *r = NLMSG_DATA(n);
+
+	/* families missing from the input are left alone */
+	if (!sync_route_selected(rs, n) ||
+	    !(rs->families & BIT(r->rtm_family)))
+		return 0;
+	return rtnl_msgbuf_add(&rs->current, n);
+}
+
+static int sync_add_desired(struct route_sync *rs, struct nlmsghdr *n)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+
+	rs->families |= BIT(r->rtm_family);
+	return rtnl_msgbuf_add(&rs->desired, n);
+}
+
+static int sync_saved_route(struct rtnl_ctrl_data *ctrl,
+			    struct nlmsghdr *n, void *arg)
+{
+	struct route_sync *rs = arg;
+
+	if (!sync_route_selected(rs, n))
+		return 0;
+	return sync_add_desired(rs, n);
+}
+
+static int sync_line(int argc, char **argv, void *arg)
+{
+	struct route_sync *rs = arg;
+	size_t off = rs->desired.len;
+	struct nlmsghdr *n;
+	struct rtmsg *r;
+	int ret;
+
+	route_queue = &rs->desired;
+	ret = iproute_modify(RTM_NEWROUTE, 0, argc, argv);
+	route_queue = NULL;
+	if (ret)
+		return ret;
+
+	n = (struct nlmsghdr *)(rs->desired.buf + off);
+	r = NLMSG_DATA(n);
+	/* routes without a protocol take the one being synced */
+	if (rs->protocol >= 0 && r->rtm_protocol == RTPROT_BOOT)
+		r->rtm_protocol = rs->protocol;
+
+	if (!sync_route_selected(rs, n)) {
+		fprintf(stderr, "Route is outside of the synced table or protocol\n");
+		return -1;
+	}
+	rs->families |= BIT(r->rtm_family);
+	return 0;
+}
+
+static int sync_load(struct route_sync *rs, const char *name)
+{
+	FILE *fp = stdin;
+	int c, ret;
+
+	if (strcmp(name, "-") != 0) {
+		fp = fopen(name, "r");
+		if (!fp) {
+			fprintf(stderr,
+				"Cannot open file \"%s\" for reading: %s\n",
+				name, strerror(errno));
 			return -1;
 		}
+	}
+
+	/* either an "ip route save" stream or one ROUTE per line */
+	c = getc(fp);
+	if (c == (IP_ROUTE_DUMP_MAGIC & 0xff)) {
+		__u32 magic = c;
+
+		if (fread((char *)&magic + 1, sizeof(magic) - 1, 1, fp) != 1 ||
+		    magic != IP_ROUTE_DUMP_MAGIC) {
+			fprintf(stderr, "%s: bad route dump magic %x\n",
+				name, magic);
+			ret = -1;
+		} else {
+			ret = rtnl_from_file(fp, sync_saved_route, rs);
+		}
+	} else {
+		if (c != EOF)
+			ungetc(c, fp);
+		ret = do_batch_fp(fp, name, false, sync_line, rs);
+	}
+
+	if (fp != stdin)
+		fclose(fp);
+	return ret ? -1 : 0;
+}
+
+static void sync_print(const char *action, const char *mark,
+		       struct nlmsghdr *n)
+{
+	open_json_object(NULL);
+	print_string(PRINT_JSON, "action", NULL, action);
+	print_string(PRINT_FP, NULL, "%s ", mark);
+	open_json_array(PRINT_JSON, "routes");
+	print_route(n, stdout);
+	close_json_array(PRINT_JSON, NULL);
+	close_json_object();
+}
+
+static int sync_error(struct rtnl_batch *b, __u32 cookie, int error,
+		      struct nlmsghdr *n, void *arg)
+{
+	struct route_sync *rs = arg;
+
+	/* deleted routes may already be gone */
+	if (error == -ESRCH || error == -ENOENT)
+		return 0;
+
+	rs->failed++;
+	rtnl_print_ack_error(n);
+	return 0;
+}
+
+static int sync_submit(struct rtnl_batch *batch, struct nlmsghdr *n,
+		       __u16 type, __u16 flags, __u32 *idx)
+{
+	n->nlmsg_type = type;
+	n->nlmsg_flags = NLM_F_REQUEST | flags;
+	return rtnl_batch_add(batch, n, (*idx)++);
+}
+
+static int iproute_sync(int argc, char **argv)
+{
+	struct route_sync rs = {
+		.table = RT_TABLE_MAIN,
+		.protocol = -1,
+	};
+	__u64 added = 0, replaced = 0, unchanged = 0, deleted = 0;
+	struct rtnl_msgbuf deletes = {};
+	struct bulk_progress progress;
+	struct rtnl_batch batch;
+	const char *name = "-";
+	struct sync_entry *e;
+	struct nlmsghdr *n;
+	unsigned int pos;
+	__u32 idx = 0;
+	int ret = -1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "table") == 0) {
+			NEXT_ARG();
+			if (rtnl_rttable_a2n(&rs.table, *argv))
+				invarg("\"table\" value is invalid\n", *argv);
+		} else if (strcmp(*argv, "proto") == 0 ||
+			   strcmp(*argv, "protocol") == 0) {
+			__u32 prot;
+
+			NEXT_ARG();
+			if (rtnl_rtprot_a2n(&prot, *argv))
+				invarg("\"protocol\" value is invalid\n", *argv);
+			rs.protocol = prot;
+		} else if (strcmp(*argv, "diff") == 0) {
+			rs.diff = true;
+		} else if (strcmp(*argv, "help") == 0) {
+			usage();
+		} else {
+			name = *argv;
+		}
+		argc--; argv++;
+	}
+
+	if (sync_load(&rs, name))
+		goto out;
+	/* an explicit family is synced even when the input has no routes */
+	if (preferred_family != AF_UNSPEC)
+		rs.families |= BIT(preferred_family);
 
-		if (show_stats) {
-			printf("\n*** Round %d, deleting %d entries ***\n",
-			       round, filter.flushed);
-			fflush(stdout);
+	if (rtnl_routedump_req(&rth, preferred_family, NULL) < 0) {
+		perror("Cannot send dump request");
+		goto out;
+	}
+	if (rtnl_dump_filter(&rth, sync_dump_route, &rs) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out;
+	}
+	if (sync_index_current(&rs))
+		goto out;
+
+	iproute_reset_filter(0);
+	new_json_obj(json);
+	if (!rs.diff) {
+		if (rtnl_batch_init(&batch, &rth, sync_error, &rs) < 0)
+			goto out_json;
+		if (show_stats)
+			bulk_progress_init(&progress, "Syncing routes");
+	}
+
+	ret = 0;
+	rtnl_msgbuf_for_each(&rs.desired, n) {
+		__u16 flags = NLM_F_CREATE | NLM_F_REPLACE;
+		unsigned int instances;
+		bool equal;
+
+		e = sync_match(&rs, n, &equal, &instances);
+		if (e) {
+			e->seen = true;
+			if (equal) {
+				unchanged++;
+				continue;
+			}
+			replaced++;
+			if (rs.diff)
+				sync_print("replace", "~", n);
+		} else {
+			/*
+			 * A replace could hit any of several routes with the
+			 * key, add one more instead; the unused ones get
+			 * deleted below.
+			 */
+			if (instances)
+				flags = NLM_F_CREATE | NLM_F_APPEND;
+			added++;
+			if (rs.diff)
+				sync_print("add", "+", n);
+		}
+		if (!rs.diff &&
+		    sync_submit(&batch, n, RTM_NEWROUTE, flags, &idx) < 0) {
+			ret = -2;
+			break;
 		}
 	}
+
+	hashtab_for_each(&rs.index, pos, e) {
+		struct rtattr *tb[RTA_MAX+1];
+		struct rtmsg *r;
+
+		if (ret)
+			break;
+		if (e->seen)
+			continue;
+
+		deleted++;
+		if (rs.diff) {
+			sync_print("delete", "-", e->n);
+			continue;
+		}
+		r = NLMSG_DATA(e->n);
+		parse_rtattr(tb, RTA_MAX, RTM_RTA(r),
+			     e->n->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+		if (flush_queue_route(&deletes, e->n, tb) < 0)
+			ret = -2;
+	}
+
+	if (!rs.diff) {
+		rtnl_msgbuf_for_each(&deletes, n) {
+			if (ret || rtnl_batch_add(&batch, n, idx++) < 0) {
+				ret = -2;
+				break;
+			}
+			if (show_stats)
+				bulk_progress_update(&progress, batch.acked,
+						     added + replaced + deleted);
+		}
+		if (rtnl_batch_flush(&batch) < 0)
+			ret = -2;
+		rtnl_batch_free(&batch);
+		if (show_stats)
+			bulk_progress_done(&progress,
+					   batch.acked - batch.errors,
+					   rs.failed);
+		if (rs.failed)
+			ret = -2;
+	}
+
+out_json:
+	delete_json_obj();
+	fflush(stdout);
+	if (show_stats || rs.diff)
+		fprintf(stderr,
+			"%llu added, %llu replaced, %llu deleted, %llu unchanged\n",
+			added, replaced, deleted, unchanged);
+out:
+	hashtab_free(&rs.index);
+	rtnl_msgbuf_free(&deletes);
+	rtnl_msgbuf_free(&rs.current);
+	rtnl_msgbuf_free(&rs.desired);
+	return ret;
 }
 
 static int save_route_errhndlr(struct nlmsghdr *n, void *arg)
@@ -2039,29 +2658,33 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 }
 
 
-static int iproute_get(int argc, char **argv)
-{
+struct route_get {
 	struct {
 		struct nlmsghdr	n;
 		struct rtmsg		r;
 		char			buf[1024];
-	} req = {
-		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg)),
-		.n.nlmsg_flags = NLM_F_REQUEST,
-		.n.nlmsg_type = RTM_GETROUTE,
-		.r.rtm_family = preferred_family,
-	};
+	} req;
+	char	*idev;
+	char	*odev;
+	int	connected;
+	int	from_ok;
+};
+
+static int iproute_get_parse(int argc, char **argv, struct route_get *rg)
+{
 	char  *idev = NULL;
 	char  *odev = NULL;
-	struct nlmsghdr *answer;
 	int connected = 0;
 	int fib_match = 0;
 	int from_ok = 0;
 	unsigned int mark = 0;
 	bool address_found = false;
 
-	iproute_reset_filter(0);
-	filter.cloned = 2;
+	memset(rg, 0, sizeof(*rg));
+	rg->req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	rg->req.n.nlmsg_flags = NLM_F_REQUEST;
+	rg->req.n.nlmsg_type = RTM_GETROUTE;
+	rg->req.r.rtm_family = preferred_family;
 
 	while (argc > 0) {
 		if (strcmp(*argv, "tos") == 0 ||
@@ -2071,7 +2694,7 @@ static int iproute_get(int argc, char **argv)
 			NEXT_ARG();
 			if (rtnl_dsfield_a2n(&tos, *argv))
 				invarg("TOS value is invalid\n", *argv);
-			req.r.rtm_tos = tos;
+			rg->req.r.rtm_tos = tos;
 		} else if (matches(*argv, "from") == 0) {
 			inet_prefix addr;
 
@@ -2079,13 +2702,13 @@ static int iproute_get(int argc, char **argv)
 			if (matches(*argv, "help") == 0)
 				usage();
 			from_ok = 1;
-			get_prefix(&addr, *argv, req.r.rtm_family);
-			if (req.r.rtm_family == AF_UNSPEC)
-				req.r.rtm_family = addr.family;
+			get_prefix(&addr, *argv, rg->req.r.rtm_family);
+			if (rg->req.r.rtm_family == AF_UNSPEC)
+				rg->req.r.rtm_family = addr.family;
 			if (addr.bytelen)
-				addattr_l(&req.n, sizeof(req), RTA_SRC,
+				addattr_l(&rg->req.n, sizeof(rg->req), RTA_SRC,
 					  &addr.data, addr.bytelen);
-			req.r.rtm_src_len = addr.bitlen;
+			rg->req.r.rtm_src_len = addr.bitlen;
 		} else if (matches(*argv, "iif") == 0) {
 			NEXT_ARG();
 			idev = *argv;
@@ -2098,7 +2721,7 @@ static int iproute_get(int argc, char **argv)
 			NEXT_ARG();
 			odev = *argv;
 		} else if (matches(*argv, "notify") == 0) {
-			req.r.rtm_flags |= RTM_F_NOTIFY;
+			rg->req.r.rtm_flags |= RTM_F_NOTIFY;
 		} else if (matches(*argv, "connected") == 0) {
 			connected = 1;
 		} else if (matches(*argv, "vrf") == 0) {
@@ -2112,7 +2735,7 @@ static int iproute_get(int argc, char **argv)
 			NEXT_ARG();
 			if (get_unsigned(&uid, *argv, 0))
 				invarg("invalid UID\n", *argv);
-			addattr32(&req.n, sizeof(req), RTA_UID, uid);
+			addattr32(&rg->req.n, sizeof(rg->req), RTA_UID, uid);
 		} else if (matches(*argv, "fibmatch") == 0) {
 			fib_match = 1;
 		} else if (strcmp(*argv, "as") == 0) {
@@ -2121,10 +2744,10 @@ static int iproute_get(int argc, char **argv)
 			NEXT_ARG();
 			if (strcmp(*argv, "to") == 0)
 				NEXT_ARG();
-			get_addr(&addr, *argv, req.r.rtm_family);
-			if (req.r.rtm_family == AF_UNSPEC)
-				req.r.rtm_family = addr.family;
-			addattr_l(&req.n, sizeof(req), RTA_NEWDST,
+			get_addr(&addr, *argv, rg->req.r.rtm_family);
+			if (rg->req.r.rtm_family == AF_UNSPEC)
+				rg->req.r.rtm_family = addr.family;
+			addattr_l(&rg->req.n, sizeof(rg->req), RTA_NEWDST,
 				  &addr.data, addr.bytelen);
 		} else if (matches(*argv, "sport") == 0) {
 			__be16 sport;
@@ -2132,14 +2755,14 @@ static int iproute_get(int argc, char **argv)
 			NEXT_ARG();
 			if (get_be16(&sport, *argv, 0))
 				invarg("invalid sport\n", *argv);
-			addattr16(&req.n, sizeof(req), RTA_SPORT, sport);
+			addattr16(&rg->req.n, sizeof(rg->req), RTA_SPORT, sport);
 		} else if (matches(*argv, "dport") == 0) {
 			__be16 dport;
 
 			NEXT_ARG();
 			if (get_be16(&dport, *argv, 0))
 				invarg("invalid dport\n", *argv);
-			addattr16(&req.n, sizeof(req), RTA_DPORT, dport);
+			addattr16(&rg->req.n, sizeof(rg->req), RTA_DPORT, dport);
 		} else if (matches(*argv, "ipproto") == 0) {
 			int ipproto;
 
@@ -2148,14 +2771,14 @@ static int iproute_get(int argc, char **argv)
 			if (ipproto < 0)
 				invarg("Invalid \"ipproto\" value\n",
 				       *argv);
-			addattr8(&req.n, sizeof(req), RTA_IP_PROTO, ipproto);
+			addattr8(&rg->req.n, sizeof(rg->req), RTA_IP_PROTO, ipproto);
 		} else if (strcmp(*argv, "flowlabel") == 0) {
 			__be32 flowlabel;
 
 			NEXT_ARG();
 			if (get_be32(&flowlabel, *argv, 0))
 				invarg("invalid flowlabel", *argv);
-			addattr32(&req.n, sizeof(req), RTA_FLOWLABEL,
+			addattr32(&rg->req.n, sizeof(rg->req), RTA_FLOWLABEL,
 				  flowlabel);
 		} else {
 			inet_prefix addr;
@@ -2165,24 +2788,24 @@ static int iproute_get(int argc, char **argv)
 			}
 			if (matches(*argv, "help") == 0)
 				usage();
-			get_prefix(&addr, *argv, req.r.rtm_family);
-			if (req.r.rtm_family == AF_UNSPEC)
-				req.r.rtm_family = addr.family;
+			get_prefix(&addr, *argv, rg->req.r.rtm_family);
+			if (rg->req.r.rtm_family == AF_UNSPEC)
+				rg->req.r.rtm_family = addr.family;
 			if (addr.bytelen)
-				addattr_l(&req.n, sizeof(req),
+				addattr_l(&rg->req.n, sizeof(rg->req),
 					  RTA_DST, &addr.data, addr.bytelen);
-			if (req.r.rtm_family == AF_INET && addr.bitlen != 32) {
+			if (rg->req.r.rtm_family == AF_INET && addr.bitlen != 32) {
 				fprintf(stderr,
 					"Warning: /%u as prefix is invalid, only /32 (or none) is supported.\n",
 					addr.bitlen);
-				req.r.rtm_dst_len = 32;
-			} else if (req.r.rtm_family == AF_INET6 && addr.bitlen != 128) {
+				rg->req.r.rtm_dst_len = 32;
+			} else if (rg->req.r.rtm_family == AF_INET6 && addr.bitlen != 128) {
 				fprintf(stderr,
 					"Warning: /%u as prefix is invalid, only /128 (or none) is supported.\n",
 					addr.bitlen);
-				req.r.rtm_dst_len = 128;
+				rg->req.r.rtm_dst_len = 128;
 			} else
-				req.r.rtm_dst_len = addr.bitlen;
+				rg->req.r.rtm_dst_len = addr.bitlen;
 			address_found = true;
 		}
 		argc--; argv++;
@@ -2200,33 +2823,139 @@ static int iproute_get(int argc, char **argv)
 			idx = ll_name_to_index(idev);
 			if (!idx)
 				return nodev(idev);
-			addattr32(&req.n, sizeof(req), RTA_IIF, idx);
+			addattr32(&rg->req.n, sizeof(rg->req), RTA_IIF, idx);
 		}
 		if (odev) {
 			idx = ll_name_to_index(odev);
 			if (!idx)
 				return nodev(odev);
-			addattr32(&req.n, sizeof(req), RTA_OIF, idx);
+			addattr32(&rg->req.n, sizeof(rg->req), RTA_OIF, idx);
 		}
 	}
 	if (mark)
-		addattr32(&req.n, sizeof(req), RTA_MARK, mark);
+		addattr32(&rg->req.n, sizeof(rg->req), RTA_MARK, mark);
 
-	if (req.r.rtm_family == AF_UNSPEC)
-		req.r.rtm_family = AF_INET;
+	if (rg->req.r.rtm_family == AF_UNSPEC)
+		rg->req.r.rtm_family = AF_INET;
 
 	/* Only IPv4 supports the RTM_F_LOOKUP_TABLE flag */
-	if (req.r.rtm_family == AF_INET)
-		req.r.rtm_flags |= RTM_F_LOOKUP_TABLE;
+	if (rg->req.r.rtm_family == AF_INET)
+		rg->req.r.rtm_flags |= RTM_F_LOOKUP_TABLE;
 	if (fib_match)
-		req.r.rtm_flags |= RTM_F_FIB_MATCH;
+		rg->req.r.rtm_flags |= RTM_F_FIB_MATCH;
 
-	if (rtnl_talk(&rth, &req.n, &answer) < 0)
+	rg->idev = idev;
+	rg->odev = odev;
+	rg->connected = connected;
+	rg->from_ok = from_ok;
+	return 0;
+}
+
+static int iproute_get_batch_reply(struct rtnl_batch *b, __u32 cookie,
+				   int error, struct nlmsghdr *n, void *arg)
+{
+	if (!is_json_context()) {
+		if (error)
+			return rtnl_batch_report_line(b, cookie, error, n, arg);
+		return print_route(n, stdout) < 0 ? -1 : 0;
+	}
+
+	/* results are keyed by the line of the request */
+	open_json_object(NULL);
+	print_uint(PRINT_JSON, "line", NULL, cookie);
+	if (error) {
+		print_string(PRINT_JSON, "error", NULL, strerror(-error));
+	} else {
+		open_json_array(PRINT_JSON, "routes");
+		print_route(n, stdout);
+		close_json_array(PRINT_JSON, NULL);
+	}
+	close_json_object();
+	return 0;
+}
+
+static int iproute_get_batch_cmd(int argc, char **argv, void *batch)
+{
+	struct route_get rg;
+	int ret;
+
+	ret = iproute_get_parse(argc, argv, &rg);
+	if (ret)
+		return ret;
+
+	if (rg.connected) {
+		fprintf(stderr, "\"connected\" is not supported in batch mode\n");
+		return -1;
+	}
+
+	return rtnl_batch_add(batch, &rg.req.n, cmdlineno);
+}
+
+/*
+ * Each line of the file holds the arguments of one "ip route get";
+ * lookups are pipelined and answered in order.
+ */
+static int iproute_get_batch(const char *name)
+{
+	struct rtnl_batch batch;
+	FILE *fp = stdin;
+	int ret, failed;
+
+	if (strcmp(name, "-") != 0) {
+		fp = fopen(name, "r");
+		if (!fp) {
+			fprintf(stderr,
+				"Cannot open file \"%s\" for reading: %s\n",
+				name, strerror(errno));
+			return -1;
+		}
+	}
+
+	if (rtnl_batch_init(&batch, &rth, iproute_get_batch_reply,
+			    (void *)name) < 0) {
+		ret = -1;
+		goto out;
+	}
+
+	new_json_obj(json);
+	failed = do_batch_fp_rtnl(fp, name, iproute_get_batch_cmd, &batch);
+	ret = rtnl_batch_flush(&batch) < 0 ? -2 : 0;
+	delete_json_obj();
+
+	if (batch_report(name, "lookups", batch.errors + failed,
+			 batch.sent + failed))
+		ret = -2;
+
+	rtnl_batch_free(&batch);
+out:
+	if (fp != stdin)
+		fclose(fp);
+	return ret;
+}
+
+static int iproute_get(int argc, char **argv)
+{
+	struct nlmsghdr *answer;
+	struct route_get rg;
+	int ret;
+
+	iproute_reset_filter(0);
+	filter.cloned = 2;
+
+	if (argc > 0 &&
+	    (strcmp(*argv, "batch") == 0 || strcmp(*argv, "-batch") == 0))
+		return iproute_get_batch(argc > 1 ? argv[1] : "-");
+
+	ret = iproute_get_parse(argc, argv, &rg);
+	if (ret)
+		return ret;
+
+	if (rtnl_talk(&rth, &rg.req.n, &answer) < 0)
 		return -2;
 
 	new_json_obj(json);
 
-	if (connected && !from_ok) {
+	if (rg.connected && !rg.from_ok) {
 		struct rtmsg *r = NLMSG_DATA(answer);
 		int len = answer->nlmsg_len;
 		struct rtattr *tb[RTA_MAX+1];
@@ -2263,20 +2992,20 @@ static int iproute_get(int argc, char **argv)
 			free(answer);
 			return -1;
 		}
-		if (!odev && tb[RTA_OIF])
+		if (!rg.odev && tb[RTA_OIF])
 			tb[RTA_OIF]->rta_type = 0;
 		if (tb[RTA_GATEWAY])
 			tb[RTA_GATEWAY]->rta_type = 0;
 		if (tb[RTA_VIA])
 			tb[RTA_VIA]->rta_type = 0;
-		if (!idev && tb[RTA_IIF])
+		if (!rg.idev && tb[RTA_IIF])
 			tb[RTA_IIF]->rta_type = 0;
-		req.n.nlmsg_flags = NLM_F_REQUEST;
-		req.n.nlmsg_type = RTM_GETROUTE;
+		rg.req.n.nlmsg_flags = NLM_F_REQUEST;
+		rg.req.n.nlmsg_type = RTM_GETROUTE;
 
 		delete_json_obj();
 		free(answer);
-		if (rtnl_talk(&rth, &req.n, &answer) < 0)
+		if (rtnl_talk(&rth, &rg.req.n, &answer) < 0)
 			return -2;
 	}
 
@@ -2300,42 +3029,60 @@ static int rtattr_cmp(const struct rtattr *rta1, const struct rtattr *rta2)
 	return memcmp(RTA_DATA(rta1), RTA_DATA(rta2), RTA_PAYLOAD(rta1));
 }
 
-static int restore_handler(struct rtnl_ctrl_data *ctrl,
-			   struct nlmsghdr *n, void *arg)
+/* Restore routes in correct order:
+ * 0. ones for local addresses,
+ * 1. ones for local networks,
+ * 2. others (remote networks/hosts).
+ */
+#define RESTORE_PRIO_MAX	3
+
+struct route_restore {
+	struct rtnl_msgbuf	bucket[RESTORE_PRIO_MAX];
+	__u64			total;
+	__u64			failed;
+};
+
+static int restore_prio(struct nlmsghdr *n)
 {
 	struct rtmsg *r = NLMSG_DATA(n);
 	struct rtattr *tb[RTA_MAX+1];
 	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
-	int ret, prio = *(int *)arg;
 
 	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
 
-	/* Restore routes in correct order:
-	 * 0. ones for local addresses,
-	 * 1. ones for local networks,
-	 * 2. others (remote networks/hosts).
-	 */
-	if (!prio && !tb[RTA_GATEWAY] && (!tb[RTA_PREFSRC] ||
-	    !rtattr_cmp(tb[RTA_PREFSRC], tb[RTA_DST])))
-		goto restore;
-	else if (prio == 1 && !tb[RTA_GATEWAY] && tb[RTA_PREFSRC] &&
-		 rtattr_cmp(tb[RTA_PREFSRC], tb[RTA_DST]))
-		goto restore;
-	else if (prio == 2 && tb[RTA_GATEWAY])
-		goto restore;
+	if (tb[RTA_GATEWAY])
+		return 2;
+	if (!tb[RTA_PREFSRC] || !rtattr_cmp(tb[RTA_PREFSRC], tb[RTA_DST]))
+		return 0;
+	return 1;
+}
 
-	return 0;
+/* the dump is read once and kept in memory, so it may come from a pipe */
+static int restore_handler(struct rtnl_ctrl_data *ctrl,
+			   struct nlmsghdr *n, void *arg)
+{
+	struct route_restore *rr = arg;
 
-restore:
-	n->nlmsg_flags |= NLM_F_REQUEST | NLM_F_CREATE | NLM_F_ACK;
+	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(struct rtmsg)))
+		return 0;
 
-	ll_init_map(&rth);
+	if (rtnl_msgbuf_add(&rr->bucket[restore_prio(n)], n) < 0)
+		return -1;
+	rr->total++;
+	return 0;
+}
 
-	ret = rtnl_talk(&rth, n, NULL);
-	if ((ret < 0) && (errno == EEXIST))
-		ret = 0;
+static int restore_error(struct rtnl_batch *b, __u32 cookie, int error,
+			 struct nlmsghdr *n, void *arg)
+{
+	struct route_restore *rr = arg;
 
-	return ret;
+	if (!error || error == -EEXIST)
+		return 0;
+
+	rr->failed++;
+	rtnl_print_ack_error(n);
+	return 0;
 }
 
 static int route_dump_check_magic(void)
@@ -2359,31 +3106,56 @@ static int route_dump_check_magic(void)
 
 static int iproute_restore(void)
 {
-	int pos, prio;
+	struct route_restore rr = {};
+	struct bulk_progress progress;
+	struct rtnl_batch batch;
+	__u64 done = 0;
+	int prio, ret = 0;
 
 	if (route_dump_check_magic())
 		return -1;
 
-	pos = ftell(stdin);
-	if (pos == -1) {
-		perror("Failed to restore: ftell");
-		return -1;
-	}
+	if (rtnl_from_file(stdin, &restore_handler, &rr))
+		ret = -2;
 
-	for (prio = 0; prio < 3; prio++) {
-		int err;
+	if (!ret && rtnl_batch_init(&batch, &rth, restore_error, &rr) < 0)
+		ret = -1;
 
-		err = rtnl_from_file(stdin, &restore_handler, &prio);
-		if (err)
-			return -2;
+	if (ret)
+		goto out;
 
-		if (fseek(stdin, pos, SEEK_SET) == -1) {
-			perror("Failed to restore: fseek");
-			return -1;
+	if (show_stats)
+		bulk_progress_init(&progress, "Restoring routes");
+
+	/* requests are handled in order, so the classes stay ordered */
+	for (prio = 0; prio < RESTORE_PRIO_MAX && !ret; prio++) {
+		struct nlmsghdr *n;
+
+		rtnl_msgbuf_for_each(&rr.bucket[prio], n) {
+			n->nlmsg_flags |= NLM_F_REQUEST | NLM_F_CREATE;
+			if (rtnl_batch_add(&batch, n, done++) < 0) {
+				ret = -2;
+				break;
+			}
+			if (show_stats)
+				bulk_progress_update(&progress, batch.acked,
+						     rr.total);
 		}
 	}
 
-	return 0;
+	if (rtnl_batch_flush(&batch) < 0)
+		ret = -2;
+	if (show_stats)
+		bulk_progress_done(&progress, batch.acked - rr.failed,
+				   rr.failed);
+	if (rr.failed)
+		ret = -2;
+
+	rtnl_batch_free(&batch);
+out:
+	for (prio = 0; prio < RESTORE_PRIO_MAX; prio++)
+		rtnl_msgbuf_free(&rr.bucket[prio]);
+	return ret;
 }
 
 static int show_handler(struct rtnl_ctrl_data *ctrl,
@@ -2453,6 +3225,10 @@ int do_iproute(int argc, char **argv)
 		return iproute_restore();
 	if (matches(*argv, "showdump") == 0)
 		return iproute_showdump();
+	if (strcmp(*argv, "lookup") == 0)
+		return iproute_lookup(argc-1, argv+1);
+	if (strcmp(*argv, "sync") == 0)
+		return iproute_sync(argc-1, argv+1);
 	if (matches(*argv, "help") == 0)
 		usage();
 
@@ -0,0 +1,567 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * iproute_lookup.c	Route lookups in "ip route save" snapshots.
+ *
+ * The saved routes are indexed per table in sorted prefix arrays, one
+ * per populated prefix length, which are searched longest first.  Rules
+ * come from an "ip rule save" snapshot or default to the kernel's
+ * local/main/default rules.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <net/if.h>
+#include <linux/fib_rules.h>
+
+#include "rt_names.h"
+#include "utils.h"
+#include "ip_common.h"
+#include "iprule_match.h"
+
+struct lpm_prefix {
+	__u8			addr[16];
+	__u32			metric;
+	struct nlmsghdr		*n;
+};
+
+struct lpm_level {
+	struct lpm_prefix	*prefixes;
+	unsigned int		count;
+	unsigned int		size;
+};
+
+struct lpm_table {
+	__u32			id;
+	int			family;
+	int			bytelen;
+	int			nlens;
+	__u8			lens[129];	/* populated, longest first */
+	struct lpm_level	level[129];
+};
+
+struct lookup_key {
+	struct ip_rule_tuple	t;
+	const char		*text;
+};
+
+struct lookup_result {
+	struct nlmsghdr		*route;
+	const struct ip_rule	*rule;
+	int			error;
+};
+
+static struct {
+	struct rtnl_msgbuf	routes;
+	struct rtnl_msgbuf	rules_msgs;
+	struct lpm_table	**tables;
+	int			ntables;
+	struct ip_rule_set	rules;
+	__u32			table;		/* only look up this table */
+	struct bulk_progress	progress;
+	__u64			lookups;
+	__u64			misses;
+} db;
+
+static void usage(void) __attribute__((noreturn));
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: ip route lookup dump FILE [ rules FILE ] [ table TABLE ]\n"
+		"                       [ QUERY_OPTS ] { ADDRESS ... | batch [ FILE ] }\n"
+		"QUERY_OPTS := [ from ADDRESS ] [ iif NAME ] [ oif NAME ] [ mark MARK ]\n"
+		"              [ uid UID ] [ ipproto PROTOCOL ] [ sport NUMBER ]\n"
+		"              [ dport NUMBER ] [ tos TOS ] [ flowlabel FLOWLABEL ]\n");
+	exit(-1);
+}
+
+static int lookup_add_msg(struct rtnl_ctrl_data *ctrl,
+			  struct nlmsghdr *n, void *arg)
+{
+	return rtnl_msgbuf_add(arg, n);
+}
+
+static int lookup_load(const char *name, __u32 magic, struct rtnl_msgbuf *mb)
+{
+	__u32 file_magic = 0;
+	FILE *fp;
+	int ret;
+
+	fp = fopen(name, "r");
+	if (!fp) {
+		fprintf(stderr, "Cannot open \"%s\": %s\n",
+			name, strerror(errno));
+		return -1;
+	}
+
+	if (fread(&file_magic, sizeof(file_magic), 1, fp) != 1 ||
+	    file_magic != magic) {
+		fprintf(stderr, "%s: not a saved dump (magic %x)\n",
+			name, file_magic);
+		fclose(fp);
+		return -1;
+	}
+
+	ret = rtnl_from_file(fp, lookup_add_msg, mb);
+	fclose(fp);
+	return ret;
+}
+
+static void lpm_mask(__u8 *dst, const __u8 *src, int bytelen, int bits)
+{
+	int i;
+
+	for (i = 0; i < bytelen; i++, bits -= 8) {
+		if (bits >= 8)
+			dst[i] = src[i];
+		else if (bits > 0)
+			dst[i] = src[i] & (0xff << (8 - bits));
+		else
+			dst[i] = 0;
+	}
+}
+
+static struct lpm_table *lpm_table_get(int family, __u32 id, bool create)
+{
+	struct lpm_table *t, **tables;
+	int i;
+
+	for (i = 0; i < db.ntables; i++) {
+		t = db.tables[i];
+		if (t->family == family && t->id == id)
+			return t;
+	}
+	if (!create)
+		return NULL;
+
+	tables = realloc(db.tables, (db.ntables + 1) * sizeof(*tables));
+	if (!tables)
+		return NULL;
+	db.tables = tables;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+	t->family = family;
+	t->bytelen = family == AF_INET ? 4 : 16;
+	t->id = id;
+	db.tables[db.ntables++] = t;
+	return t;
+}
+
+static int lpm_insert(struct nlmsghdr *n)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	struct rtattr *tb[RTA_MAX+1];
+	struct lpm_prefix *p;
+	struct lpm_level *l;
+	struct lpm_table *t;
+
+	if (n->nlmsg_type != RTM_NEWROUTE || len < 0)
+		return 0;
+	if (r->rtm_family != AF_INET && r->rtm_family != AF_INET6)
+		return 0;
+	if (r->rtm_flags & RTM_F_CLONED)
+		return 0;
+
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+
+	t = lpm_table_get(r->rtm_family, rtm_get_table(r, tb), true);
+	if (!t)
+		return -1;
+	if (r->rtm_dst_len > t->bytelen * 8)
+		return 0;
+
+	l = &t->level[r->rtm_dst_len];
+	if (l->count == l->size) {
+		unsigned int size = l->size ? l->size * 2 : 64;
+
+		p = realloc(l->prefixes, size * sizeof(*p));
+		if (!p)
+			return -1;
+		l->prefixes = p;
+		l->size = size;
+	}
+
+	p = &l->prefixes[l->count++];
+	memset(p->addr, 0, sizeof(p->addr));
+	if (tb[RTA_DST] && RTA_PAYLOAD(tb[RTA_DST]) >= t->bytelen)
+		lpm_mask(p->addr, RTA_DATA(tb[RTA_DST]), t->bytelen,
+			 r->rtm_dst_len);
+	p->metric = tb[RTA_PRIORITY] ? rta_getattr_u32(tb[RTA_PRIORITY]) : 0;
+	p->n = n;
+	return 0;
+}
+
+static int lpm_prefix_cmp(const void *a, const void *b)
+{
+	const struct lpm_prefix *pa = a, *pb = b;
+	int ret = memcmp(pa->addr, pb->addr, sizeof(pa->addr));
+
+	if (ret)
+		return ret;
+	if (pa->metric != pb->metric)
+		return pa->metric < pb->metric ? -1 : 1;
+	return 0;
+}
+
+/* sort every level and keep only the lowest metric route per prefix */
+static void lpm_table_finish(struct lpm_table *t)
+{
+	int len;
+
+	for (len = t->bytelen * 8; len >= 0; len--) {
+		struct lpm_level *l = &t->level[len];
+		unsigned int i, j;
+
+		if (!l->count)
+			continue;
+
+		qsort(l->prefixes, l->count, sizeof(*l->prefixes),
+		      lpm_prefix_cmp);
+		for (i = 1, j = 0; i < l->count; i++) {
+			if (memcmp(l->prefixes[i].addr, l->prefixes[j].addr,
+				   sizeof(l->prefixes[j].addr)))
+				l->prefixes[++j] = l->prefixes[i];
+		}
+		l->count = j + 1;
+		t->lens[t->nlens++] = len;
+	}
+}
+
+static struct nlmsghdr *lpm_lookup(const struct lpm_table *t, const __u8 *addr)
+{
+	struct lpm_prefix key = {};
+	int i;
+
+	for (i = 0; i < t->nlens; i++) {
+		const struct lpm_level *l = &t->level[t->lens[i]];
+		unsigned int lo = 0, hi = l->count;
+
+		lpm_mask(key.addr, addr, t->bytelen, t->lens[i]);
+		while (lo < hi) {
+			unsigned int mid = (lo + hi) / 2;
+			int ret = memcmp(key.addr, l->prefixes[mid].addr,
+					 t->bytelen);
+
+			if (!ret)
+				return l->prefixes[mid].n;
+			if (ret < 0)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+	}
+
+	return NULL;
+}
+
+static int lookup_default_rules(void)
+{
+	static const struct {
+		int family;
+		__u32 prio;
+		__u32 table;
+	} defaults[] = {
+		{ AF_INET,  0,     RT_TABLE_LOCAL },
+		{ AF_INET,  32766, RT_TABLE_MAIN },
+		{ AF_INET,  32767, RT_TABLE_DEFAULT },
+		{ AF_INET6, 0,     RT_TABLE_LOCAL },
+		{ AF_INET6, 32766, RT_TABLE_MAIN },
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(defaults); i++) {
+		struct ip_rule rule = {
+			.prio = defaults[i].prio,
+			.family = defaults[i].family,
+			.action = FR_ACT_TO_TBL,
+			.table = defaults[i].table,
+			.suppress_prefixlen = -1,
+			.suppress_ifgroup = -1,
+			.uid.end = ~0U,
+		};
+
+		if (ip_rule_set_add_rule(&db.rules, &rule))
+			return -1;
+	}
+	return 0;
+}
+
+static void lookup_table(const struct lookup_key *key, __u32 id,
+			 struct lookup_result *res)
+{
+	const struct lpm_table *t = lpm_table_get(key->t.family, id, false);
+
+	res->route = t ? lpm_lookup(t, key->t.dst) : NULL;
+	res->error = res->route ? 0 : -ENETUNREACH;
+}
+
+static void lookup_route(const struct lookup_key *key,
+			 struct lookup_result *res)
+{
+	int i;
+
+	memset(res, 0, sizeof(*res));
+	res->error = -ENETUNREACH;
+
+	if (db.table) {
+		lookup_table(key, db.table, res);
+		return;
+	}
+
+	for (i = ip_rule_set_next(&db.rules, &key->t, 0); i >= 0;
+	     i = ip_rule_set_next(&db.rules, &key->t, i + 1)) {
+		const struct ip_rule *rule = &db.rules.rules[i];
+		struct rtmsg *r;
+
+		switch (rule->action) {
+		case FR_ACT_TO_TBL:
+			lookup_table(key, rule->table, res);
+			if (!res->route)
+				continue;
+			r = NLMSG_DATA(res->route);
+			if (r->rtm_type == RTN_THROW)
+				continue;
+			if (rule->suppress_prefixlen >= 0 &&
+			    r->rtm_dst_len <= rule->suppress_prefixlen)
+				continue;
+			res->rule = rule;
+			return;
+		case FR_ACT_GOTO: {
+			int target = ip_rule_set_goto(&db.rules, i);
+
+			/* resume right before the target */
+			if (target >= 0)
+				i = target - 1;
+			continue;
+		}
+		case FR_ACT_BLACKHOLE:
+		case FR_ACT_UNREACHABLE:
+		case FR_ACT_PROHIBIT:
+			res->route = NULL;
+			res->rule = rule;
+			res->error = rule->action == FR_ACT_PROHIBIT ?
+				     -EACCES : rule->action == FR_ACT_BLACKHOLE ?
+				     -EINVAL : -ENETUNREACH;
+			return;
+		default:
+			continue;
+		}
+	}
+
+	res->route = NULL;
+	res->error = -ENETUNREACH;
+}
+
+static void lookup_print(const struct lookup_key *key,
+			 const struct lookup_result *res)
+{
+	open_json_object(NULL);
+	print_string(PRINT_ANY, "address", "%s: ", key->text);
+	if (res->rule && (show_details || is_json_context()))
+		print_uint(PRINT_ANY, "rule", "rule %u ", res->rule->prio);
+
+	if (res->route) {
+		open_json_array(PRINT_JSON, "routes");
+		print_route(res->route, stdout);
+		close_json_array(PRINT_JSON, NULL);
+	} else {
+		print_string(PRINT_ANY, "error", "%s\n",
+			     strerror(-res->error));
+	}
+	close_json_object();
+}
+
+static int lookup_parse_key(int argc, char **argv, const struct lookup_key *def,
+			    struct lookup_key *key, int *used)
+{
+	int argc0 = argc;
+
+	*key = *def;
+	while (argc > 0) {
+		int n = ip_rule_tuple_parse(argc, argv, &key->t);
+
+		if (!n)
+			break;
+		argc -= n; argv += n;
+	}
+
+	*used = argc0 - argc;
+	return 0;
+}
+
+static int lookup_one(const char *dst, const struct lookup_key *opts)
+{
+	struct lookup_result res;
+	struct lookup_key key = *opts;
+	inet_prefix addr;
+
+	if (get_addr_1(&addr, dst, key.t.family) ||
+	    (addr.family != AF_INET && addr.family != AF_INET6)) {
+		fprintf(stderr, "Invalid address \"%s\"\n", dst);
+		return -1;
+	}
+
+	key.t.family = addr.family;
+	memcpy(key.t.dst, addr.data, addr.bytelen);
+	key.text = dst;
+
+	lookup_route(&key, &res);
+	lookup_print(&key, &res);
+
+	db.lookups++;
+	if (!res.route)
+		db.misses++;
+	return 0;
+}
+
+static int lookup_batch_cmd(int argc, char **argv, void *data)
+{
+	const struct lookup_key *def = data;
+	struct lookup_key key;
+	const char *dst = *argv;
+	int used;
+
+	argc--; argv++;
+	lookup_parse_key(argc, argv, def, &key, &used);
+	if (used != argc) {
+		fprintf(stderr, "Unknown lookup option \"%s\"\n", argv[used]);
+		return -1;
+	}
+	return lookup_one(dst, &key);
+}
+
+static void lookup_free(void)
+{
+	int i, len;
+
+	for (i = 0; i < db.ntables; i++) {
+		for (len = 0; len <= 128; len++)
+			free(db.tables[i]->level[len].prefixes);
+		free(db.tables[i]);
+	}
+	free(db.tables);
+	ip_rule_set_free(&db.rules);
+	rtnl_msgbuf_free(&db.routes);
+	rtnl_msgbuf_free(&db.rules_msgs);
+}
+
+int iproute_lookup(int argc, char **argv)
+{
+	struct lookup_key def = {
+		.t.family = preferred_family,
+		.t.iif = "lo",
+	};
+	const char *routes = NULL, *rules = NULL;
+	struct nlmsghdr *n;
+	int used, i, ret = 0;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dump") == 0) {
+			NEXT_ARG();
+			routes = *argv;
+		} else if (strcmp(*argv, "rules") == 0) {
+			NEXT_ARG();
+			rules = *argv;
+		} else if (strcmp(*argv, "table") == 0) {
+			NEXT_ARG();
+			if (rtnl_rttable_a2n(&db.table, *argv))
+				invarg("invalid table ID\n", *argv);
+		} else if (strcmp(*argv, "help") == 0) {
+			usage();
+		} else {
+			lookup_parse_key(argc, argv, &def, &def, &used);
+			if (!used)
+				break;
+			argc -= used; argv += used;
+			continue;
+		}
+		argc--; argv++;
+	}
+
+	if (!routes) {
+		fprintf(stderr, "\"ip route lookup\" needs a route dump\n");
+		return -1;
+	}
+	if (argc == 0) {
+		fprintf(stderr, "Nothing to look up\n");
+		return -1;
+	}
+
+	if (lookup_load(routes, IP_ROUTE_DUMP_MAGIC, &db.routes) ||
+	    (rules && lookup_load(rules, IP_RULE_DUMP_MAGIC, &db.rules_msgs))) {
+		ret = -1;
+		goto out;
+	}
+
+	/* the dumps are fully loaded, messages no longer move */
+	rtnl_msgbuf_for_each(&db.routes, n) {
+		if (lpm_insert(n)) {
+			fprintf(stderr, "Not enough memory to index routes\n");
+			ret = -1;
+			goto out;
+		}
+	}
+	for (i = 0; i < db.ntables; i++)
+		lpm_table_finish(db.tables[i]);
+
+	if (rules) {
+		rtnl_msgbuf_for_each(&db.rules_msgs, n) {
+			if (ip_rule_set_add(&db.rules, n)) {
+				ret = -1;
+				goto out;
+			}
+		}
+	} else if (lookup_default_rules()) {
+		ret = -1;
+		goto out;
+	}
+	if (ip_rule_set_compile(&db.rules)) {
+		ret = -1;
+		goto out;
+	}
+
+	iproute_reset_filter(0);
+	new_json_obj(json);
+	if (show_stats)
+		bulk_progress_init(&db.progress, "Lookups");
+
+	if (strcmp(*argv, "batch") == 0) {
+		const char *name = argc > 1 ? argv[1] : "-";
+		FILE *fp = stdin;
+
+		if (strcmp(name, "-") != 0) {
+			fp = fopen(name, "r");
+			if (!fp) {
+				fprintf(stderr,
+					"Cannot open file \"%s\" for reading: %s\n",
+					name, strerror(errno));
+				ret = -1;
+				goto out_json;
+			}
+		}
+		ret = do_batch_fp_rtnl(fp, name, lookup_batch_cmd, &def) ?
+			-1 : 0;
+		if (fp != stdin)
+			fclose(fp);
+	} else {
+		for (; argc > 0; argc--, argv++) {
+			if (lookup_one(*argv, &def))
+				ret = -1;
+		}
+	}
+
+out_json:
+	delete_json_obj();
+	if (show_stats)
+		bulk_progress_done(&db.progress, db.lookups - db.misses,
+				   db.misses);
+out:
+	lookup_free();
+	return ret;
+}
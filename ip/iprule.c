@@ -22,6 +22,8 @@
 #include "utils.h"
 #include "ip_common.h"
 #include "json_print.h"
+#include "iprule_match.h"
+#include "hashtab.h"
 
 #define PORT_MAX_MASK 0xFFFF
 #define DSCP_MAX_MASK 0x3F
@@ -34,6 +36,9 @@ enum list_action {
 
 extern struct rtnl_handle rth;
 
+/* when set, iprule_modify() queues its request here instead of sending it */
+static struct rtnl_msgbuf *rule_queue;
+
 static void usage(void) __attribute__((noreturn));
 
 static void usage(void)
@@ -42,6 +47,8 @@ static void usage(void)
 		"Usage: ip rule { add | del } SELECTOR ACTION\n"
 		"       ip rule { flush | save | restore }\n"
 		"       ip rule [ list [ SELECTOR ]]\n"
+		"       ip rule sync [ proto RTPROTO ] [ diff ] [ FILE ]\n"
+		"       ip rule match [ rules FILE ] { PACKET | batch [ FILE ] }\n"
 		"SELECTOR := [ not ] [ from PREFIX ] [ to PREFIX ] [ tos TOS ]\n"
 		"            [ fwmark FWMARK[/MASK] ]\n"
 		"            [ iif STRING ] [ oif STRING ] [ pref NUMBER ] [ l3mdev ]\n"
@@ -58,7 +65,11 @@ static void usage(void)
 		"          SUPPRESSOR\n"
 		"SUPPRESSOR := [ suppress_prefixlength NUMBER ]\n"
 		"              [ suppress_ifgroup DEVGROUP ]\n"
-		"TABLE_ID := [ local | main | default | NUMBER ]\n");
+		"TABLE_ID := [ local | main | default | NUMBER ]\n"
+		"PACKET := [ from ADDRESS ] [ to ADDRESS ] [ iif NAME ] [ oif NAME ]\n"
+		"          [ fwmark MARK ] [ uid UID ] [ ipproto PROTOCOL ]\n"
+		"          [ sport NUMBER ] [ dport NUMBER ] [ tos TOS ]\n"
+		"          [ tun_id TUN_ID ] [ flowlabel FLOWLABEL ]\n");
 	exit(-1);
 }
 
@@ -602,7 +613,7 @@ int print_rule(struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
-static __u32 rule_dump_magic = 0x71706986;
+static __u32 rule_dump_magic = IP_RULE_DUMP_MAGIC;
 
 static int save_rule_prep(void)
 {
@@ -1222,6 +1233,9 @@ static int iprule_modify(int cmd, int argc, char **argv)
 	if (!table_ok && cmd == RTM_NEWRULE)
 		req.frh.table = RT_TABLE_MAIN;
 
+	if (rule_queue)
+		return rtnl_msgbuf_add(rule_queue, &req.n);
+
 	if (echo_request)
 		ret = rtnl_echo_talk(&rth, &req.n, json, print_rule);
 	else
@@ -1233,6 +1247,513 @@ static int iprule_modify(int cmd, int argc, char **argv)
 	return 0;
 }
 
+/* read an "ip rule save" stream whose first byte was already consumed */
+static int rule_load_saved(FILE *fp, int c, const char *name,
+			   rtnl_listen_filter_t handler, void *arg)
+{
+	__u32 magic = c;
+
+	if (c == EOF ||
+	    fread((char *)&magic + 1, sizeof(magic) - 1, 1, fp) != 1 ||
+	    magic != rule_dump_magic) {
+		fprintf(stderr, "%s: bad rule dump magic %x\n", name, magic);
+		return -1;
+	}
+	return rtnl_from_file(fp, handler, arg) ? -1 : 0;
+}
+
+static FILE *rule_open(const char *name)
+{
+	FILE *fp;
+
+	if (strcmp(name, "-") == 0)
+		return stdin;
+
+	fp = fopen(name, "r");
+	if (!fp)
+		fprintf(stderr, "Cannot open file \"%s\" for reading: %s\n",
+			name, strerror(errno));
+	return fp;
+}
+
+static void rule_close(FILE *fp)
+{
+	if (fp && fp != stdin)
+		fclose(fp);
+}
+
+/*
+ * ip rule sync: converge the rule list to the rules listed in a file.
+ * Rules are compared by all their selectors and actions; missing rules
+ * are added before stale ones are deleted, so traffic never falls
+ * through to a later rule while the list is being replaced.  Rules
+ * added several times are counted, the extra copies get deleted.
+ */
+struct rule_sync_entry {
+	struct ip_rule		rule;
+	unsigned int		count;	/* copies in the kernel */
+	unsigned int		seen;	/* of them in the file */
+};
+
+struct rule_sync {
+	int			protocol;	/* -1: all but kernel rules */
+	bool			diff;
+	struct rtnl_msgbuf	current;
+	struct rtnl_msgbuf	desired;
+	struct hashtab		index;		/* of rule_sync_entry */
+	__u64			failed;
+};
+
+static bool rule_sync_selected(struct rule_sync *rs, struct nlmsghdr *n)
+{
+	struct ip_rule rule;
+
+	if (n->nlmsg_type != RTM_NEWRULE || ip_rule_parse(n, &rule))
+		return false;
+	if (preferred_family != AF_UNSPEC ? rule.family != preferred_family :
+	    rule.family != AF_INET && rule.family != AF_INET6)
+		return false;
+	return rs->protocol >= 0 ? rule.protocol == rs->protocol :
+				   rule.protocol != RTPROT_KERNEL;
+}
+
+static int rule_sync_index(struct rule_sync *rs)
+{
+	struct nlmsghdr *n;
+
+	hashtab_init(&rs->index, sizeof(struct rule_sync_entry),
+		     IP_RULE_KEY_LEN);
+
+	rtnl_msgbuf_for_each(&rs->current, n) {
+		struct rule_sync_entry *e;
+		struct ip_rule rule;
+		bool found;
+
+		ip_rule_parse(n, &rule);
+		e = hashtab_insert(&rs->index, &rule, &found);
+		if (!e)
+			return -1;
+		if (!found)
+			e->rule = rule;
+		e->count++;
+	}
+	return 0;
+}
+
+static int rule_sync_dump(struct nlmsghdr *n, void *arg)
+{
+	struct rule_sync *rs = arg;
+
+	if (!rule_sync_selected(rs, n))
+		return 0;
+	return rtnl_msgbuf_add(&rs->current, n);
+}
+
+static int rule_sync_saved(struct rtnl_ctrl_data *ctrl,
+			   struct nlmsghdr *n, void *arg)
+{
+	struct rule_sync *rs = arg;
+
+	if (!rule_sync_selected(rs, n))
+		return 0;
+	return rtnl_msgbuf_add(&rs->desired, n);
+}
+
+static int rule_sync_line(int argc, char **argv, void *arg)
+{
+	struct rule_sync *rs = arg;
+	char *args[argc + 2];
+	bool has_pref = false, has_proto = false;
+	struct nlmsghdr *n;
+	size_t off = rs->desired.len;
+	int i, ret;
+
+	for (i = 0; i < argc; i++) {
+		args[i] = argv[i];
+		if (strcmp(argv[i], "pref") == 0 ||
+		    strcmp(argv[i], "preference") == 0 ||
+		    strcmp(argv[i], "priority") == 0 ||
+		    strcmp(argv[i], "order") == 0)
+			has_pref = true;
+		else if (strcmp(argv[i], "proto") == 0 ||
+			 strcmp(argv[i], "protocol") == 0)
+			has_proto = true;
+	}
+	if (!has_pref) {
+		fprintf(stderr, "Rules to sync need a preference\n");
+		return -1;
+	}
+
+	/* rules without a protocol take the one being synced */
+	if (!has_proto && rs->protocol >= 0) {
+		static char proto[16];
+
+		snprintf(proto, sizeof(proto), "%d", rs->protocol);
+		args[argc++] = "protocol";
+		args[argc++] = proto;
+	}
+
+	rule_queue = &rs->desired;
+	ret = iprule_modify(RTM_NEWRULE, argc, args);
+	rule_queue = NULL;
+	if (ret)
+		return ret;
+
+	n = (struct nlmsghdr *)(rs->desired.buf + off);
+	if (!rule_sync_selected(rs, n)) {
+		fprintf(stderr, "Rule is outside of the synced family or protocol\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int rule_sync_load(struct rule_sync *rs, const char *name)
+{
+	FILE *fp = rule_open(name);
+	int c, ret;
+
+	if (!fp)
+		return -1;
+
+	/* either an "ip rule save" stream or one RULE per line */
+	c = getc(fp);
+	if (c == (IP_RULE_DUMP_MAGIC & 0xff)) {
+		ret = rule_load_saved(fp, c, name, rule_sync_saved, rs);
+	} else {
+		if (c != EOF)
+			ungetc(c, fp);
+		ret = do_batch_fp(fp, name, false, rule_sync_line, rs);
+	}
+
+	rule_close(fp);
+	return ret ? -1 : 0;
+}
+
+static void rule_sync_print(const char *action, const char *mark,
+			    struct nlmsghdr *n)
+{
+	open_json_object(NULL);
+	print_string(PRINT_JSON, "action", NULL, action);
+	print_string(PRINT_FP, NULL, "%s ", mark);
+	open_json_array(PRINT_JSON, "rules");
+	print_rule(n, stdout);
+	close_json_array(PRINT_JSON, NULL);
+	close_json_object();
+}
+
+static int rule_sync_error(struct rtnl_batch *b, __u32 cookie, int error,
+			   struct nlmsghdr *n, void *arg)
+{
+	struct rule_sync *rs = arg;
+
+	/* deleted rules may already be gone */
+	if (error == -ENOENT)
+		return 0;
+
+	rs->failed++;
+	rtnl_print_ack_error(n);
+	return 0;
+}
+
+static int iprule_sync(int argc, char **argv)
+{
+	struct rule_sync rs = {
+		.protocol = -1,
+	};
+	__u64 added = 0, deleted = 0, unchanged = 0;
+	struct bulk_progress progress;
+	struct rtnl_batch batch;
+	struct rule_sync_entry *e;
+	const char *name = "-";
+	struct nlmsghdr *n;
+	unsigned int pos;
+	__u32 idx = 0;
+	int ret = -1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "proto") == 0 ||
+		    strcmp(*argv, "protocol") == 0) {
+			__u32 prot;
+
+			NEXT_ARG();
+			if (rtnl_rtprot_a2n(&prot, *argv))
+				invarg("\"protocol\" value is invalid\n", *argv);
+			rs.protocol = prot;
+		} else if (strcmp(*argv, "diff") == 0) {
+			rs.diff = true;
+		} else if (strcmp(*argv, "help") == 0) {
+			usage();
+		} else {
+			name = *argv;
+		}
+		argc--; argv++;
+	}
+
+	if (rule_sync_load(&rs, name))
+		goto out;
+
+	if (rtnl_ruledump_req(&rth, preferred_family) < 0) {
+		perror("Cannot send dump request");
+		goto out;
+	}
+	if (rtnl_dump_filter(&rth, rule_sync_dump, &rs) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out;
+	}
+	if (rule_sync_index(&rs))
+		goto out;
+
+	memset(&filter, 0, sizeof(filter));
+	new_json_obj(json);
+	if (!rs.diff) {
+		if (rtnl_batch_init(&batch, &rth, rule_sync_error, &rs) < 0)
+			goto out_json;
+		if (show_stats)
+			bulk_progress_init(&progress, "Syncing rules");
+	}
+
+	ret = 0;
+	rtnl_msgbuf_for_each(&rs.desired, n) {
+		struct ip_rule rule;
+
+		ip_rule_parse(n, &rule);
+		e = hashtab_lookup(&rs.index, &rule);
+		if (e && e->seen < e->count) {
+			e->seen++;
+			unchanged++;
+			continue;
+		}
+
+		added++;
+		if (rs.diff) {
+			rule_sync_print("add", "+", n);
+			continue;
+		}
+		/* not exclusive: the kernel ignores some attributes */
+		n->nlmsg_type = RTM_NEWRULE;
+		n->nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE;
+		if (rtnl_batch_add(&batch, n, idx++) < 0) {
+			ret = -2;
+			break;
+		}
+	}
+
+	hashtab_for_each(&rs.index, pos, e) {
+		/* each delete removes one copy of the rule */
+		for (; e->seen < e->count && !ret; e->seen++) {
+			deleted++;
+			if (rs.diff) {
+				rule_sync_print("delete", "-", e->rule.n);
+				continue;
+			}
+			e->rule.n->nlmsg_type = RTM_DELRULE;
+			e->rule.n->nlmsg_flags = NLM_F_REQUEST;
+			if (rtnl_batch_add(&batch, e->rule.n, idx++) < 0)
+				ret = -2;
+			if (show_stats)
+				bulk_progress_update(&progress, batch.acked,
+						     added + deleted);
+		}
+	}
+
+	if (!rs.diff) {
+		if (rtnl_batch_flush(&batch) < 0)
+			ret = -2;
+		rtnl_batch_free(&batch);
+		if (show_stats)
+			bulk_progress_done(&progress,
+					   batch.acked - batch.errors,
+					   rs.failed);
+		if (rs.failed)
+			ret = -2;
+	}
+
+out_json:
+	delete_json_obj();
+	fflush(stdout);
+	if (show_stats || rs.diff)
+		fprintf(stderr, "%llu added, %llu deleted, %llu unchanged\n",
+			added, deleted, unchanged);
+out:
+	hashtab_free(&rs.index);
+	rtnl_msgbuf_free(&rs.current);
+	rtnl_msgbuf_free(&rs.desired);
+	return ret;
+}
+
+/*
+ * ip rule match: show the rules a packet visits, evaluated against an
+ * indexed copy of the rule list.  Table lookups are not done, so every
+ * matching rule up to the first terminal action is shown.
+ */
+struct rule_match {
+	struct rtnl_msgbuf	msgs;
+	struct ip_rule_set	set;
+	struct ip_rule_tuple	def;
+};
+
+static int rule_match_dump(struct nlmsghdr *n, void *arg)
+{
+	return rtnl_msgbuf_add(arg, n);
+}
+
+static int rule_match_saved(struct rtnl_ctrl_data *ctrl,
+			    struct nlmsghdr *n, void *arg)
+{
+	return rtnl_msgbuf_add(arg, n);
+}
+
+static int rule_match_load(struct rule_match *rm, const char *name)
+{
+	struct nlmsghdr *n;
+
+	if (name) {
+		FILE *fp = rule_open(name);
+		int ret;
+
+		if (!fp)
+			return -1;
+		ret = rule_load_saved(fp, getc(fp), name,
+				      rule_match_saved, &rm->msgs);
+		rule_close(fp);
+		if (ret)
+			return -1;
+	} else {
+		if (rtnl_ruledump_req(&rth, preferred_family) < 0) {
+			perror("Cannot send dump request");
+			return -1;
+		}
+		if (rtnl_dump_filter(&rth, rule_match_dump, &rm->msgs) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			return -1;
+		}
+	}
+
+	/* the list is fully loaded, messages no longer move */
+	rtnl_msgbuf_for_each(&rm->msgs, n) {
+		if (ip_rule_set_add(&rm->set, n)) {
+			fprintf(stderr, "Not enough memory to compile rules\n");
+			return -1;
+		}
+	}
+	return ip_rule_set_compile(&rm->set);
+}
+
+static void rule_match_one(struct rule_match *rm,
+			   const struct ip_rule_tuple *t)
+{
+	const struct ip_rule_set *set = &rm->set;
+	int i = ip_rule_set_next(set, t, 0);
+
+	while (i >= 0) {
+		const struct ip_rule *rule = &set->rules[i];
+		unsigned int next = i + 1;
+
+		print_rule(rule->n, stdout);
+		if (rule->action == FR_ACT_GOTO) {
+			int target = ip_rule_set_goto(set, i);
+
+			/* unresolved gotos are skipped like in the kernel */
+			if (target >= 0)
+				next = target;
+		} else if (rule->action != FR_ACT_TO_TBL &&
+			   rule->action != FR_ACT_NOP) {
+			break;
+		}
+		i = ip_rule_set_next(set, t, next);
+	}
+}
+
+static int rule_match_parse(int argc, char **argv,
+			    const struct ip_rule_tuple *def,
+			    struct ip_rule_tuple *t)
+{
+	*t = *def;
+	while (argc > 0) {
+		int n = ip_rule_tuple_parse(argc, argv, t);
+
+		if (!n) {
+			fprintf(stderr, "Unknown packet field \"%s\"\n", *argv);
+			return -1;
+		}
+		argc -= n; argv += n;
+	}
+	if (t->family == AF_UNSPEC)
+		t->family = AF_INET;
+	return 0;
+}
+
+static int rule_match_line(int argc, char **argv, void *arg)
+{
+	struct rule_match *rm = arg;
+	struct ip_rule_tuple t;
+	char packet[256] = "";
+	size_t len;
+	int i;
+
+	if (rule_match_parse(argc, argv, &rm->def, &t))
+		return -1;
+
+	for (i = 0, len = 0; i < argc && len < sizeof(packet); i++)
+		len += snprintf(packet + len, sizeof(packet) - len, "%s%s",
+				i ? " " : "", argv[i]);
+
+	open_json_object(NULL);
+	print_string(PRINT_ANY, "packet", "%s:\n", packet);
+	open_json_array(PRINT_JSON, "rules");
+	rule_match_one(rm, &t);
+	close_json_array(PRINT_JSON, NULL);
+	close_json_object();
+	return 0;
+}
+
+static int iprule_match(int argc, char **argv)
+{
+	struct rule_match rm = {
+		.def.family = preferred_family,
+		.def.iif = "lo",
+	};
+	const char *rules = NULL, *batch = NULL;
+	struct ip_rule_tuple t;
+	int ret = -1;
+
+	if (argc > 1 && strcmp(*argv, "rules") == 0) {
+		rules = argv[1];
+		argc -= 2; argv += 2;
+	}
+	if (argc > 0 && strcmp(*argv, "batch") == 0) {
+		batch = argc > 1 ? argv[1] : "-";
+	} else if (argc > 0 && strcmp(*argv, "help") == 0) {
+		usage();
+	} else if (rule_match_parse(argc, argv, &rm.def, &t)) {
+		return -1;
+	}
+
+	if (rule_match_load(&rm, rules))
+		goto out;
+
+	memset(&filter, 0, sizeof(filter));
+	new_json_obj(json);
+	if (batch) {
+		FILE *fp = rule_open(batch);
+
+		if (fp) {
+			ret = do_batch_fp_rtnl(fp, batch, rule_match_line,
+					       &rm) ? -1 : 0;
+			rule_close(fp);
+		}
+	} else {
+		rule_match_one(&rm, &t);
+		ret = 0;
+	}
+	delete_json_obj();
+
+out:
+	ip_rule_set_free(&rm.set);
+	rtnl_msgbuf_free(&rm.msgs);
+	return ret;
+}
+
 int do_iprule(int argc, char **argv)
 {
 	if (argc < 1) {
@@ -1251,6 +1772,10 @@ int do_iprule(int argc, char **argv)
 		return iprule_modify(RTM_DELRULE, argc-1, argv+1);
 	} else if (matches(argv[0], "flush") == 0) {
 		return iprule_list_flush_or_save(argc-1, argv+1, IPRULE_FLUSH);
+	} else if (strcmp(argv[0], "sync") == 0) {
+		return iprule_sync(argc-1, argv+1);
+	} else if (strcmp(argv[0], "match") == 0) {
+		return iprule_match(argc-1, argv+1);
 	} else if (matches(argv[0], "help") == 0)
 		usage();
 
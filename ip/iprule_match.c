@@ -0,0 +1,478 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * iprule_match.c	Policy rule evaluation without the kernel.
+ *
+ * Rules are kept in priority order.  Those selecting one exact fwmark,
+ * typically per tenant, are indexed by that mark so that a packet is
+ * only checked against the rules of its own mark and the rules without
+ * such a selector.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "rt_names.h"
+#include "utils.h"
+#include "iprule_match.h"
+
+#define PORT_MAX_MASK 0xFFFF
+#define DSCP_MAX_MASK 0x3F
+
+static void rule_mask(__u8 *dst, const struct rtattr *rta, int bits)
+{
+	const __u8 *src = RTA_DATA(rta);
+	int i, len = min((int)RTA_PAYLOAD(rta), 16);
+
+	for (i = 0; i < len; i++, bits -= 8) {
+		if (bits >= 8)
+			dst[i] = src[i];
+		else if (bits > 0)
+			dst[i] = src[i] & (0xff << (8 - bits));
+	}
+}
+
+int ip_rule_parse(struct nlmsghdr *n, struct ip_rule *rule)
+{
+	struct fib_rule_hdr *frh = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*frh));
+	struct rtattr *tb[FRA_MAX+1];
+
+	if (len < 0)
+		return -1;
+
+	parse_rtattr(tb, FRA_MAX, RTM_RTA(frh), len);
+
+	memset(rule, 0, sizeof(*rule));
+	rule->n = n;
+	rule->family = frh->family;
+	rule->action = frh->action;
+	rule->flags = frh->flags & FIB_RULE_INVERT;
+	rule->tos = frh->tos;
+	rule->src_len = frh->src_len;
+	rule->dst_len = frh->dst_len;
+	rule->table = tb[FRA_TABLE] ? rta_getattr_u32(tb[FRA_TABLE]) :
+				      frh->table;
+	rule->suppress_prefixlen = -1;
+	rule->suppress_ifgroup = -1;
+	rule->uid.end = ~0U;
+
+	if (tb[FRA_PRIORITY])
+		rule->prio = rta_getattr_u32(tb[FRA_PRIORITY]);
+	if (tb[FRA_PROTOCOL])
+		rule->protocol = rta_getattr_u8(tb[FRA_PROTOCOL]);
+	if (tb[FRA_SRC])
+		rule_mask(rule->src, tb[FRA_SRC], rule->src_len);
+	if (tb[FRA_DST])
+		rule_mask(rule->dst, tb[FRA_DST], rule->dst_len);
+	if (tb[FRA_GOTO])
+		rule->target = rta_getattr_u32(tb[FRA_GOTO]);
+	if (tb[FRA_FLOW])
+		rule->realms = rta_getattr_u32(tb[FRA_FLOW]);
+
+	/* the kernel reports the implicit full mask of a fwmark */
+	if (tb[FRA_FWMARK]) {
+		rule->fwmark = rta_getattr_u32(tb[FRA_FWMARK]);
+		rule->fwmask = 0xffffffff;
+	}
+	if (tb[FRA_FWMASK])
+		rule->fwmask = rta_getattr_u32(tb[FRA_FWMASK]);
+
+	if (tb[FRA_SUPPRESS_PREFIXLEN])
+		rule->suppress_prefixlen =
+			(int)rta_getattr_u32(tb[FRA_SUPPRESS_PREFIXLEN]);
+	if (tb[FRA_SUPPRESS_IFGROUP])
+		rule->suppress_ifgroup =
+			(int)rta_getattr_u32(tb[FRA_SUPPRESS_IFGROUP]);
+	if (tb[FRA_IIFNAME])
+		strlcpy(rule->iif, rta_getattr_str(tb[FRA_IIFNAME]),
+			sizeof(rule->iif));
+	if (tb[FRA_OIFNAME])
+		strlcpy(rule->oif, rta_getattr_str(tb[FRA_OIFNAME]),
+			sizeof(rule->oif));
+	if (tb[FRA_L3MDEV])
+		rule->l3mdev = rta_getattr_u8(tb[FRA_L3MDEV]);
+	if (tb[FRA_UID_RANGE]) {
+		rule->has_uid = true;
+		memcpy(&rule->uid, RTA_DATA(tb[FRA_UID_RANGE]),
+		       sizeof(rule->uid));
+	}
+	if (tb[FRA_IP_PROTO])
+		rule->ipproto = rta_getattr_u8(tb[FRA_IP_PROTO]);
+	if (tb[FRA_SPORT_RANGE]) {
+		memcpy(&rule->sport, RTA_DATA(tb[FRA_SPORT_RANGE]),
+		       sizeof(rule->sport));
+		rule->sport_mask = tb[FRA_SPORT_MASK] ?
+			rta_getattr_u16(tb[FRA_SPORT_MASK]) : PORT_MAX_MASK;
+	}
+	if (tb[FRA_DPORT_RANGE]) {
+		memcpy(&rule->dport, RTA_DATA(tb[FRA_DPORT_RANGE]),
+		       sizeof(rule->dport));
+		rule->dport_mask = tb[FRA_DPORT_MASK] ?
+			rta_getattr_u16(tb[FRA_DPORT_MASK]) : PORT_MAX_MASK;
+	}
+	if (tb[FRA_TUN_ID]) {
+		rule->has_tun_id = true;
+		rule->tun_id = ntohll(rta_getattr_u64(tb[FRA_TUN_ID]));
+	}
+	if (tb[FRA_DSCP]) {
+		rule->dscp = rta_getattr_u8(tb[FRA_DSCP]);
+		rule->dscp_mask = tb[FRA_DSCP_MASK] ?
+			rta_getattr_u8(tb[FRA_DSCP_MASK]) : DSCP_MAX_MASK;
+	}
+	if (tb[FRA_FLOWLABEL] && tb[FRA_FLOWLABEL_MASK]) {
+		rule->flowlabel = ntohl(rta_getattr_be32(tb[FRA_FLOWLABEL]));
+		rule->flowlabel_mask =
+			ntohl(rta_getattr_be32(tb[FRA_FLOWLABEL_MASK]));
+	}
+
+	return 0;
+}
+
+static bool port_match(const struct fib_rule_port_range *r, __u16 mask,
+		       __u16 port)
+{
+	if (mask != PORT_MAX_MASK)
+		return (port & mask) == r->start;
+	return port >= r->start && port <= r->end;
+}
+
+static bool addr_match(const __u8 *prefix, int bits, const __u8 *addr)
+{
+	int i;
+
+	for (i = 0; bits > 0; i++, bits -= 8) {
+		__u8 mask = bits >= 8 ? 0xff : 0xff << (8 - bits);
+
+		if ((addr[i] & mask) != prefix[i])
+			return false;
+	}
+	return true;
+}
+
+/* mirrors fib_rule_match() and the per family match callbacks */
+static bool ip_rule_match(const struct ip_rule *rule,
+			  const struct ip_rule_tuple *t)
+{
+	bool match = false;
+
+	if (rule->family != t->family)
+		return false;
+
+	if (rule->iif[0] && (!t->iif || strcmp(rule->iif, t->iif)))
+		goto out;
+	if (rule->oif[0] && (!t->oif || strcmp(rule->oif, t->oif)))
+		goto out;
+	if ((rule->fwmark ^ t->mark) & rule->fwmask)
+		goto out;
+	if (rule->has_tun_id && rule->tun_id != t->tun_id)
+		goto out;
+	/* no VRF is known offline */
+	if (rule->l3mdev)
+		goto out;
+	if (t->uid < rule->uid.start || t->uid > rule->uid.end)
+		goto out;
+
+	if (!addr_match(rule->src, rule->src_len, t->src) ||
+	    !addr_match(rule->dst, rule->dst_len, t->dst))
+		goto out;
+	if (rule->tos && rule->tos != t->tos)
+		goto out;
+	if (rule->dscp_mask &&
+	    ((t->tos >> 2) ^ rule->dscp) & rule->dscp_mask)
+		goto out;
+	if (rule->flowlabel_mask &&
+	    (t->flowlabel ^ rule->flowlabel) & rule->flowlabel_mask)
+		goto out;
+	if (rule->ipproto && rule->ipproto != t->ipproto)
+		goto out;
+	if (rule->sport_mask && !port_match(&rule->sport, rule->sport_mask,
+					     t->sport))
+		goto out;
+	if (rule->dport_mask && !port_match(&rule->dport, rule->dport_mask,
+					     t->dport))
+		goto out;
+
+	match = true;
+out:
+	return (rule->flags & FIB_RULE_INVERT) ? !match : match;
+}
+
+int ip_rule_set_add_rule(struct ip_rule_set *set, const struct ip_rule *rule)
+{
+	struct ip_rule *rules;
+
+	rules = realloc(set->rules, (set->count + 1) * sizeof(*rules));
+	if (!rules)
+		return -1;
+	rules[set->count++] = *rule;
+	set->rules = rules;
+	return 0;
+}
+
+int ip_rule_set_add(struct ip_rule_set *set, struct nlmsghdr *n)
+{
+	struct ip_rule rule;
+
+	if (n->nlmsg_type != RTM_NEWRULE || ip_rule_parse(n, &rule))
+		return 0;
+	return ip_rule_set_add_rule(set, &rule);
+}
+
+struct rule_order {
+	__u32		prio;
+	unsigned int	idx;
+};
+
+static int rule_order_cmp(const void *a, const void *b)
+{
+	const struct rule_order *ra = a, *rb = b;
+
+	if (ra->prio != rb->prio)
+		return ra->prio < rb->prio ? -1 : 1;
+	return ra->idx < rb->idx ? -1 : ra->idx > rb->idx;
+}
+
+static bool ip_rule_indexed(const struct ip_rule *rule)
+{
+	return rule->fwmask == 0xffffffff &&
+	       !(rule->flags & FIB_RULE_INVERT);
+}
+
+static unsigned int mark_bucket(const struct ip_rule_set *set, __u32 mark)
+{
+	mark ^= mark >> 16;
+	mark *= 0x45d9f3b;
+	mark ^= mark >> 16;
+	return mark & (set->mark_size - 1);
+}
+
+/* sort the rules like the kernel does and build the fwmark index */
+int ip_rule_set_compile(struct ip_rule_set *set)
+{
+	struct rule_order *order;
+	struct ip_rule *rules;
+	unsigned int i, *fill;
+
+	order = calloc(set->count + 1, sizeof(*order));
+	rules = calloc(set->count + 1, sizeof(*rules));
+	if (!order || !rules)
+		goto err;
+
+	for (i = 0; i < set->count; i++) {
+		order[i].prio = set->rules[i].prio;
+		order[i].idx = i;
+	}
+	qsort(order, set->count, sizeof(*order), rule_order_cmp);
+	for (i = 0; i < set->count; i++)
+		rules[i] = set->rules[order[i].idx];
+	free(set->rules);
+	set->rules = rules;
+	free(order);
+	order = NULL;
+
+	set->mark_size = 16;
+	while (set->mark_size < set->count)
+		set->mark_size *= 2;
+	set->mark_start = calloc(set->mark_size + 1, sizeof(unsigned int));
+	set->mark_rules = calloc(set->count + 1, sizeof(unsigned int));
+	set->wild = calloc(set->count + 1, sizeof(unsigned int));
+	fill = calloc(set->mark_size, sizeof(unsigned int));
+	if (!set->mark_start || !set->mark_rules || !set->wild || !fill) {
+		free(fill);
+		goto err;
+	}
+
+	for (i = 0; i < set->count; i++) {
+		if (ip_rule_indexed(&set->rules[i]))
+			set->mark_start[mark_bucket(set,
+					set->rules[i].fwmark) + 1]++;
+		else
+			set->wild[set->nwild++] = i;
+	}
+	for (i = 0; i < set->mark_size; i++)
+		set->mark_start[i + 1] += set->mark_start[i];
+	for (i = 0; i < set->count; i++) {
+		unsigned int b;
+
+		if (!ip_rule_indexed(&set->rules[i]))
+			continue;
+		b = mark_bucket(set, set->rules[i].fwmark);
+		set->mark_rules[set->mark_start[b] + fill[b]++] = i;
+	}
+	free(fill);
+	return 0;
+
+err:
+	free(order);
+	free(rules);
+	fprintf(stderr, "Not enough memory to compile rules\n");
+	return -1;
+}
+
+static unsigned int first_at_least(const unsigned int *v, unsigned int count,
+				   unsigned int from)
+{
+	unsigned int lo = 0, hi = count;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (v[mid] < from)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Index of the first rule at or after position 'from' matching the
+ * packet, or -1.  The candidates of the packet's fwmark bucket and the
+ * unindexed rules are merged in priority order.
+ */
+int ip_rule_set_next(const struct ip_rule_set *set,
+		     const struct ip_rule_tuple *t, unsigned int from)
+{
+	const unsigned int *m = NULL;
+	unsigned int mi = 0, mn = 0, wi;
+
+	if (set->mark_size) {
+		unsigned int b = mark_bucket(set, t->mark);
+
+		m = set->mark_rules + set->mark_start[b];
+		mn = set->mark_start[b + 1] - set->mark_start[b];
+		mi = first_at_least(m, mn, from);
+	}
+	wi = first_at_least(set->wild, set->nwild, from);
+
+	while (mi < mn || wi < set->nwild) {
+		unsigned int idx;
+
+		if (wi >= set->nwild || (mi < mn && m[mi] < set->wild[wi]))
+			idx = m[mi++];
+		else
+			idx = set->wild[wi++];
+
+		if (ip_rule_match(&set->rules[idx], t))
+			return idx;
+	}
+
+	return -1;
+}
+
+/* position of the first rule with at least the given priority */
+static unsigned int ip_rule_set_find_prio(const struct ip_rule_set *set,
+					  __u32 prio)
+{
+	unsigned int lo = 0, hi = set->count;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (set->rules[mid].prio < prio)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Index of the rule the goto rule at i jumps to: the first one of its
+ * family with the target priority.  -1 if there is none; the kernel
+ * then marks the goto unresolved and moves on to the next rule.
+ */
+int ip_rule_set_goto(const struct ip_rule_set *set, unsigned int i)
+{
+	const struct ip_rule *rule = &set->rules[i];
+	unsigned int t = ip_rule_set_find_prio(set, rule->target);
+
+	for (; t < set->count && set->rules[t].prio == rule->target; t++) {
+		if (t > i && set->rules[t].family == rule->family)
+			return t;
+	}
+	return -1;
+}
+
+void ip_rule_set_free(struct ip_rule_set *set)
+{
+	free(set->rules);
+	free(set->mark_start);
+	free(set->mark_rules);
+	free(set->wild);
+	memset(set, 0, sizeof(*set));
+}
+
+/*
+ * Parse one packet field of a tuple at argv, returning the number of
+ * arguments used or 0 if argv does not start with a packet field.
+ */
+int ip_rule_tuple_parse(int argc, char **argv, struct ip_rule_tuple *t)
+{
+	int argc0 = argc;
+	inet_prefix addr;
+
+	if (strcmp(*argv, "from") == 0 || strcmp(*argv, "to") == 0) {
+		bool from = **argv == 'f';
+
+		NEXT_ARG();
+		get_addr(&addr, *argv, t->family);
+		if (t->family == AF_UNSPEC)
+			t->family = addr.family;
+		memcpy(from ? t->src : t->dst, addr.data, addr.bytelen);
+	} else if (strcmp(*argv, "iif") == 0) {
+		NEXT_ARG();
+		t->iif = *argv;
+	} else if (strcmp(*argv, "oif") == 0) {
+		NEXT_ARG();
+		t->oif = *argv;
+	} else if (strcmp(*argv, "fwmark") == 0 ||
+		   strcmp(*argv, "mark") == 0) {
+		NEXT_ARG();
+		if (get_u32(&t->mark, *argv, 0))
+			invarg("invalid fwmark\n", *argv);
+	} else if (strcmp(*argv, "uid") == 0) {
+		NEXT_ARG();
+		if (get_u32(&t->uid, *argv, 0))
+			invarg("invalid UID\n", *argv);
+	} else if (strcmp(*argv, "ipproto") == 0) {
+		int ipproto;
+
+		NEXT_ARG();
+		ipproto = inet_proto_a2n(*argv);
+		if (ipproto < 0)
+			invarg("Invalid \"ipproto\" value\n", *argv);
+		t->ipproto = ipproto;
+	} else if (strcmp(*argv, "sport") == 0) {
+		NEXT_ARG();
+		if (get_u16(&t->sport, *argv, 0))
+			invarg("invalid sport\n", *argv);
+	} else if (strcmp(*argv, "dport") == 0) {
+		NEXT_ARG();
+		if (get_u16(&t->dport, *argv, 0))
+			invarg("invalid dport\n", *argv);
+	} else if (strcmp(*argv, "tos") == 0 ||
+		   strcmp(*argv, "dsfield") == 0) {
+		__u32 tos;
+
+		NEXT_ARG();
+		if (rtnl_dsfield_a2n(&tos, *argv))
+			invarg("TOS value is invalid\n", *argv);
+		t->tos = tos;
+	} else if (strcmp(*argv, "tun_id") == 0) {
+		NEXT_ARG();
+		if (get_be64(&t->tun_id, *argv, 0))
+			invarg("invalid tun_id\n", *argv);
+		t->tun_id = ntohll(t->tun_id);
+	} else if (strcmp(*argv, "flowlabel") == 0) {
+		NEXT_ARG();
+		if (get_u32(&t->flowlabel, *argv, 0))
+			invarg("invalid flowlabel\n", *argv);
+	} else {
+		return 0;
+	}
+
+	return argc0 - argc + 1;
+}
@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __IPRULE_MATCH_H__
+#define __IPRULE_MATCH_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/if.h>
+#include <linux/fib_rules.h>
+
+#include "libnetlink.h"
+
+/*
+ * Policy rules compiled from RTM_NEWRULE messages, for evaluating
+ * packets without the kernel.  The selector fields come first and are
+ * compared as a whole, up to IP_RULE_KEY_LEN; the structure is zeroed
+ * before it is filled, so padding compares equal too.
+ */
+struct ip_rule {
+	int				family;
+	__u32				prio;
+	__u8				action;
+	__u8				flags;
+	__u8				tos;
+	__u8				protocol;
+	__u8				src_len;
+	__u8				dst_len;
+	__u8				src[16];
+	__u8				dst[16];
+	__u32				table;
+	__u32				target;
+	__u32				realms;
+	__u32				fwmark;
+	__u32				fwmask;
+	int				suppress_prefixlen;
+	int				suppress_ifgroup;
+	char				iif[IFNAMSIZ];
+	char				oif[IFNAMSIZ];
+	__u8				l3mdev;
+	__u8				ipproto;
+	bool				has_uid;
+	bool				has_tun_id;
+	struct fib_rule_uid_range	uid;
+	struct fib_rule_port_range	sport;
+	struct fib_rule_port_range	dport;
+	__u16				sport_mask;
+	__u16				dport_mask;
+	__u64				tun_id;
+	__u8				dscp;
+	__u8				dscp_mask;
+	__u32				flowlabel;
+	__u32				flowlabel_mask;
+
+	/* not part of the selector */
+	struct nlmsghdr			*n;
+};
+
+#define IP_RULE_KEY_LEN		offsetof(struct ip_rule, n)
+
+/* the packet a rule set is evaluated for */
+struct ip_rule_tuple {
+	int		family;
+	__u8		src[16];
+	__u8		dst[16];
+	const char	*iif;
+	const char	*oif;
+	__u32		mark;
+	__u32		uid;
+	__u8		ipproto;
+	__u16		sport;
+	__u16		dport;
+	__u8		tos;
+	__u64		tun_id;
+	__u32		flowlabel;
+};
+
+struct ip_rule_set {
+	struct ip_rule	*rules;		/* sorted by priority */
+	unsigned int	count;
+
+	/* rules matching one exact fwmark, hashed by it */
+	unsigned int	mark_size;
+	unsigned int	*mark_start;
+	unsigned int	*mark_rules;
+	/* all other rules */
+	unsigned int	*wild;
+	unsigned int	nwild;
+};
+
+int ip_rule_parse(struct nlmsghdr *n, struct ip_rule *rule);
+
+int ip_rule_set_add(struct ip_rule_set *set, struct nlmsghdr *n);
+int ip_rule_set_add_rule(struct ip_rule_set *set, const struct ip_rule *rule);
+int ip_rule_set_compile(struct ip_rule_set *set);
+int ip_rule_set_next(const struct ip_rule_set *set,
+		     const struct ip_rule_tuple *t, unsigned int from);
+int ip_rule_set_goto(const struct ip_rule_set *set, unsigned int i);
+void ip_rule_set_free(struct ip_rule_set *set);
+
+int ip_rule_tuple_parse(int argc, char **argv, struct ip_rule_tuple *t);
+
+#endif /* __IPRULE_MATCH_H__ */
@@ -9,12 +9,15 @@
  */
 
 #include <alloca.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <time.h>
+#include <unistd.h>
 #include <netdb.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
@@ -35,7 +38,7 @@ static void usage(void)
 	fprintf(stderr,
 		"Usage: ip xfrm XFRM-OBJECT { COMMAND | help }\n"
 		"where  XFRM-OBJECT := state | policy | monitor\n");
-	exit(-1);
+	parse_exit(-1);
 }
 
 /* This is based on utils.c(inet_addr_match) */
@@ -1179,11 +1182,11 @@ int xfrm_id_parse(xfrm_address_t *saddr, struct xfrm_id *id, __u16 *family,
 		if (xfrm_xfrmproto_is_ro(id->proto)) {
 			fprintf(stderr, "\"spi\" is invalid with XFRM-PROTO value \"%s\"\n",
 				strxf_xfrmproto(id->proto));
-			exit(1);
+			parse_exit(1);
 		} else if (id->proto == IPPROTO_COMP && ntohl(id->spi) >= 0x10000) {
 			fprintf(stderr, "SPI value is too large with XFRM-PROTO value \"%s\"\n",
 				strxf_xfrmproto(id->proto));
-			exit(1);
+			parse_exit(1);
 		}
 	}
 
@@ -1354,7 +1357,7 @@ static int xfrm_selector_upspec_parse(struct xfrm_selector *sel,
 			else {
 				if (get_unsigned(&uval, *argv, 0) < 0) {
 					fprintf(stderr, "value after \"key\" is invalid\n");
-					exit(-1);
+					parse_exit(-1);
 				}
 			}
 
@@ -1386,7 +1389,7 @@ static int xfrm_selector_upspec_parse(struct xfrm_selector *sel,
 			break;
 		default:
 			fprintf(stderr, "\"sport\" and \"dport\" are invalid with PROTO value \"%s\"\n", strxf_proto(sel->proto));
-			exit(1);
+			parse_exit(1);
 		}
 	}
 	if (typep || codep) {
@@ -1397,7 +1400,7 @@ static int xfrm_selector_upspec_parse(struct xfrm_selector *sel,
 			break;
 		default:
 			fprintf(stderr, "\"type\" and \"code\" are invalid with PROTO value \"%s\"\n", strxf_proto(sel->proto));
-			exit(1);
+			parse_exit(1);
 		}
 	}
 	if (grekey) {
@@ -1406,7 +1409,7 @@ static int xfrm_selector_upspec_parse(struct xfrm_selector *sel,
 			break;
 		default:
 			fprintf(stderr, "\"key\" is invalid with PROTO value \"%s\"\n", strxf_proto(sel->proto));
-			exit(1);
+			parse_exit(1);
 		}
 	}
 
@@ -1572,3 +1575,237 @@ int do_xfrm(int argc, char **argv)
 	}
 	usage();
 }
+
+static int xfrm_deleteall_error(struct rtnl_batch *b, __u32 cookie, int error,
+				struct nlmsghdr *n, void *arg)
+{
+	__u64 *failed = arg;
+
+	/* already gone, e.g. expired since the dump */
+	if (error == -ESRCH || error == -ENOENT)
+		return 0;
+
+	(*failed)++;
+	rtnl_print_ack_error(n);
+	return 0;
+}
+
+/*
+ * Send the delete requests collected from a dump in pipelined batches.
+ * Returns -1 if sending failed; *failed is set to the number of
+ * requests the kernel refused.
+ */
+int xfrm_deleteall_send(struct rtnl_handle *rth, struct rtnl_msgbuf *mb,
+			__u64 *failed)
+{
+	struct rtnl_batch batch;
+	struct nlmsghdr *n;
+	__u32 idx = 0;
+	int ret = 0;
+
+	*failed = 0;
+	if (show_stats > 1)
+		fprintf(stderr, "Delete-all nlmsg count = %llu\n", mb->count);
+	if (!mb->count)
+		return 0;
+
+	if (rtnl_batch_init(&batch, rth, xfrm_deleteall_error, failed) < 0)
+		return -1;
+
+	rtnl_msgbuf_for_each(mb, n) {
+		if (rtnl_batch_add(&batch, n, idx++) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+	if (rtnl_batch_flush(&batch) < 0)
+		ret = -1;
+	rtnl_batch_free(&batch);
+
+	if (*failed)
+		fprintf(stderr, "Delete-all: %llu of %llu requests failed\n",
+			*failed, mb->count);
+	else if (show_stats > 1)
+		fprintf(stderr, "Delete-all completed\n");
+
+	return ret;
+}
+
+static int xfrm_export_msg(struct nlmsghdr *n, void *arg)
+{
+	FILE *fp = arg;
+
+	if (n->nlmsg_type == XFRM_MSG_NEWSA) {
+		struct xfrm_usersa_info *xsinfo = NLMSG_DATA(n);
+
+		if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*xsinfo)))
+			return -1;
+		/* created by the kernel along with IPcomp states */
+		if (xsinfo->id.proto == IPPROTO_IPIP ||
+		    xsinfo->id.proto == IPPROTO_IPV6)
+			return 0;
+	} else if (n->nlmsg_type == XFRM_MSG_NEWPOLICY) {
+		struct xfrm_userpolicy_info *xpinfo = NLMSG_DATA(n);
+
+		if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*xpinfo)))
+			return -1;
+		/* socket policies go away with their socket */
+		if (xpinfo->dir >= XFRM_POLICY_MAX)
+			return 0;
+	} else {
+		return 0;
+	}
+
+	if (fwrite(n, n->nlmsg_len, 1, fp) != 1) {
+		perror("Cannot write dump");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Write all states or policies, keys included, to a file as the raw
+ * netlink messages of a dump, for "import" to install them again.
+ */
+int xfrm_export(__u16 type, __u32 magic, const char *name)
+{
+	struct rtnl_handle rth;
+	struct nlmsghdr req = {
+		.nlmsg_len = NLMSG_HDRLEN,
+		.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
+		.nlmsg_type = type,
+	};
+	FILE *fp = stdout;
+	int ret = 0;
+
+	if (name) {
+		/* states carry their keys, keep the file private */
+		int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+		fp = fd < 0 ? NULL : fdopen(fd, "w");
+		if (!fp) {
+			fprintf(stderr, "Cannot open file \"%s\" for writing: %s\n",
+				name, strerror(errno));
+			if (fd >= 0)
+				close(fd);
+			return -1;
+		}
+	} else if (isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "Not sending a binary stream to stdout\n");
+		return -1;
+	}
+
+	if (rtnl_open_byproto(&rth, 0, NETLINK_XFRM) < 0)
+		exit(1);
+
+	if (fwrite(&magic, sizeof(magic), 1, fp) != 1) {
+		fprintf(stderr, "Can't write magic to dump file\n");
+		ret = -1;
+		goto out;
+	}
+
+	req.nlmsg_seq = rth.dump = ++rth.seq;
+	if (rtnl_send(&rth, &req, req.nlmsg_len) < 0) {
+		perror("Cannot send dump request");
+		ret = -1;
+		goto out;
+	}
+	if (rtnl_dump_filter(&rth, xfrm_export_msg, fp) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		ret = -1;
+	}
+out:
+	rtnl_close(&rth);
+	if (fclose(fp) && !ret) {
+		perror("Cannot write dump");
+		ret = -1;
+	}
+	return ret;
+}
+
+struct xfrm_import {
+	struct rtnl_batch	*batch;
+	__u16			type;
+	__u32			record;
+};
+
+static int xfrm_import_msg(struct rtnl_ctrl_data *ctrl,
+			   struct nlmsghdr *n, void *arg)
+{
+	struct xfrm_import *xi = arg;
+
+	n->nlmsg_type = xi->type;
+	n->nlmsg_flags = NLM_F_REQUEST;
+	return rtnl_batch_add(xi->batch, n, ++xi->record) < 0 ? -1 : 0;
+}
+
+/*
+ * Install the states or policies of an "export" stream, as requests of
+ * the given type, or the add and update commands listed one per line.
+ * Requests are sent pipelined and failures are reported per record or
+ * line without stopping the import.
+ */
+int xfrm_import(const char *name, __u32 magic, __u16 type,
+		int (*cmd)(int argc, char **argv, void *batch))
+{
+	struct xfrm_import xi = { .type = type };
+	int saved_lineno = cmdlineno;
+	struct rtnl_handle rth;
+	struct rtnl_batch batch;
+	FILE *fp = stdin;
+	int c, ret, failed = 0;
+
+	if (strcmp(name, "-") != 0) {
+		fp = fopen(name, "r");
+		if (!fp) {
+			fprintf(stderr,
+				"Cannot open file \"%s\" for reading: %s\n",
+				name, strerror(errno));
+			return -1;
+		}
+	}
+
+	if (rtnl_open_byproto(&rth, 0, NETLINK_XFRM) < 0)
+		exit(1);
+
+	if (rtnl_batch_init(&batch, &rth, rtnl_batch_report_line,
+			    (void *)name) < 0) {
+		ret = -1;
+		goto out;
+	}
+	xi.batch = &batch;
+
+	c = getc(fp);
+	if (c == (magic & 0xff)) {
+		unsigned char b[sizeof(magic)] = { c };
+		__u32 m;
+
+		ret = fread(b + 1, sizeof(b) - 1, 1, fp);
+		memcpy(&m, b, sizeof(m));
+		if (ret != 1 || m != magic) {
+			fprintf(stderr, "%s: magic mismatch\n", name);
+			ret = -1;
+		} else {
+			ret = rtnl_from_file(fp, xfrm_import_msg, &xi);
+		}
+	} else {
+		if (c != EOF)
+			ungetc(c, fp);
+		failed = do_batch_fp_rtnl(fp, name, cmd, &batch);
+		ret = 0;
+	}
+
+	if (rtnl_batch_flush(&batch) < 0)
+		ret = -1;
+	if (batch_report(name, "requests", batch.errors + failed,
+			 batch.sent + failed))
+		ret = -1;
+
+	rtnl_batch_free(&batch);
+out:
+	rtnl_close(&rth);
+	if (fp != stdin)
+		fclose(fp);
+	cmdlineno = saved_lineno;
+	return ret;
+}
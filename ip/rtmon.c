@@ -13,6 +13,13 @@
 #include <sys/time.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "version.h"
 
@@ -20,8 +27,203 @@
 #include "libnetlink.h"
 
 static int init_phase = 1;
+static volatile sig_atomic_t stop;
 
-static void write_stamp(FILE *fp)
+/*
+ * Output of rtmon: the plain capture format written straight to the
+ * file, or, with "segment" or "compress", the block format of
+ * libnetlink.h collected in blk and written a block at a time.
+ */
+#define RTMON_BLOCK_SIZE	65536
+#define RTMON_FLUSH_MS		1000
+
+struct rtmon_log {
+	FILE			*fp;
+	const char		*file;
+	unsigned int		groups;
+
+	char			*blk;
+	size_t			len;
+	size_t			size;
+	struct rtmon_block_hdr	hdr;
+	struct {
+		struct nlmsghdr	n;
+		__u32		tv[2];
+	}			stamp;
+	bool			stamped;
+
+	__u64			written;	/* to the current segment */
+	__u64			segment;	/* rotate beyond this, 0 never */
+	unsigned int		keep;
+	bool			compress;
+	bool			rotating;
+};
+
+static void rtmon_log_open(struct rtmon_log *l)
+{
+	struct rtmon_log_hdr lh = {
+		.magic = RTMON_LOG_MAGIC,
+		.version = RTMON_LOG_VERSION,
+	};
+
+	l->fp = fopen(l->file, "w");
+	if (l->fp == NULL) {
+		perror("Cannot fopen");
+		exit(-1);
+	}
+	l->written = 0;
+	if (!l->blk)
+		return;
+
+	if (fwrite(&lh, 1, sizeof(lh), l->fp) != sizeof(lh)) {
+		perror("rtmon: write");
+		exit(1);
+	}
+	l->written = sizeof(lh);
+}
+
+static void write_stamp(struct rtmon_log *l);
+static int dump_msg2(struct nlmsghdr *n, void *arg);
+static void rtmon_log_flush(struct rtmon_log *l);
+
+/* the new segment gets its own snapshot of links, to be replayed alone */
+static void rtmon_log_rotate(struct rtmon_log *l)
+{
+	char from[PATH_MAX], to[PATH_MAX];
+	int i, phase = init_phase;
+	struct rtnl_handle rth;
+
+	fclose(l->fp);
+	for (i = l->keep; i > 0; i--) {
+		if (i > 1)
+			snprintf(from, sizeof(from), "%s.%d", l->file, i - 1);
+		else
+			snprintf(from, sizeof(from), "%s", l->file);
+		snprintf(to, sizeof(to), "%s.%d", l->file, i);
+		if (rename(from, to) < 0 && errno != ENOENT)
+			fprintf(stderr, "rtmon: cannot rename %s: %s\n",
+				from, strerror(errno));
+	}
+	rtmon_log_open(l);
+
+	if (rtnl_open(&rth, 0) < 0)
+		return;
+	l->rotating = true;
+	init_phase = 1;
+	if (rtnl_linkdump_req(&rth, AF_UNSPEC) < 0) {
+		perror("Cannot send dump request");
+	} else {
+		write_stamp(l);
+		if (rtnl_dump_filter(&rth, dump_msg2, l) < 0)
+			fprintf(stderr, "Dump terminated\n");
+	}
+	/* the initial dump may still be going on */
+	init_phase = phase;
+	/* not counting the snapshot, or a large one rotates right again */
+	rtmon_log_flush(l);
+	l->written = 0;
+	l->rotating = false;
+	rtnl_close(&rth);
+}
+
+static void rtmon_log_flush(struct rtmon_log *l)
+{
+	struct rtmon_block_hdr *h = &l->hdr;
+	void *data = l->blk;
+
+	if (!l->len)
+		return;
+
+	h->magic = RTMON_BLOCK_MAGIC;
+	h->raw_len = h->len = l->len;
+#ifdef HAVE_ZLIB
+	if (l->compress) {
+		static Bytef *zbuf;
+		static uLongf zsize;
+		uLongf zlen = compressBound(l->len);
+
+		if (zsize < zlen) {
+			free(zbuf);
+			zbuf = malloc(zlen);
+			if (!zbuf) {
+				fprintf(stderr, "rtmon: out of memory\n");
+				exit(1);
+			}
+			zsize = zlen;
+		}
+		if (compress2(zbuf, &zlen, (Bytef *)l->blk, l->len,
+			      Z_BEST_SPEED) == Z_OK && zlen < l->len) {
+			h->flags |= RTMON_BLOCK_ZLIB;
+			h->len = zlen;
+			data = zbuf;
+		}
+	}
+#endif
+
+	if (fwrite(h, 1, sizeof(*h), l->fp) != sizeof(*h) ||
+	    fwrite(data, 1, h->len, l->fp) != h->len ||
+	    fflush(l->fp)) {
+		perror("rtmon: write");
+		exit(1);
+	}
+	l->written += sizeof(*h) + h->len;
+	l->len = 0;
+	memset(h, 0, sizeof(*h));
+
+	if (l->segment && l->written >= l->segment && !l->rotating)
+		rtmon_log_rotate(l);
+}
+
+static void rtmon_log_append(struct rtmon_log *l, const struct nlmsghdr *n)
+{
+	size_t len = NLMSG_ALIGN(n->nlmsg_len);
+
+	if (l->len + len > l->size) {
+		size_t size = l->len + len;
+		char *blk = realloc(l->blk, size);
+
+		if (!blk) {
+			fprintf(stderr, "rtmon: out of memory\n");
+			exit(1);
+		}
+		l->blk = blk;
+		l->size = size;
+	}
+	memcpy(l->blk + l->len, n, len);
+	l->len += len;
+}
+
+static void rtmon_write(struct rtmon_log *l, const struct nlmsghdr *n)
+{
+	struct rtmon_block_hdr *h = &l->hdr;
+
+	if (!l->blk) {
+		fwrite((void *)n, 1, NLMSG_ALIGN(n->nlmsg_len), l->fp);
+		return;
+	}
+
+	if (l->len && l->len + NLMSG_ALIGN(n->nlmsg_len) > RTMON_BLOCK_SIZE)
+		rtmon_log_flush(l);
+
+	/* every block starts with a stamp, so it can be read alone */
+	if (n->nlmsg_type == NLMSG_TSTAMP) {
+		memcpy(&l->stamp, n, sizeof(l->stamp));
+		l->stamped = true;
+		if (!l->len)
+			h->first_sec = l->stamp.tv[0];
+		h->last_sec = l->stamp.tv[0];
+	} else {
+		if (!l->len && l->stamped) {
+			rtmon_log_append(l, &l->stamp.n);
+			h->first_sec = h->last_sec = l->stamp.tv[0];
+		}
+		rtnl_log_type_set(h->types, n->nlmsg_type);
+		h->count++;
+	}
+	rtmon_log_append(l, n);
+}
+
+static void write_stamp(struct rtmon_log *l)
 {
 	char buf[128];
 	struct nlmsghdr *n1 = (void *)buf;
@@ -35,18 +237,19 @@ static void write_stamp(FILE *fp)
 	gettimeofday(&tv, NULL);
 	((__u32 *)NLMSG_DATA(n1))[0] = tv.tv_sec;
 	((__u32 *)NLMSG_DATA(n1))[1] = tv.tv_usec;
-	fwrite((void *)n1, 1, NLMSG_ALIGN(n1->nlmsg_len), fp);
+	rtmon_write(l, n1);
 }
 
 static int dump_msg(struct rtnl_ctrl_data *ctrl,
 		    struct nlmsghdr *n, void *arg)
 {
-	FILE *fp = (FILE *)arg;
+	struct rtmon_log *l = arg;
 
 	if (!init_phase)
-		write_stamp(fp);
-	fwrite((void *)n, 1, NLMSG_ALIGN(n->nlmsg_len), fp);
-	fflush(fp);
+		write_stamp(l);
+	rtmon_write(l, n);
+	if (!l->blk)
+		fflush(l->fp);
 	return 0;
 }
 
@@ -55,12 +258,25 @@ static int dump_msg2(struct nlmsghdr *n, void *arg)
 	return dump_msg(NULL, n, arg);
 }
 
+/* a partial block is written after a second at the latest */
+static int rtmon_tick(unsigned int overruns, void *arg)
+{
+	rtmon_log_flush(arg);
+	return stop ? -1 : 0;
+}
+
+static void rtmon_stop(int sig)
+{
+	stop = 1;
+}
+
 static void usage(void)
 {
 	fprintf(stderr,
-		"Usage: rtmon [ OPTIONS ] file FILE [ all | OBJECTS ]\n"
+		"Usage: rtmon [ OPTIONS ] file FILE [ LOG ] [ all | OBJECTS ]\n"
 		"OPTIONS := { -f[amily] { inet | inet6 | link | help } |\n"
 		"             -4 | -6 | -0 | -V[ersion] }\n"
+		"LOG := [ segment SIZE [ keep COUNT ] ] [ compress ]\n"
 		"OBJECTS := [ link ] [ address ] [ route ]\n");
 	exit(-1);
 }
@@ -68,7 +284,7 @@ static void usage(void)
 int
 main(int argc, char **argv)
 {
-	FILE *fp;
+	struct rtmon_log l = { .keep = 8 };
 	struct rtnl_handle rth;
 	int family = AF_UNSPEC;
 	unsigned int groups = ~0U;
@@ -76,6 +292,7 @@ main(int argc, char **argv)
 	int laddr = 0;
 	int lroute = 0;
 	char *file = NULL;
+	int err;
 
 	while (argc > 1) {
 		if (matches(argv[1], "-family") == 0) {
@@ -110,6 +327,26 @@ main(int argc, char **argv)
 			if (argc <= 1)
 				missarg("file");
 			file = argv[1];
+		} else if (strcmp(argv[1], "segment") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				missarg("segment size");
+			if (get_size64(&l.segment, argv[1]) || !l.segment)
+				invarg("invalid segment size", argv[1]);
+		} else if (strcmp(argv[1], "keep") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				missarg("keep count");
+			if (get_unsigned(&l.keep, argv[1], 0))
+				invarg("invalid keep count", argv[1]);
+		} else if (strcmp(argv[1], "compress") == 0) {
+#ifndef HAVE_ZLIB
+			fprintf(stderr, "rtmon was built without zlib, \"compress\" is not supported\n");
+			exit(-1);
+#endif
+			l.compress = true;
 		} else if (matches(argv[1], "link") == 0) {
 			llink = 1;
 			groups = 0;
@@ -149,11 +386,16 @@ main(int argc, char **argv)
 			groups |= nl_mgrp(RTNLGRP_IPV6_ROUTE);
 	}
 
-	fp = fopen(file, "w");
-	if (fp == NULL) {
-		perror("Cannot fopen");
-		exit(-1);
+	l.file = file;
+	if (l.segment || l.compress) {
+		l.size = RTMON_BLOCK_SIZE;
+		l.blk = malloc(l.size);
+		if (!l.blk) {
+			fprintf(stderr, "rtmon: out of memory\n");
+			exit(1);
+		}
 	}
+	rtmon_log_open(&l);
 
 	if (rtnl_open(&rth, groups) < 0)
 		exit(1);
@@ -163,16 +405,29 @@ main(int argc, char **argv)
 		exit(1);
 	}
 
-	write_stamp(fp);
+	write_stamp(&l);
 
-	if (rtnl_dump_filter(&rth, dump_msg2, fp) < 0) {
+	if (rtnl_dump_filter(&rth, dump_msg2, &l) < 0) {
 		fprintf(stderr, "Dump terminated\n");
 		return 1;
 	}
 
 	init_phase = 0;
 
-	if (rtnl_listen(&rth, dump_msg, (void *)fp) < 0)
+	if (!l.blk) {
+		if (rtnl_listen(&rth, dump_msg, &l) < 0)
+			exit(2);
+		exit(0);
+	}
+
+	/* write out the partial block before exiting */
+	signal(SIGINT, rtmon_stop);
+	signal(SIGTERM, rtmon_stop);
+	err = rtnl_listen_timed(&rth, dump_msg, rtmon_tick, RTMON_FLUSH_MS,
+				&l);
+	rtmon_log_flush(&l);
+	fclose(l.fp);
+	if (err < 0 && !stop)
 		exit(2);
 
 	exit(0);
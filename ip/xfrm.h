@@ -19,6 +19,10 @@
 #define IPPROTO_MH              135
 #endif
 
+/* "ip xfrm { state | policy } export" streams start with these */
+#define XFRM_STATE_DUMP_MAGIC	0x58534131
+#define XFRM_POLICY_DUMP_MAGIC	0x58535031
+
 #define XFRMS_RTA(x)  ((struct rtattr*)(((char*)(x)) + NLMSG_ALIGN(sizeof(struct xfrm_usersa_info))))
 #define XFRMS_PAYLOAD(n) NLMSG_PAYLOAD(n,sizeof(struct xfrm_usersa_info))
 
@@ -46,15 +50,6 @@
 		} \
 	} while(0)
 
-struct xfrm_buffer {
-	char *buf;
-	int size;
-	int offset;
-
-	int nlmsg_count;
-	struct rtnl_handle *rth;
-};
-
 struct xfrm_filter {
 	int use;
 
@@ -127,4 +122,9 @@ int xfrm_lifetime_cfg_parse(struct xfrm_lifetime_cfg *lft,
 			    int *argcp, char ***argvp);
 int xfrm_sctx_parse(char *ctxstr, char *context,
 		    struct xfrm_user_sec_ctx *sctx);
+int xfrm_deleteall_send(struct rtnl_handle *rth, struct rtnl_msgbuf *mb,
+			__u64 *failed);
+int xfrm_export(__u16 type, __u32 magic, const char *name);
+int xfrm_import(const char *name, __u32 magic, __u16 type,
+		int (*cmd)(int argc, char **argv, void *batch));
 #endif
@@ -17,9 +17,6 @@
 #include "xfrm.h"
 #include "ip_common.h"
 
-/* #define NLMSG_DELETEALL_BUF_SIZE (4096-512) */
-#define NLMSG_DELETEALL_BUF_SIZE 8192
-
 /*
  * Receiving buffer defines:
  * nlmsg
@@ -50,6 +47,8 @@ static void usage(void)
 		"	[ flag FLAG-LIST ]\n"
 		"Usage: ip xfrm policy flush [ ptype PTYPE ]\n"
 		"Usage: ip xfrm policy count\n"
+		"Usage: ip xfrm policy export [ FILE ]\n"
+		"Usage: ip xfrm policy import [ update ] [ FILE ]\n"
 		"Usage: ip xfrm policy set [ hthresh4 LBITS RBITS ] [ hthresh6 LBITS RBITS ]\n"
 		"Usage: ip xfrm policy setdefault DIR ACTION [ DIR ACTION ] [ DIR ACTION ]\n"
 		"Usage: ip xfrm policy getdefault\n"
@@ -80,7 +79,7 @@ static void usage(void)
 		"MODE := transport | tunnel | beet | ro | in_trigger\n"
 		"LEVEL := required | use\n");
 
-	exit(-1);
+	parse_exit(-1);
 }
 
 static int xfrm_policy_dir_parse(__u8 *dir, int *argcp, char ***argvp)
@@ -223,7 +222,8 @@ int xfrm_sctx_parse(char *ctxstr, char *s,
 	return 0;
 }
 
-static int xfrm_policy_modify(int cmd, unsigned int flags, int argc, char **argv)
+static int xfrm_policy_modify(int cmd, unsigned int flags, int argc, char **argv,
+			      struct rtnl_batch *batch)
 {
 	struct rtnl_handle rth;
 	struct {
@@ -312,7 +312,7 @@ static int xfrm_policy_modify(int cmd, unsigned int flags, int argc, char **argv
 
 			if (tmpls_len + sizeof(*tmpl) > sizeof(tmpls_buf)) {
 				fprintf(stderr, "Too many tmpls: buffer overflow\n");
-				exit(1);
+				parse_exit(1);
 			}
 			tmpl = (struct xfrm_user_tmpl *)((char *)tmpls_buf + tmpls_len);
 
@@ -360,7 +360,7 @@ static int xfrm_policy_modify(int cmd, unsigned int flags, int argc, char **argv
 
 	if (!dirp) {
 		fprintf(stderr, "Not enough information: DIR is required.\n");
-		exit(1);
+		parse_exit(1);
 	}
 
 	if (ptypep) {
@@ -378,7 +378,7 @@ static int xfrm_policy_modify(int cmd, unsigned int flags, int argc, char **argv
 				  (void *)&mark, sizeof(mark));
 		if (r < 0) {
 			fprintf(stderr, "%s: XFRMA_MARK failed\n", __func__);
-			exit(1);
+			parse_exit(1);
 		}
 	}
 
@@ -397,12 +397,15 @@ static int xfrm_policy_modify(int cmd, unsigned int flags, int argc, char **argv
 			  sizeof(xuo));
 	}
 
-	if (rtnl_open_byproto(&rth, 0, NETLINK_XFRM) < 0)
-		exit(1);
-
 	if (req.xpinfo.sel.family == AF_UNSPEC)
 		req.xpinfo.sel.family = AF_INET;
 
+	if (batch)
+		return rtnl_batch_add(batch, &req.n, cmdlineno);
+
+	if (rtnl_open_byproto(&rth, 0, NETLINK_XFRM) < 0)
+		exit(1);
+
 	if (rtnl_talk(&rth, &req.n, NULL) < 0)
 		exit(2);
 
@@ -724,8 +727,7 @@ static int xfrm_policy_get(int argc, char **argv)
  */
 static int xfrm_policy_keep(struct nlmsghdr *n, void *arg)
 {
-	struct xfrm_buffer *xb = (struct xfrm_buffer *)arg;
-	struct rtnl_handle *rth = xb->rth;
+	struct rtnl_msgbuf *mb = arg;
 	struct xfrm_userpolicy_info *xpinfo = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
 	struct rtattr *tb[XFRMA_MAX+1];
@@ -765,14 +767,15 @@ static int xfrm_policy_keep(struct nlmsghdr *n, void *arg)
 	if (xpinfo->dir >= XFRM_POLICY_MAX)
 		return 0;
 
-	if (xb->offset + NLMSG_LENGTH(sizeof(*xpid)) > xb->size)
-		return 0;
+	new_n = rtnl_msgbuf_reserve(mb, n->nlmsg_len);
+	if (!new_n) {
+		fprintf(stderr, "Not enough memory to delete policies\n");
+		return -1;
+	}
 
-	new_n = (struct nlmsghdr *)(xb->buf + xb->offset);
 	new_n->nlmsg_len = NLMSG_LENGTH(sizeof(*xpid));
 	new_n->nlmsg_flags = NLM_F_REQUEST;
 	new_n->nlmsg_type = XFRM_MSG_DELPOLICY;
-	new_n->nlmsg_seq = ++rth->seq;
 
 	xpid = NLMSG_DATA(new_n);
 	memcpy(&xpid->sel, &xpinfo->sel, sizeof(xpid->sel));
@@ -780,8 +783,9 @@ static int xfrm_policy_keep(struct nlmsghdr *n, void *arg)
 	xpid->index = xpinfo->index;
 
 	if (tb[XFRMA_MARK]) {
-		int r = addattr_l(new_n, xb->size, XFRMA_MARK,
-				(void *)RTA_DATA(tb[XFRMA_MARK]), tb[XFRMA_MARK]->rta_len);
+		int r = addattr_l(new_n, n->nlmsg_len, XFRMA_MARK,
+				  RTA_DATA(tb[XFRMA_MARK]),
+				  RTA_PAYLOAD(tb[XFRMA_MARK]));
 		if (r < 0) {
 			fprintf(stderr, "%s: XFRMA_MARK failed\n", __func__);
 			exit(1);
@@ -789,13 +793,11 @@ static int xfrm_policy_keep(struct nlmsghdr *n, void *arg)
 	}
 
 	if (tb[XFRMA_IF_ID]) {
-		addattr32(new_n, xb->size, XFRMA_IF_ID,
+		addattr32(new_n, n->nlmsg_len, XFRMA_IF_ID,
 			  rta_getattr_u32(tb[XFRMA_IF_ID]));
 	}
 
-	xb->offset += new_n->nlmsg_len;
-	xb->nlmsg_count++;
-
+	rtnl_msgbuf_commit(mb, new_n);
 	return 0;
 }
 
@@ -874,56 +876,36 @@ static int xfrm_policy_list_or_deleteall(int argc, char **argv, int deleteall)
 		exit(1);
 
 	if (deleteall) {
-		struct xfrm_buffer xb;
-		char buf[NLMSG_DELETEALL_BUF_SIZE];
-		int i;
-
-		xb.buf = buf;
-		xb.size = sizeof(buf);
-		xb.rth = &rth;
-
-		for (i = 0; ; i++) {
-			struct {
-				struct nlmsghdr n;
-				char buf[NLMSG_BUF_SIZE];
-			} req = {
-				.n.nlmsg_len = NLMSG_HDRLEN,
-				.n.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
-				.n.nlmsg_type = XFRM_MSG_GETPOLICY,
-				.n.nlmsg_seq = rth.dump = ++rth.seq,
-			};
-
-			xb.offset = 0;
-			xb.nlmsg_count = 0;
-
-			if (show_stats > 1)
-				fprintf(stderr, "Delete-all round = %d\n", i);
-
-			if (rtnl_send(&rth, (void *)&req, req.n.nlmsg_len) < 0) {
-				perror("Cannot send dump request");
-				exit(1);
-			}
-
-			if (rtnl_dump_filter(&rth, xfrm_policy_keep, &xb) < 0) {
-				fprintf(stderr, "Delete-all terminated\n");
-				exit(1);
-			}
-			if (xb.nlmsg_count == 0) {
-				if (show_stats > 1)
-					fprintf(stderr, "Delete-all completed\n");
-				break;
-			}
+		struct rtnl_msgbuf mb = {};
+		struct {
+			struct nlmsghdr n;
+			char buf[NLMSG_BUF_SIZE];
+		} req = {
+			.n.nlmsg_len = NLMSG_HDRLEN,
+			.n.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
+			.n.nlmsg_type = XFRM_MSG_GETPOLICY,
+			.n.nlmsg_seq = rth.dump = ++rth.seq,
+		};
+		__u64 failed;
+		int ret;
 
-			if (rtnl_send_check(&rth, xb.buf, xb.offset) < 0) {
-				perror("Failed to send delete-all request");
-				exit(1);
-			}
-			if (show_stats > 1)
-				fprintf(stderr, "Delete-all nlmsg count = %d\n", xb.nlmsg_count);
+		/* a single dump, then the deletes in pipelined batches */
+		if (rtnl_send(&rth, (void *)&req, req.n.nlmsg_len) < 0) {
+			perror("Cannot send dump request");
+			exit(1);
+		}
 
-			xb.offset = 0;
-			xb.nlmsg_count = 0;
+		if (rtnl_dump_filter(&rth, xfrm_policy_keep, &mb) < 0) {
+			fprintf(stderr, "Delete-all terminated\n");
+			exit(1);
 		}
+
+		ret = xfrm_deleteall_send(&rth, &mb, &failed);
+		rtnl_msgbuf_free(&mb);
+		if (ret < 0)
+			fprintf(stderr, "Failed to send delete-all request\n");
+		if (ret < 0 || failed)
+			exit(1);
 	} else {
 		struct {
 			struct nlmsghdr n;
@@ -1309,6 +1291,35 @@ static int xfrm_policy_flush(int argc, char **argv)
 	return 0;
 }
 
+static int xfrm_policy_import_cmd(int argc, char **argv, void *batch)
+{
+	if (matches(*argv, "add") == 0)
+		return xfrm_policy_modify(XFRM_MSG_NEWPOLICY, 0,
+					  argc-1, argv+1, batch);
+	if (matches(*argv, "update") == 0)
+		return xfrm_policy_modify(XFRM_MSG_UPDPOLICY, 0,
+					  argc-1, argv+1, batch);
+
+	fprintf(stderr, "Command \"%s\" is not supported in xfrm policy import\n",
+		*argv);
+	return -1;
+}
+
+static int xfrm_policy_import(int argc, char **argv)
+{
+	__u16 type = XFRM_MSG_NEWPOLICY;
+
+	if (argc > 0 && strcmp(*argv, "update") == 0) {
+		type = XFRM_MSG_UPDPOLICY;
+		argc--; argv++;
+	}
+	if (argc > 1)
+		invarg("unknown", argv[1]);
+
+	return xfrm_import(argc > 0 ? *argv : "-", XFRM_POLICY_DUMP_MAGIC, type,
+			   xfrm_policy_import_cmd) ? 1 : 0;
+}
+
 int do_xfrm_policy(int argc, char **argv)
 {
 	if (argc < 1)
@@ -1316,10 +1327,10 @@ int do_xfrm_policy(int argc, char **argv)
 
 	if (matches(*argv, "add") == 0)
 		return xfrm_policy_modify(XFRM_MSG_NEWPOLICY, 0,
-					  argc-1, argv+1);
+					  argc-1, argv+1, NULL);
 	if (matches(*argv, "update") == 0)
 		return xfrm_policy_modify(XFRM_MSG_UPDPOLICY, 0,
-					  argc-1, argv+1);
+					  argc-1, argv+1, NULL);
 	if (matches(*argv, "delete") == 0)
 		return xfrm_policy_delete(argc-1, argv+1);
 	if (matches(*argv, "deleteall") == 0 || matches(*argv, "delall") == 0)
@@ -1339,6 +1350,11 @@ int do_xfrm_policy(int argc, char **argv)
 		return xfrm_spd_setdefault(argc-1, argv+1);
 	if (matches(*argv, "getdefault") == 0)
 		return xfrm_spd_getdefault(argc-1, argv+1);
+	if (strcmp(*argv, "export") == 0)
+		return xfrm_export(XFRM_MSG_GETPOLICY, XFRM_POLICY_DUMP_MAGIC,
+				   argc > 1 ? argv[1] : NULL) ? 1 : 0;
+	if (strcmp(*argv, "import") == 0)
+		return xfrm_policy_import(argc-1, argv+1);
 	if (matches(*argv, "help") == 0)
 		usage();
 	fprintf(stderr, "Command \"%s\" is unknown, try \"ip xfrm policy help\".\n", *argv);
@@ -11,14 +11,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <netdb.h>
 #include "utils.h"
+#include "hashtab.h"
 #include "xfrm.h"
 #include "ip_common.h"
 
-/* #define NLMSG_DELETEALL_BUF_SIZE (4096-512) */
-#define NLMSG_DELETEALL_BUF_SIZE 8192
-
 /*
  * Receiving buffer defines:
  * nlmsg
@@ -57,6 +57,10 @@ static void usage(void)
 		"        [ flag FLAG-LIST ]\n"
 		"Usage: ip xfrm state flush [ proto XFRM-PROTO ]\n"
 		"Usage: ip xfrm state count\n"
+		"Usage: ip xfrm state watch [ interval SECS ] [ top N ] [ count N ]\n"
+		"        [ ID ] [ mode MODE ] [ reqid REQID ] [ flag FLAG-LIST ]\n"
+		"Usage: ip xfrm state export [ FILE ]\n"
+		"Usage: ip xfrm state import [ update ] [ FILE ]\n"
 		"ID := [ src ADDR ] [ dst ADDR ] [ proto XFRM-PROTO ] [ spi SPI ]\n"
 		"XFRM-PROTO := ");
 	fprintf(stderr,
@@ -99,7 +103,7 @@ static void usage(void)
 		"ENCAP := { espinudp | espinudp-nonike | espintcp } SPORT DPORT OADDR\n"
 		"DIR := in | out\n");
 
-	exit(-1);
+	parse_exit(-1);
 }
 
 static int xfrm_algo_parse(struct xfrm_algo *alg, enum xfrm_attr_type_t type,
@@ -267,7 +271,8 @@ static void xfrm_dir_parse(__u8 *dir, int *argcp, char ***argvp)
 	*argvp = argv;
 }
 
-static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
+static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv,
+			     struct rtnl_batch *batch)
 {
 	struct rtnl_handle rth;
 	struct {
@@ -590,14 +595,14 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 	if (req.xsinfo.flags & XFRM_STATE_ESN &&
 	    replay_window == 0 && dir != XFRM_SA_DIR_OUT ) {
 		fprintf(stderr, "Error: esn flag set without replay-window.\n");
-		exit(-1);
+		parse_exit(-1);
 	}
 
 	if (replay_window > XFRMA_REPLAY_ESN_MAX) {
 		fprintf(stderr,
 			"Error: replay-window (%u) > XFRMA_REPLAY_ESN_MAX (%u).\n",
 			replay_window, XFRMA_REPLAY_ESN_MAX);
-		exit(-1);
+		parse_exit(-1);
 	}
 
 	if (is_offload) {
@@ -635,7 +640,7 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 
 	if (!idp) {
 		fprintf(stderr, "Not enough information: ID is required\n");
-		exit(1);
+		parse_exit(1);
 	}
 
 	if (mark.m) {
@@ -643,7 +648,7 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 				  (void *)&mark, sizeof(mark));
 		if (r < 0) {
 			fprintf(stderr, "XFRMA_MARK failed\n");
-			exit(1);
+			parse_exit(1);
 		}
 	}
 
@@ -665,7 +670,7 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 		default:
 			fprintf(stderr, "MODE value is invalid with XFRM-PROTO value \"%s\"\n",
 				strxf_xfrmproto(req.xsinfo.id.proto));
-			exit(1);
+			parse_exit(1);
 		}
 
 		switch (req.xsinfo.id.proto) {
@@ -674,14 +679,14 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 				fprintf(stderr, "ALGO-TYPE value \"%s\" is invalid with XFRM-PROTO value \"%s\"\n",
 					strxf_algotype(XFRMA_ALG_COMP),
 					strxf_xfrmproto(req.xsinfo.id.proto));
-				exit(1);
+				parse_exit(1);
 			}
 			if (!ealgop && !aeadop) {
 				fprintf(stderr, "ALGO-TYPE value \"%s\" or \"%s\" is required with XFRM-PROTO value \"%s\"\n",
 					strxf_algotype(XFRMA_ALG_CRYPT),
 					strxf_algotype(XFRMA_ALG_AEAD),
 					strxf_xfrmproto(req.xsinfo.id.proto));
-				exit(1);
+				parse_exit(1);
 			}
 			break;
 		case IPPROTO_AH:
@@ -691,14 +696,14 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 					strxf_algotype(XFRMA_ALG_AEAD),
 					strxf_algotype(XFRMA_ALG_COMP),
 					strxf_xfrmproto(req.xsinfo.id.proto));
-				exit(1);
+				parse_exit(1);
 			}
 			if (!aalgop) {
 				fprintf(stderr, "ALGO-TYPE value \"%s\" or \"%s\" is required with XFRM-PROTO value \"%s\"\n",
 					strxf_algotype(XFRMA_ALG_AUTH),
 					strxf_algotype(XFRMA_ALG_AUTH_TRUNC),
 					strxf_xfrmproto(req.xsinfo.id.proto));
-				exit(1);
+				parse_exit(1);
 			}
 			break;
 		case IPPROTO_COMP:
@@ -709,13 +714,13 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 					strxf_algotype(XFRMA_ALG_AUTH_TRUNC),
 					strxf_algotype(XFRMA_ALG_AEAD),
 					strxf_xfrmproto(req.xsinfo.id.proto));
-				exit(1);
+				parse_exit(1);
 			}
 			if (!calgop) {
 				fprintf(stderr, "ALGO-TYPE value \"%s\" is required with XFRM-PROTO value \"%s\"\n",
 					strxf_algotype(XFRMA_ALG_COMP),
 					strxf_xfrmproto(req.xsinfo.id.proto));
-				exit(1);
+				parse_exit(1);
 			}
 			break;
 		}
@@ -723,7 +728,7 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 		if (ealgop || aalgop || aeadop || calgop) {
 			fprintf(stderr, "ALGO is invalid with XFRM-PROTO value \"%s\"\n",
 				strxf_xfrmproto(req.xsinfo.id.proto));
-			exit(1);
+			parse_exit(1);
 		}
 	}
 
@@ -735,23 +740,23 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 		case 0:
 			fprintf(stderr, "\"mode\" is required with XFRM-PROTO value \"%s\"\n",
 				strxf_xfrmproto(req.xsinfo.id.proto));
-			exit(1);
+			parse_exit(1);
 		default:
 			fprintf(stderr, "MODE value is invalid with XFRM-PROTO value \"%s\"\n",
 				strxf_xfrmproto(req.xsinfo.id.proto));
-			exit(1);
+			parse_exit(1);
 		}
 
 		if (!coap) {
 			fprintf(stderr, "\"coa\" is required with XFRM-PROTO value \"%s\"\n",
 				strxf_xfrmproto(req.xsinfo.id.proto));
-			exit(1);
+			parse_exit(1);
 		}
 	} else {
 		if (coap) {
 			fprintf(stderr, "\"coa\" is invalid with XFRM-PROTO value \"%s\"\n",
 				strxf_xfrmproto(req.xsinfo.id.proto));
-			exit(1);
+			parse_exit(1);
 		}
 	}
 
@@ -761,14 +766,11 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 	if (output_mark.m)
 		addattr32(&req.n, sizeof(req.buf), XFRMA_SET_MARK_MASK, output_mark.m);
 
-	if (rtnl_open_byproto(&rth, 0, NETLINK_XFRM) < 0)
-		exit(1);
-
 	if (dir) {
 		int r = addattr8(&req.n, sizeof(req.buf), XFRMA_SA_DIR, dir);
 		if (r < 0) {
 			fprintf(stderr, "XFRMA_SA_DIR failed\n");
-			exit(1);
+			parse_exit(1);
 		}
 	}
 
@@ -778,6 +780,12 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 	if (req.xsinfo.family == AF_UNSPEC)
 		req.xsinfo.family = AF_INET;
 
+	if (batch)
+		return rtnl_batch_add(batch, &req.n, cmdlineno);
+
+	if (rtnl_open_byproto(&rth, 0, NETLINK_XFRM) < 0)
+		exit(1);
+
 	if (rtnl_talk(&rth, &req.n, NULL) < 0)
 		exit(2);
 
@@ -1152,8 +1160,7 @@ static int xfrm_state_get_or_delete(int argc, char **argv, int delete)
  */
 static int xfrm_state_keep(struct nlmsghdr *n, void *arg)
 {
-	struct xfrm_buffer *xb = (struct xfrm_buffer *)arg;
-	struct rtnl_handle *rth = xb->rth;
+	struct rtnl_msgbuf *mb = arg;
 	struct xfrm_usersa_info *xsinfo = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
 	struct nlmsghdr *new_n;
@@ -1179,16 +1186,15 @@ static int xfrm_state_keep(struct nlmsghdr *n, void *arg)
 	    xsinfo->id.proto == IPPROTO_IPV6)
 		return 0;
 
-	if (xb->offset > xb->size) {
-		fprintf(stderr, "State buffer overflow\n");
+	new_n = rtnl_msgbuf_reserve(mb, n->nlmsg_len);
+	if (!new_n) {
+		fprintf(stderr, "Not enough memory to delete states\n");
 		return -1;
 	}
 
-	new_n = (struct nlmsghdr *)(xb->buf + xb->offset);
 	new_n->nlmsg_len = NLMSG_LENGTH(sizeof(*xsid));
 	new_n->nlmsg_flags = NLM_F_REQUEST;
 	new_n->nlmsg_type = XFRM_MSG_DELSA;
-	new_n->nlmsg_seq = ++rth->seq;
 
 	xsid = NLMSG_DATA(new_n);
 	xsid->family = xsinfo->family;
@@ -1196,31 +1202,28 @@ static int xfrm_state_keep(struct nlmsghdr *n, void *arg)
 	xsid->spi = xsinfo->id.spi;
 	xsid->proto = xsinfo->id.proto;
 
-	addattr_l(new_n, xb->size, XFRMA_SRCADDR, &xsinfo->saddr,
+	addattr_l(new_n, n->nlmsg_len, XFRMA_SRCADDR, &xsinfo->saddr,
 		  sizeof(xsid->daddr));
 
 	parse_rtattr(tb, XFRMA_MAX, XFRMS_RTA(xsinfo), len);
 
 	if (tb[XFRMA_MARK]) {
-		int r = addattr_l(new_n, xb->size, XFRMA_MARK,
-				(void *)RTA_DATA(tb[XFRMA_MARK]), tb[XFRMA_MARK]->rta_len);
+		int r = addattr_l(new_n, n->nlmsg_len, XFRMA_MARK,
+				  RTA_DATA(tb[XFRMA_MARK]),
+				  RTA_PAYLOAD(tb[XFRMA_MARK]));
 		if (r < 0) {
 			fprintf(stderr, "%s: XFRMA_MARK failed\n", __func__);
 			exit(1);
 		}
 	}
 
-	xb->offset += new_n->nlmsg_len;
-	xb->nlmsg_count++;
-
+	rtnl_msgbuf_commit(mb, new_n);
 	return 0;
 }
 
-static int xfrm_state_list_or_deleteall(int argc, char **argv, int deleteall)
+static void xfrm_state_filter_parse(int argc, char **argv, bool *nokeys)
 {
 	char *idp = NULL;
-	struct rtnl_handle rth;
-	bool nokeys = false;
 
 	if (argc > 0 || preferred_family != AF_UNSPEC)
 		filter.use = 1;
@@ -1228,7 +1231,7 @@ static int xfrm_state_list_or_deleteall(int argc, char **argv, int deleteall)
 
 	while (argc > 0) {
 		if (strcmp(*argv, "nokeys") == 0) {
-			nokeys = true;
+			*nokeys = true;
 		} else if (strcmp(*argv, "mode") == 0) {
 			NEXT_ARG();
 			xfrm_mode_parse(&filter.xsinfo.mode, &argc, &argv);
@@ -1260,70 +1263,52 @@ static int xfrm_state_list_or_deleteall(int argc, char **argv, int deleteall)
 		}
 		argc--; argv++;
 	}
+}
 
-	if (rtnl_open_byproto(&rth, 0, NETLINK_XFRM) < 0)
-		exit(1);
+/* request a dump of the states, filtered by the kernel where it can */
+static void xfrm_state_dump_req(struct rtnl_handle *rth)
+{
+	struct xfrm_address_filter addrfilter = {
+		.saddr = filter.xsinfo.saddr,
+		.daddr = filter.xsinfo.id.daddr,
+		.family = filter.xsinfo.family,
+		.splen = filter.id_src_mask,
+		.dplen = filter.id_dst_mask,
+	};
+	struct {
+		struct nlmsghdr n;
+		char buf[NLMSG_BUF_SIZE];
+	} req = {
+		.n.nlmsg_len = NLMSG_HDRLEN,
+		.n.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
+		.n.nlmsg_type = XFRM_MSG_GETSA,
+		.n.nlmsg_seq = rth->dump = ++rth->seq,
+	};
 
-	if (deleteall) {
-		struct xfrm_buffer xb;
-		char buf[NLMSG_DELETEALL_BUF_SIZE];
-		int i;
+	if (filter.xsinfo.id.proto)
+		addattr8(&req.n, sizeof(req), XFRMA_PROTO,
+			 filter.xsinfo.id.proto);
+	addattr_l(&req.n, sizeof(req), XFRMA_ADDRESS_FILTER,
+		  &addrfilter, sizeof(addrfilter));
 
-		xb.buf = buf;
-		xb.size = sizeof(buf);
-		xb.rth = &rth;
-
-		for (i = 0; ; i++) {
-			struct {
-				struct nlmsghdr n;
-				char buf[NLMSG_BUF_SIZE];
-			} req = {
-				.n.nlmsg_len = NLMSG_HDRLEN,
-				.n.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
-				.n.nlmsg_type = XFRM_MSG_GETSA,
-				.n.nlmsg_seq = rth.dump = ++rth.seq,
-			};
-
-			xb.offset = 0;
-			xb.nlmsg_count = 0;
-
-			if (show_stats > 1)
-				fprintf(stderr, "Delete-all round = %d\n", i);
-
-			if (rtnl_send(&rth, (void *)&req, req.n.nlmsg_len) < 0) {
-				perror("Cannot send dump request");
-				exit(1);
-			}
+	if (rtnl_send(rth, (void *)&req, req.n.nlmsg_len) < 0) {
+		perror("Cannot send dump request");
+		exit(1);
+	}
+}
 
-			if (rtnl_dump_filter(&rth, xfrm_state_keep, &xb) < 0) {
-				fprintf(stderr, "Delete-all terminated\n");
-				exit(1);
-			}
-			if (xb.nlmsg_count == 0) {
-				if (show_stats > 1)
-					fprintf(stderr, "Delete-all completed\n");
-				break;
-			}
+static int xfrm_state_list_or_deleteall(int argc, char **argv, int deleteall)
+{
+	struct rtnl_handle rth;
+	bool nokeys = false;
 
-			if (rtnl_send_check(&rth, xb.buf, xb.offset) < 0) {
-				perror("Failed to send delete-all request\n");
-				exit(1);
-			}
-			if (show_stats > 1)
-				fprintf(stderr, "Delete-all nlmsg count = %d\n", xb.nlmsg_count);
+	xfrm_state_filter_parse(argc, argv, &nokeys);
 
-			xb.offset = 0;
-			xb.nlmsg_count = 0;
-		}
+	if (rtnl_open_byproto(&rth, 0, NETLINK_XFRM) < 0)
+		exit(1);
 
-	} else {
-		struct xfrm_address_filter addrfilter = {
-			.saddr = filter.xsinfo.saddr,
-			.daddr = filter.xsinfo.id.daddr,
-			.family = filter.xsinfo.family,
-			.splen = filter.id_src_mask,
-			.dplen = filter.id_dst_mask,
-		};
+	if (deleteall) {
+		struct rtnl_msgbuf mb = {};
 		struct {
 			struct nlmsghdr n;
 			char buf[NLMSG_BUF_SIZE];
@@ -1333,18 +1318,29 @@ static int xfrm_state_list_or_deleteall(int argc, char **argv, int deleteall)
 			.n.nlmsg_type = XFRM_MSG_GETSA,
 			.n.nlmsg_seq = rth.dump = ++rth.seq,
 		};
+		__u64 failed;
+		int ret;
 
-		if (filter.xsinfo.id.proto)
-			addattr8(&req.n, sizeof(req), XFRMA_PROTO,
-				 filter.xsinfo.id.proto);
-		addattr_l(&req.n, sizeof(req), XFRMA_ADDRESS_FILTER,
-			  &addrfilter, sizeof(addrfilter));
-
+		/* a single dump, then the deletes in pipelined batches */
 		if (rtnl_send(&rth, (void *)&req, req.n.nlmsg_len) < 0) {
 			perror("Cannot send dump request");
 			exit(1);
 		}
 
+		if (rtnl_dump_filter(&rth, xfrm_state_keep, &mb) < 0) {
+			fprintf(stderr, "Delete-all terminated\n");
+			exit(1);
+		}
+
+		ret = xfrm_deleteall_send(&rth, &mb, &failed);
+		rtnl_msgbuf_free(&mb);
+		if (ret < 0)
+			fprintf(stderr, "Failed to send delete-all request\n");
+		if (ret < 0 || failed)
+			exit(1);
+	} else {
+		xfrm_state_dump_req(&rth);
+
 		rtnl_filter_t filter = nokeys ?
 				xfrm_state_print_nokeys : xfrm_state_print;
 		if (rtnl_dump_filter(&rth, filter, stdout) < 0) {
@@ -1358,6 +1354,285 @@ static int xfrm_state_list_or_deleteall(int argc, char **argv, int deleteall)
 	exit(0);
 }
 
+/*
+ * "ip xfrm state watch" keeps the counters of every SA seen in a dump in
+ * a hash table keyed by (daddr, spi, proto).  The table of
+ * the previous dump is kept too, so each SA's rate follows from one
+ * lookup, and the fastest SAs of each interval are printed.
+ */
+struct sa_sample {
+	xfrm_address_t	daddr;
+	__u32		spi;
+	__u16		family;
+	__u8		proto;
+	__u8		pad;
+
+	xfrm_address_t	saddr;	/* first field after the key */
+	__u64		bytes;
+	__u64		packets;
+	__u64		errors;
+
+	/* per second, since the previous dump */
+	__u64		rate_bytes;
+	__u64		rate_packets;
+	__u64		rate_errors;
+};
+
+struct sa_watch {
+	struct hashtab		cur;
+	struct hashtab		prev;
+
+	struct sa_sample	**top;
+	unsigned int		ntop;
+	unsigned int		max_top;
+
+	unsigned int		active;
+	__u64			rate_bytes;
+	__u64			rate_packets;
+	__u64			rate_errors;
+};
+
+static void sa_table_init(struct hashtab *t)
+{
+	hashtab_init(t, sizeof(struct sa_sample),
+		     offsetof(struct sa_sample, saddr));
+}
+
+static int xfrm_state_sample(struct nlmsghdr *n, void *arg)
+{
+	struct xfrm_usersa_info *xsinfo = NLMSG_DATA(n);
+	struct sa_watch *w = arg;
+	struct sa_sample key = {}, *s;
+	bool found;
+
+	if (n->nlmsg_type != XFRM_MSG_NEWSA ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(*xsinfo)))
+		return 0;
+	if (!xfrm_state_filter_match(xsinfo))
+		return 0;
+
+	key.daddr = xsinfo->id.daddr;
+	key.spi = xsinfo->id.spi;
+	key.proto = xsinfo->id.proto;
+	key.family = xsinfo->family;
+
+	/* SAs only told apart by their mark are counted together */
+	s = hashtab_insert(&w->cur, &key, &found);
+	if (!s) {
+		fprintf(stderr, "Not enough memory to watch states\n");
+		exit(1);
+	}
+	if (!found)
+		s->saddr = xsinfo->saddr;
+	s->bytes += xsinfo->curlft.bytes;
+	s->packets += xsinfo->curlft.packets;
+	s->errors += xsinfo->stats.replay_window + xsinfo->stats.replay +
+		     xsinfo->stats.integrity_failed;
+	return 0;
+}
+
+static __u64 sa_rate(__u64 now, __u64 then, long ms)
+{
+	/* counters only go back if the SA was replaced meanwhile */
+	if (now < then)
+		then = 0;
+	return (now - then) * 1000 / ms;
+}
+
+static bool sa_faster(const struct sa_sample *a, const struct sa_sample *b)
+{
+	if (a->rate_bytes != b->rate_bytes)
+		return a->rate_bytes > b->rate_bytes;
+	return a->rate_packets > b->rate_packets;
+}
+
+static void sa_top_swap(struct sa_sample **h, unsigned int i, unsigned int j)
+{
+	struct sa_sample *tmp = h[i];
+
+	h[i] = h[j];
+	h[j] = tmp;
+}
+
+/* w->top is a min-heap of the fastest SAs, the slowest of them first */
+static void sa_top_sift(struct sa_watch *w, unsigned int i)
+{
+	struct sa_sample **h = w->top;
+
+	for (;;) {
+		unsigned int l = 2 * i + 1, r = l + 1, min = i;
+
+		if (l < w->ntop && sa_faster(h[min], h[l]))
+			min = l;
+		if (r < w->ntop && sa_faster(h[min], h[r]))
+			min = r;
+		if (min == i)
+			break;
+		sa_top_swap(h, i, min);
+		i = min;
+	}
+}
+
+static void sa_top_add(struct sa_watch *w, struct sa_sample *s)
+{
+	struct sa_sample **h = w->top;
+	unsigned int i;
+
+	if (w->ntop < w->max_top) {
+		i = w->ntop++;
+		h[i] = s;
+		while (i && sa_faster(h[(i - 1) / 2], h[i])) {
+			sa_top_swap(h, i, (i - 1) / 2);
+			i = (i - 1) / 2;
+		}
+	} else if (sa_faster(s, h[0])) {
+		h[0] = s;
+		sa_top_sift(w, 0);
+	}
+}
+
+static int sa_top_cmp(const void *a, const void *b)
+{
+	const struct sa_sample *x = *(struct sa_sample * const *)a;
+	const struct sa_sample *y = *(struct sa_sample * const *)b;
+
+	return sa_faster(x, y) ? -1 : sa_faster(y, x);
+}
+
+static void xfrm_state_watch_rates(struct sa_watch *w, long ms)
+{
+	struct sa_sample *s, *old;
+	unsigned int pos;
+
+	w->ntop = w->active = 0;
+	w->rate_bytes = w->rate_packets = w->rate_errors = 0;
+
+	hashtab_for_each(&w->cur, pos, s) {
+		old = hashtab_lookup(&w->prev, s);
+		s->rate_bytes = sa_rate(s->bytes, old ? old->bytes : 0, ms);
+		s->rate_packets = sa_rate(s->packets,
+					  old ? old->packets : 0, ms);
+		s->rate_errors = sa_rate(s->errors, old ? old->errors : 0, ms);
+		if (!s->rate_bytes && !s->rate_packets && !s->rate_errors)
+			continue;
+
+		w->active++;
+		w->rate_bytes += s->rate_bytes;
+		w->rate_packets += s->rate_packets;
+		w->rate_errors += s->rate_errors;
+		sa_top_add(w, s);
+	}
+	qsort(w->top, w->ntop, sizeof(*w->top), sa_top_cmp);
+}
+
+static void xfrm_state_watch_print(struct sa_watch *w, long ms, FILE *fp)
+{
+	unsigned int i;
+
+	if (timestamp)
+		print_timestamp(fp);
+
+	fprintf(fp, "interval %ldms states %u active %u rate", ms,
+		w->cur.used, w->active);
+	print_rate(use_iec, PRINT_FP, NULL, " %s", w->rate_bytes);
+	fprintf(fp, " %llupps", w->rate_packets);
+	if (w->rate_errors)
+		fprintf(fp, " errors %llu/s", w->rate_errors);
+	fprintf(fp, "\n");
+
+	for (i = 0; i < w->ntop; i++) {
+		struct sa_sample *s = w->top[i];
+
+		fprintf(fp, "\tsrc %s",
+			rt_addr_n2a(s->family, sizeof(s->saddr), &s->saddr));
+		fprintf(fp, " dst %s",
+			rt_addr_n2a(s->family, sizeof(s->daddr), &s->daddr));
+		fprintf(fp, " proto %s spi 0x%08x",
+			strxf_xfrmproto(s->proto), ntohl(s->spi));
+		print_rate(use_iec, PRINT_FP, NULL, " rate %s", s->rate_bytes);
+		fprintf(fp, " %llupps", s->rate_packets);
+		if (s->rate_errors)
+			fprintf(fp, " errors %llu/s", s->rate_errors);
+		fprintf(fp, "\n");
+	}
+	fflush(fp);
+}
+
+static int xfrm_state_watch(int argc, char **argv)
+{
+	struct sa_watch w = { .max_top = 10 };
+	unsigned int interval = 1, count = 0, round;
+	struct timespec then, now;
+	struct rtnl_handle rth;
+	bool nokeys = false;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&interval, *argv, 0) || !interval)
+				invarg("INTERVAL value is invalid", *argv);
+		} else if (strcmp(*argv, "top") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&w.max_top, *argv, 0) || !w.max_top)
+				invarg("top value is invalid", *argv);
+		} else if (strcmp(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&count, *argv, 0))
+				invarg("count value is invalid", *argv);
+		} else {
+			break;
+		}
+		argc--; argv++;
+	}
+	/* keys are never looked at, "nokeys" is accepted for symmetry */
+	xfrm_state_filter_parse(argc, argv, &nokeys);
+
+	sa_table_init(&w.cur);
+	sa_table_init(&w.prev);
+	w.top = calloc(w.max_top, sizeof(*w.top));
+	if (!w.top) {
+		fprintf(stderr, "Not enough memory to watch states\n");
+		exit(1);
+	}
+
+	if (rtnl_open_byproto(&rth, 0, NETLINK_XFRM) < 0)
+		exit(1);
+
+	for (round = 0; !count || round <= count; round++) {
+		struct hashtab t;
+
+		if (round)
+			sleep(interval);
+
+		xfrm_state_dump_req(&rth);
+		if (rtnl_dump_filter(&rth, xfrm_state_sample, &w) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			exit(1);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		if (round) {
+			long ms = timespec_diff_ms(&now, &then);
+
+			xfrm_state_watch_rates(&w, ms > 0 ? ms : 1);
+			xfrm_state_watch_print(&w, ms, stdout);
+		}
+		then = now;
+
+		/* this dump becomes the previous one, reuse the older table */
+		t = w.prev;
+		w.prev = w.cur;
+		w.cur = t;
+		hashtab_reset(&w.cur);
+	}
+
+	rtnl_close(&rth);
+	hashtab_free(&w.prev);
+	hashtab_free(&w.cur);
+	free(w.top);
+	return 0;
+}
+
 static int print_sadinfo(struct nlmsghdr *n, void *arg)
 {
 	FILE *fp = (FILE *)arg;
@@ -1484,6 +1759,35 @@ static int xfrm_state_flush(int argc, char **argv)
 	return 0;
 }
 
+static int xfrm_state_import_cmd(int argc, char **argv, void *batch)
+{
+	if (matches(*argv, "add") == 0)
+		return xfrm_state_modify(XFRM_MSG_NEWSA, 0,
+					 argc-1, argv+1, batch);
+	if (matches(*argv, "update") == 0)
+		return xfrm_state_modify(XFRM_MSG_UPDSA, 0,
+					 argc-1, argv+1, batch);
+
+	fprintf(stderr, "Command \"%s\" is not supported in xfrm state import\n",
+		*argv);
+	return -1;
+}
+
+static int xfrm_state_import(int argc, char **argv)
+{
+	__u16 type = XFRM_MSG_NEWSA;
+
+	if (argc > 0 && strcmp(*argv, "update") == 0) {
+		type = XFRM_MSG_UPDSA;
+		argc--; argv++;
+	}
+	if (argc > 1)
+		invarg("unknown", argv[1]);
+
+	return xfrm_import(argc > 0 ? *argv : "-", XFRM_STATE_DUMP_MAGIC, type,
+			   xfrm_state_import_cmd) ? 1 : 0;
+}
+
 int do_xfrm_state(int argc, char **argv)
 {
 	if (argc < 1)
@@ -1491,10 +1795,10 @@ int do_xfrm_state(int argc, char **argv)
 
 	if (matches(*argv, "add") == 0)
 		return xfrm_state_modify(XFRM_MSG_NEWSA, 0,
-					 argc-1, argv+1);
+					 argc-1, argv+1, NULL);
 	if (matches(*argv, "update") == 0)
 		return xfrm_state_modify(XFRM_MSG_UPDSA, 0,
-					 argc-1, argv+1);
+					 argc-1, argv+1, NULL);
 	if (matches(*argv, "allocspi") == 0)
 		return xfrm_state_allocspi(argc-1, argv+1);
 	if (matches(*argv, "delete") == 0)
@@ -1511,6 +1815,13 @@ int do_xfrm_state(int argc, char **argv)
 	if (matches(*argv, "count") == 0) {
 		return xfrm_sad_getinfo(argc, argv);
 	}
+	if (strcmp(*argv, "watch") == 0)
+		return xfrm_state_watch(argc-1, argv+1);
+	if (strcmp(*argv, "export") == 0)
+		return xfrm_export(XFRM_MSG_GETSA, XFRM_STATE_DUMP_MAGIC,
+				   argc > 1 ? argv[1] : NULL) ? 1 : 0;
+	if (strcmp(*argv, "import") == 0)
+		return xfrm_state_import(argc-1, argv+1);
 	if (matches(*argv, "help") == 0)
 		usage();
 	fprintf(stderr, "Command \"%s\" is unknown, try \"ip xfrm state help\".\n", *argv);
@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * hashtab.c	open addressing hash table for aggregating counters
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashtab.h"
+
+#define HASHTAB_MIN_SIZE	64
+
+void hashtab_init(struct hashtab *t, size_t elem_size, size_t key_len)
+{
+	memset(t, 0, sizeof(*t));
+	t->elem_size = elem_size;
+	t->key_len = key_len;
+}
+
+void hashtab_counter_init(struct hashtab *t)
+{
+	hashtab_init(t, sizeof(struct hashtab_counter),
+		     sizeof(((struct hashtab_counter *)0)->key));
+}
+
+/* forget all records but keep the memory for the next round */
+void hashtab_reset(struct hashtab *t)
+{
+	if (t->busy)
+		memset(t->busy, 0, t->size);
+	t->used = 0;
+}
+
+void hashtab_free(struct hashtab *t)
+{
+	free(t->slots);
+	free(t->busy);
+	t->slots = NULL;
+	t->busy = NULL;
+	t->size = t->used = 0;
+}
+
+static __u32 hashtab_hash(const struct hashtab *t, const void *key)
+{
+	const char *p = key;
+	size_t off;
+	__u32 h = 0;
+
+	/* mix word by word so keys growing in several fields spread out */
+	for (off = 0; off < t->key_len; off += 4) {
+		__u32 w = 0;
+
+		memcpy(&w, p + off, t->key_len - off < 4 ? t->key_len - off : 4);
+		h ^= w;
+		h *= 0x9e3779b1;
+		h ^= h >> 15;
+	}
+	return h;
+}
+
+static unsigned int hashtab_slot(const struct hashtab *t, const void *key)
+{
+	unsigned int i = hashtab_hash(t, key) & (t->size - 1);
+
+	while (t->busy[i] &&
+	       memcmp(t->slots + i * t->elem_size, key, t->key_len))
+		i = (i + 1) & (t->size - 1);
+	return i;
+}
+
+static int hashtab_grow(struct hashtab *t)
+{
+	unsigned int i, j, size = t->size ? t->size * 2 : HASHTAB_MIN_SIZE;
+	struct hashtab n = *t;
+
+	n.slots = calloc(size, t->elem_size);
+	n.busy = calloc(size, 1);
+	if (!n.slots || !n.busy) {
+		free(n.slots);
+		free(n.busy);
+		return -1;
+	}
+	n.size = size;
+
+	for (i = 0; i < t->size; i++) {
+		if (!t->busy[i])
+			continue;
+		j = hashtab_slot(&n, t->slots + i * t->elem_size);
+		memcpy(n.slots + j * t->elem_size,
+		       t->slots + i * t->elem_size, t->elem_size);
+		n.busy[j] = 1;
+	}
+	free(t->slots);
+	free(t->busy);
+	*t = n;
+	return 0;
+}
+
+void *hashtab_lookup(const struct hashtab *t, const void *key)
+{
+	unsigned int i;
+
+	if (!t->used)
+		return NULL;
+	i = hashtab_slot(t, key);
+	return t->busy[i] ? t->slots + i * t->elem_size : NULL;
+}
+
+/*
+ * Return the record of key, adding a zeroed one with the key filled in
+ * if there is none.  NULL means no memory, the table is left as it was.
+ */
+void *hashtab_insert(struct hashtab *t, const void *key, bool *found)
+{
+	unsigned int i;
+	char *e;
+
+	if (2 * (t->used + 1) > t->size && hashtab_grow(t))
+		return NULL;
+
+	i = hashtab_slot(t, key);
+	e = t->slots + i * t->elem_size;
+	if (found)
+		*found = t->busy[i];
+	if (!t->busy[i]) {
+		memset(e, 0, t->elem_size);
+		memcpy(e, key, t->key_len);
+		t->busy[i] = 1;
+		t->used++;
+	}
+	return e;
+}
+
+/* next record at or after *pos, in table order */
+void *hashtab_next(const struct hashtab *t, unsigned int *pos)
+{
+	unsigned int i;
+
+	for (i = *pos; i < t->size; i++) {
+		if (t->busy[i]) {
+			*pos = i + 1;
+			return t->slots + i * t->elem_size;
+		}
+	}
+	*pos = t->size;
+	return NULL;
+}
+
+/*
+ * Move the records to the start of t->slots and sort them.  The table is
+ * empty afterwards; the sorted records stay there until the next insert.
+ */
+unsigned int hashtab_sort(struct hashtab *t,
+			  int (*cmp)(const void *a, const void *b))
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < t->size; i++) {
+		if (!t->busy[i])
+			continue;
+		if (i != n)
+			memcpy(t->slots + n * t->elem_size,
+			       t->slots + i * t->elem_size, t->elem_size);
+		n++;
+	}
+	hashtab_reset(t);
+	if (n > 1)
+		qsort(t->slots, n, t->elem_size, cmp);
+	return n;
+}
+
+int hashtab_count(struct hashtab *t, __u32 key)
+{
+	struct hashtab_counter *c = hashtab_insert(t, &key, NULL);
+
+	if (!c)
+		return -1;
+	c->count++;
+	return 0;
+}
+
+int hashtab_counter_cmp(const void *a, const void *b)
+{
+	const struct hashtab_counter *x = a, *y = b;
+
+	return x->key < y->key ? -1 : x->key > y->key;
+}
@@ -21,7 +21,9 @@ static void __new_json_obj(int json, bool have_array)
 			perror("json object");
 			exit(1);
 		}
-		if (pretty)
+		if (cbor)
+			jsonw_cbor(_jw, true);
+		else if (pretty)
 			jsonw_pretty(_jw, true);
 		if (have_array)
 			jsonw_start_array(_jw);
@@ -5,88 +5,263 @@
  * This takes care of the annoying bits of JSON syntax like the commas
  * after elements
  *
+ * The same calls can produce CBOR (RFC 8949) instead of text, with
+ * objects and arrays encoded as indefinite length maps and arrays.
+ *
  * Authors:	Stephen Hemminger <stephen@networkplumber.org>
  */
 
 #include <stdio.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdarg.h>
 #include <assert.h>
 #include <malloc.h>
+#include <string.h>
 #include <inttypes.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <endian.h>
 
 #include "json_writer.h"
 
+/*
+ * Output is collected in an owned buffer and written to the FILE in
+ * large chunks: when the buffer fills, when a top level value or an
+ * element of one is complete, and when the stream is destroyed.
+ * Integers and strings are formatted by hand, only floats and
+ * jsonw_printf() go through the printf machinery.
+ */
+#define JSONW_BUF_SIZE	(64 * 1024)
+
 struct json_writer {
 	FILE		*out;	/* output file */
 	unsigned	depth;  /* nesting */
 	bool		pretty; /* optional whitepace */
+	bool		cbor;	/* binary output */
 	char		sep;	/* either nul or comma */
+	size_t		len;	/* bytes pending in buf */
+	char		buf[JSONW_BUF_SIZE];
+};
+
+static void jsonw_flush(json_writer_t *self)
+{
+	if (self->len) {
+		fwrite(self->buf, 1, self->len, self->out);
+		self->len = 0;
+	}
+}
+
+/* room for at least len more bytes, len must not exceed the buffer */
+static char *jsonw_reserve(json_writer_t *self, size_t len)
+{
+	if (self->len + len > sizeof(self->buf))
+		jsonw_flush(self);
+	return self->buf + self->len;
+}
+
+static void jsonw_putc(json_writer_t *self, char c)
+{
+	*jsonw_reserve(self, 1) = c;
+	self->len++;
+}
+
+static void jsonw_write(json_writer_t *self, const char *str, size_t len)
+{
+	if (len > sizeof(self->buf) / 2) {
+		jsonw_flush(self);
+		fwrite(str, 1, len, self->out);
+		return;
+	}
+	memcpy(jsonw_reserve(self, len), str, len);
+	self->len += len;
+}
+
+static void jsonw_fputs(json_writer_t *self, const char *str)
+{
+	jsonw_write(self, str, strlen(str));
+}
+
+/* CBOR major types */
+enum {
+	CBOR_UINT,
+	CBOR_NINT,
+	CBOR_BYTES,
+	CBOR_TEXT,
+	CBOR_ARRAY,
+	CBOR_MAP,
+	CBOR_TAG,
+	CBOR_SIMPLE,
 };
 
+#define CBOR_FALSE	0xf4
+#define CBOR_TRUE	0xf5
+#define CBOR_NULL	0xf6
+#define CBOR_FLOAT64	0xfb
+#define CBOR_INDEF	31
+#define CBOR_BREAK	0xff
+
+/* Output the initial byte and argument of a CBOR data item */
+static void cbor_head(json_writer_t *self, unsigned int major, uint64_t val)
+{
+	char *p = jsonw_reserve(self, 9);
+	unsigned int i, n;
+
+	major <<= 5;
+	if (val < 24) {
+		*p = major | val;
+		self->len++;
+		return;
+	}
+
+	if (val <= UINT8_MAX) {
+		*p++ = major | 24;
+		n = 1;
+	} else if (val <= UINT16_MAX) {
+		*p++ = major | 25;
+		n = 2;
+	} else if (val <= UINT32_MAX) {
+		*p++ = major | 26;
+		n = 4;
+	} else {
+		*p++ = major | 27;
+		n = 8;
+	}
+	for (i = n; i > 0; i--)
+		*p++ = val >> (8 * (i - 1));
+	self->len += n + 1;
+}
+
+static void cbor_text(json_writer_t *self, const char *str, size_t len)
+{
+	cbor_head(self, CBOR_TEXT, len);
+	jsonw_write(self, str, len);
+}
+
+static void cbor_float(json_writer_t *self, double num)
+{
+	uint64_t bits;
+
+	memcpy(&bits, &num, sizeof(bits));
+	bits = htobe64(bits);
+	jsonw_putc(self, CBOR_FLOAT64);
+	jsonw_write(self, (const char *)&bits, sizeof(bits));
+}
+
 /* indentation for pretty print */
 static void jsonw_indent(json_writer_t *self)
 {
 	unsigned i;
 	for (i = 0; i < self->depth; ++i)
-		fputs("    ", self->out);
+		jsonw_write(self, "    ", 4);
 }
 
 /* end current line and indent if pretty printing */
 static void jsonw_eol(json_writer_t *self)
 {
-	if (!self->pretty)
+	if (!self->pretty || self->cbor)
 		return;
 
-	putc('\n', self->out);
+	jsonw_putc(self, '\n');
 	jsonw_indent(self);
 }
 
 /* If current object is not empty print a comma */
 static void jsonw_eor(json_writer_t *self)
 {
-	if (self->sep != '\0')
-		putc(self->sep, self->out);
+	if (self->sep != '\0' && !self->cbor)
+		jsonw_putc(self, self->sep);
 	self->sep = ',';
 }
 
+/*
+ * Escape sequence for each byte that needs one: a character for the
+ * short forms, 'u' for \u00XX and 0 for bytes that are copied as is.
+ */
+static const char jsonw_escape[256] = {
+	[0x00 ... 0x1f]	= 'u',
+	['\t']		= 't',
+	['\n']		= 'n',
+	['\r']		= 'r',
+	['\f']		= 'f',
+	['\b']		= 'b',
+	['\\']		= '\\',
+	['"']		= '"',
+	[0x7f]		= 'u',
+};
 
 /* Output JSON encoded string */
 /* Handles C escapes and control characters per RFC 8259 */
 static void jsonw_puts(json_writer_t *self, const char *str)
 {
-	putc('"', self->out);
-	for (; *str; ++str)
-		switch (*str) {
-		case '\t':
-			fputs("\\t", self->out);
-			break;
-		case '\n':
-			fputs("\\n", self->out);
-			break;
-		case '\r':
-			fputs("\\r", self->out);
-			break;
-		case '\f':
-			fputs("\\f", self->out);
-			break;
-		case '\b':
-			fputs("\\b", self->out);
-			break;
-		case '\\':
-			fputs("\\\\", self->out);
-			break;
-		case '"':
-			fputs("\\\"", self->out);
+	static const char hex[] = "0123456789abcdef";
+	const unsigned char *p = (const unsigned char *)str;
+
+	if (self->cbor) {
+		cbor_text(self, str, strlen(str));
+		return;
+	}
+
+	jsonw_putc(self, '"');
+	for (;;) {
+		const unsigned char *run = p;
+		char esc, *q;
+
+		while (*p && !jsonw_escape[*p])
+			p++;
+		if (p != run)
+			jsonw_write(self, (const char *)run, p - run);
+		if (!*p)
 			break;
-		default:
-			if ((unsigned char)*str < 0x20 || *str == 0x7f)
-				fprintf(self->out, "\\u%04x", *str);
-			else
-				putc(*str, self->out);
+
+		esc = jsonw_escape[*p];
+		q = jsonw_reserve(self, 6);
+		*q++ = '\\';
+		*q++ = esc;
+		if (esc == 'u') {
+			*q++ = '0';
+			*q++ = '0';
+			*q++ = hex[*p >> 4];
+			*q++ = hex[*p & 0xf];
 		}
-	putc('"', self->out);
+		self->len = q - self->buf;
+		p++;
+	}
+	jsonw_putc(self, '"');
+}
+
+/* Output an unsigned number in decimal, or hex when base is 16 */
+static void jsonw_ulong(json_writer_t *self, bool neg, uint64_t num,
+			unsigned int base)
+{
+	static const char digits[] = "0123456789abcdef";
+	char tmp[24], *p = tmp + sizeof(tmp);
+
+	if (self->cbor) {
+		if (neg)
+			cbor_head(self, CBOR_NINT, num - 1);
+		else
+			cbor_head(self, CBOR_UINT, num);
+		return;
+	}
+
+	do {
+		*--p = digits[num % base];
+		num /= base;
+	} while (num);
+	if (neg)
+		*--p = '-';
+
+	jsonw_eor(self);
+	jsonw_write(self, p, tmp + sizeof(tmp) - p);
+}
+
+static void jsonw_slong(json_writer_t *self, int64_t num)
+{
+	if (num < 0)
+		jsonw_ulong(self, true, -(uint64_t)num, 10);
+	else
+		jsonw_ulong(self, false, num, 10);
 }
 
 /* Create a new JSON stream */
@@ -98,6 +273,8 @@ json_writer_t *jsonw_new(FILE *f)
 		self->depth = 0;
 		self->pretty = false;
 		self->sep = '\0';
+		self->len = 0;
+		self->cbor = false;
 	}
 	return self;
 }
@@ -108,7 +285,9 @@ void jsonw_destroy(json_writer_t **self_p)
 	json_writer_t *self = *self_p;
 
 	assert(self->depth == 0);
-	fputs("\n", self->out);
+	if (!self->cbor)
+		jsonw_putc(self, '\n');
+	jsonw_flush(self);
 	fflush(self->out);
 	free(self);
 	*self_p = NULL;
@@ -119,11 +298,20 @@ void jsonw_pretty(json_writer_t *self, bool on)
 	self->pretty = on;
 }
 
+void jsonw_cbor(json_writer_t *self, bool on)
+{
+	self->cbor = on;
+}
+
 /* Basic blocks */
 static void jsonw_begin(json_writer_t *self, int c)
 {
 	jsonw_eor(self);
-	putc(c, self->out);
+	if (self->cbor)
+		jsonw_putc(self, ((c == '[' ? CBOR_ARRAY : CBOR_MAP) << 5) |
+				 CBOR_INDEF);
+	else
+		jsonw_putc(self, c);
 	++self->depth;
 	self->sep = '\0';
 }
@@ -135,8 +323,11 @@ static void jsonw_end(json_writer_t *self, int c)
 	--self->depth;
 	if (self->sep != '\0')
 		jsonw_eol(self);
-	putc(c, self->out);
+	jsonw_putc(self, self->cbor ? CBOR_BREAK : c);
 	self->sep = ',';
+	/* monitors stream the elements of one array open for good */
+	if (self->depth <= 1)
+		jsonw_flush(self);
 }
 
 
@@ -147,19 +338,100 @@ void jsonw_name(json_writer_t *self, const char *name)
 	jsonw_eol(self);
 	self->sep = '\0';
 	jsonw_puts(self, name);
-	putc(':', self->out);
+	if (self->cbor)
+		return;
+	jsonw_putc(self, ':');
 	if (self->pretty)
-		putc(' ', self->out);
+		jsonw_putc(self, ' ');
+}
+
+/*
+ * jsonw_printf() writes a raw JSON value, which callers use for numbers
+ * in a custom format.  Encode what parses as a number as one, anything
+ * else as text.  Integers out of the 64 bit range are kept as text
+ * rather than clamped.
+ */
+static void cbor_vprintf(json_writer_t *self, const char *fmt, va_list ap)
+{
+	unsigned long long ull;
+	char *str, *end;
+	long long ll;
+	double d;
+	int n;
+
+	n = vasprintf(&str, fmt, ap);
+	if (n < 0)
+		return;
+
+	errno = 0;
+	/* strtoull() would take a negative number and wrap it */
+	if (str[strspn(str, " \t")] == '-') {
+		ll = strtoll(str, &end, 10);
+		if (n && !*end) {
+			if (errno == ERANGE)
+				cbor_text(self, str, n);
+			else if (ll < 0)
+				cbor_head(self, CBOR_NINT, -(uint64_t)ll - 1);
+			else
+				cbor_head(self, CBOR_UINT, ll);
+			goto out;
+		}
+	} else {
+		ull = strtoull(str, &end, 10);
+		if (n && !*end) {
+			if (errno == ERANGE)
+				cbor_text(self, str, n);
+			else
+				cbor_head(self, CBOR_UINT, ull);
+			goto out;
+		}
+	}
+	d = strtod(str, &end);
+	if (n && !*end)
+		cbor_float(self, d);
+	else if (!strcmp(str, "true") || !strcmp(str, "false"))
+		jsonw_putc(self, *str == 't' ? CBOR_TRUE : CBOR_FALSE);
+	else if (!strcmp(str, "null"))
+		jsonw_putc(self, CBOR_NULL);
+	else
+		cbor_text(self, str, n);
+out:
+	free(str);
 }
 
 __attribute__((format(printf, 2, 3)))
 void jsonw_printf(json_writer_t *self, const char *fmt, ...)
 {
+	size_t room = sizeof(self->buf) - self->len;
 	va_list ap;
+	int n;
 
-	va_start(ap, fmt);
 	jsonw_eor(self);
-	vfprintf(self->out, fmt, ap);
+
+	if (self->cbor) {
+		va_start(ap, fmt);
+		cbor_vprintf(self, fmt, ap);
+		va_end(ap);
+		return;
+	}
+
+	va_start(ap, fmt);
+	n = vsnprintf(self->buf + self->len, room, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return;
+	if (n < room) {
+		self->len += n;
+		return;
+	}
+
+	/* did not fit, retry in an empty buffer or bypass it */
+	jsonw_flush(self);
+	va_start(ap, fmt);
+	if (n < sizeof(self->buf))
+		self->len = vsnprintf(self->buf, sizeof(self->buf), fmt, ap);
+	else
+		vfprintf(self->out, fmt, ap);
 	va_end(ap);
 }
 
@@ -177,14 +449,14 @@ void jsonw_end_object(json_writer_t *self)
 void jsonw_start_array(json_writer_t *self)
 {
 	jsonw_begin(self, '[');
-	if (self->pretty)
-		putc(' ', self->out);
+	if (self->pretty && !self->cbor)
+		jsonw_putc(self, ' ');
 }
 
 void jsonw_end_array(json_writer_t *self)
 {
-	if (self->pretty && self->sep)
-		putc(' ', self->out);
+	if (self->pretty && self->sep && !self->cbor)
+		jsonw_putc(self, ' ');
 	self->sep = '\0';
 	jsonw_end(self, ']');
 }
@@ -198,62 +470,74 @@ void jsonw_string(json_writer_t *self, const char *value)
 
 void jsonw_bool(json_writer_t *self, bool val)
 {
-	jsonw_printf(self, "%s", val ? "true" : "false");
+	jsonw_eor(self);
+	if (self->cbor)
+		jsonw_putc(self, val ? CBOR_TRUE : CBOR_FALSE);
+	else
+		jsonw_fputs(self, val ? "true" : "false");
 }
 
 void jsonw_null(json_writer_t *self)
 {
-	jsonw_printf(self, "null");
+	jsonw_eor(self);
+	if (self->cbor)
+		jsonw_putc(self, CBOR_NULL);
+	else
+		jsonw_fputs(self, "null");
 }
 
 void jsonw_float(json_writer_t *self, double num)
 {
+	if (self->cbor) {
+		cbor_float(self, num);
+		return;
+	}
 	jsonw_printf(self, "%g", num);
 }
 
 void jsonw_hhu(json_writer_t *self, unsigned char num)
 {
-	jsonw_printf(self, "%hhu", num);
+	jsonw_ulong(self, false, num, 10);
 }
 
 void jsonw_hu(json_writer_t *self, unsigned short num)
 {
-	jsonw_printf(self, "%hu", num);
+	jsonw_ulong(self, false, num, 10);
 }
 
 void jsonw_uint(json_writer_t *self, unsigned int num)
 {
-	jsonw_printf(self, "%u", num);
+	jsonw_ulong(self, false, num, 10);
 }
 
 void jsonw_u64(json_writer_t *self, uint64_t num)
 {
-	jsonw_printf(self, "%"PRIu64, num);
+	jsonw_ulong(self, false, num, 10);
 }
 
 void jsonw_xint(json_writer_t *self, uint64_t num)
 {
-	jsonw_printf(self, "%"PRIx64, num);
+	jsonw_ulong(self, false, num, 16);
 }
 
 void jsonw_luint(json_writer_t *self, unsigned long num)
 {
-	jsonw_printf(self, "%lu", num);
+	jsonw_ulong(self, false, num, 10);
 }
 
 void jsonw_lluint(json_writer_t *self, unsigned long long num)
 {
-	jsonw_printf(self, "%llu", num);
+	jsonw_ulong(self, false, num, 10);
 }
 
 void jsonw_int(json_writer_t *self, int num)
 {
-	jsonw_printf(self, "%d", num);
+	jsonw_slong(self, num);
 }
 
 void jsonw_s64(json_writer_t *self, int64_t num)
 {
-	jsonw_printf(self, "%"PRId64, num);
+	jsonw_slong(self, num);
 }
 
 /* Basic name/value objects */
@@ -12,15 +12,24 @@
 #include <fcntl.h>
 #include <net/if_arp.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
 #include <sys/uio.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <linux/fib_rules.h>
 #include <linux/if_addrlabel.h>
 #include <linux/if_bridge.h>
 #include <linux/nexthop.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "libnetlink.h"
 #include "json_print.h"
@@ -1181,6 +1190,266 @@ int rtnl_talk_suppress_rtnl_errmsg(struct rtnl_handle *rtnl, struct nlmsghdr *n,
 	return __rtnl_talk(rtnl, n, answer, false, NULL);
 }
 
+/*
+ * Request batching: many requests are packed into one sendmsg() and
+ * their ACKs collected afterwards, instead of one round trip each as
+ * with rtnl_talk().  A chunk is limited by the socket send buffer and
+ * by the number of ACKs the receive buffer can queue, so no ACK is
+ * ever dropped.  Each request carries a caller cookie (e.g. an input
+ * line number) that is handed back for errors and replies.
+ */
+#define RTNL_BATCH_ACK_TRUESIZE	1024	/* rcvbuf cost of one queued ACK */
+#define RTNL_BATCH_RECV_MSGS	64
+#define RTNL_BATCH_RECV_SIZE	8192
+
+int rtnl_batch_init(struct rtnl_batch *b, struct rtnl_handle *rth,
+		    rtnl_batch_cb_t cb, void *arg)
+{
+	int sndbuf = 0, rcvbuf_force = 4 * 1024 * 1024, rbuf = 0;
+	socklen_t optlen = sizeof(int);
+
+	memset(b, 0, sizeof(*b));
+	b->rth = rth;
+	b->cb = cb;
+	b->arg = arg;
+
+	/* a larger receive buffer allows larger chunks, best effort */
+	setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUFFORCE,
+		   &rcvbuf_force, sizeof(rcvbuf_force));
+
+	if (getsockopt(rth->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen) < 0 ||
+	    getsockopt(rth->fd, SOL_SOCKET, SO_RCVBUF, &rbuf, &optlen) < 0) {
+		perror("getsockopt");
+		return -1;
+	}
+
+	/* netlink_sendmsg() rejects messages above sk_sndbuf - 32 */
+	b->max_len = sndbuf > 4096 ? sndbuf - 32 : 4096;
+	b->max_msgs = rbuf / 2 / RTNL_BATCH_ACK_TRUESIZE;
+	if (b->max_msgs < 1)
+		b->max_msgs = 1;
+
+	b->buf = malloc(b->max_len);
+	b->cookies = calloc(b->max_msgs, sizeof(*b->cookies));
+	b->rbuf = malloc(RTNL_BATCH_RECV_MSGS * RTNL_BATCH_RECV_SIZE);
+	if (!b->buf || !b->cookies || !b->rbuf) {
+		fprintf(stderr, "malloc error: not enough buffer\n");
+		rtnl_batch_free(b);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Reserve room for a message of at most len bytes at the end of the
+ * buffer; it is only accounted for once passed to rtnl_msgbuf_commit().
+ */
+struct nlmsghdr *rtnl_msgbuf_reserve(struct rtnl_msgbuf *mb, unsigned int len)
+{
+	len = NLMSG_ALIGN(len);
+	if (mb->len + len > mb->size) {
+		size_t size = mb->size ? mb->size * 2 : 64 * 1024;
+		char *buf;
+
+		while (size < mb->len + len)
+			size *= 2;
+		buf = realloc(mb->buf, size);
+		if (!buf) {
+			fprintf(stderr, "Out of memory queueing netlink messages\n");
+			return NULL;
+		}
+		mb->buf = buf;
+		mb->size = size;
+	}
+
+	return (struct nlmsghdr *)(mb->buf + mb->len);
+}
+
+void rtnl_msgbuf_commit(struct rtnl_msgbuf *mb, struct nlmsghdr *n)
+{
+	mb->len += NLMSG_ALIGN(n->nlmsg_len);
+	mb->count++;
+}
+
+int rtnl_msgbuf_add(struct rtnl_msgbuf *mb, const struct nlmsghdr *n)
+{
+	struct nlmsghdr *m = rtnl_msgbuf_reserve(mb, n->nlmsg_len);
+
+	if (!m)
+		return -1;
+	memcpy(m, n, n->nlmsg_len);
+	rtnl_msgbuf_commit(mb, m);
+	return 0;
+}
+
+void rtnl_msgbuf_free(struct rtnl_msgbuf *mb)
+{
+	free(mb->buf);
+	memset(mb, 0, sizeof(*mb));
+}
+
+void rtnl_batch_free(struct rtnl_batch *b)
+{
+	free(b->buf);
+	free(b->cookies);
+	free(b->rbuf);
+	b->buf = b->rbuf = NULL;
+	b->cookies = NULL;
+}
+
+static int rtnl_batch_ack(struct rtnl_batch *b, struct nlmsghdr *h,
+			  int len, unsigned int *pending)
+{
+	__u32 idx = h->nlmsg_seq - b->seq;
+	int error = 0;
+
+	if (h->nlmsg_pid != b->rth->local.nl_pid || idx >= b->count)
+		return 0;
+
+	if (h->nlmsg_type != NLMSG_ERROR) {
+		/* a reply to a request, its ACK follows */
+		if (b->cb)
+			return b->cb(b, b->cookies[idx], 0, h, b->arg);
+		return 0;
+	}
+
+	if (len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+		fprintf(stderr, "ERROR truncated\n");
+		return -1;
+	}
+
+	error = ((struct nlmsgerr *)NLMSG_DATA(h))->error;
+	(*pending)--;
+	b->acked++;
+	if (!error)
+		return 0;
+
+	b->errors++;
+	if (b->cb)
+		return b->cb(b, b->cookies[idx], error, h, b->arg);
+
+	rtnl_talk_error(h, NLMSG_DATA(h), NULL);
+	return 0;
+}
+
+int rtnl_batch_flush(struct rtnl_batch *b)
+{
+	struct mmsghdr msgs[RTNL_BATCH_RECV_MSGS];
+	struct iovec iovs[RTNL_BATCH_RECV_MSGS];
+	unsigned int pending = b->count;
+	int i, n, ret = 0;
+
+	if (!b->count)
+		return 0;
+
+	if (send(b->rth->fd, b->buf, b->len, 0) < 0) {
+		perror("Cannot talk to rtnetlink");
+		b->count = b->len = 0;
+		return -1;
+	}
+	b->sent += b->count;
+
+	while (pending) {
+		for (i = 0; i < RTNL_BATCH_RECV_MSGS; i++) {
+			iovs[i].iov_base = b->rbuf + i * RTNL_BATCH_RECV_SIZE;
+			iovs[i].iov_len = RTNL_BATCH_RECV_SIZE;
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		/* block for the first message, then take what is queued */
+		n = recvmmsg(b->rth->fd, msgs, RTNL_BATCH_RECV_MSGS,
+			     MSG_WAITFORONE, NULL);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			fprintf(stderr, "netlink receive error %s (%d)\n",
+				strerror(errno), errno);
+			ret = -1;
+			break;
+		}
+
+		for (i = 0; i < n && ret >= 0; i++) {
+			int status = msgs[i].msg_len;
+			struct nlmsghdr *h = iovs[i].iov_base;
+
+			/* a truncated ACK still carries the error code */
+			if (status > RTNL_BATCH_RECV_SIZE)
+				status = RTNL_BATCH_RECV_SIZE;
+
+			while (status >= (int)sizeof(*h) && ret >= 0) {
+				int len = h->nlmsg_len;
+
+				if (len < sizeof(*h))
+					break;
+				if (len > status)
+					len = status;
+
+				ret = rtnl_batch_ack(b, h, len, &pending);
+
+				status -= NLMSG_ALIGN(len);
+				h = (struct nlmsghdr *)((char *)h + NLMSG_ALIGN(len));
+			}
+		}
+		if (ret < 0)
+			break;
+	}
+
+	b->count = b->len = 0;
+	return ret;
+}
+
+void rtnl_print_ack_error(struct nlmsghdr *n)
+{
+	rtnl_talk_error(n, NLMSG_DATA(n), NULL);
+}
+
+/* rtnl_batch_cb_t for requests read from a file: the cookie is the
+ * line number and arg the file name.
+ */
+int rtnl_batch_report_line(struct rtnl_batch *b, __u32 cookie, int error,
+			   struct nlmsghdr *n, void *arg)
+{
+	if (!error)
+		return 0;
+
+	fprintf(stderr, "%s:%u: ", (const char *)arg, cookie);
+	rtnl_print_ack_error(n);
+	return 0;
+}
+
+int rtnl_batch_add(struct rtnl_batch *b, struct nlmsghdr *n, __u32 cookie)
+{
+	unsigned int len = NLMSG_ALIGN(n->nlmsg_len);
+	struct nlmsghdr *h;
+	int ret;
+
+	if (len > b->max_len) {
+		fprintf(stderr, "Request of %u bytes is too large\n", len);
+		return -1;
+	}
+
+	if (b->len + len > b->max_len || b->count == b->max_msgs) {
+		ret = rtnl_batch_flush(b);
+		if (ret < 0)
+			return ret;
+	}
+
+	h = (struct nlmsghdr *)(b->buf + b->len);
+	memcpy(h, n, n->nlmsg_len);
+	memset((char *)h + n->nlmsg_len, 0, len - n->nlmsg_len);
+	h->nlmsg_flags |= NLM_F_ACK;
+	h->nlmsg_seq = ++b->rth->seq;
+	if (!b->count)
+		b->seq = h->nlmsg_seq;
+
+	b->cookies[b->count++] = cookie;
+	b->len += len;
+	return 0;
+}
+
 int rtnl_listen_all_nsid(struct rtnl_handle *rth)
 {
 	unsigned int on = 1;
@@ -1194,9 +1463,11 @@ int rtnl_listen_all_nsid(struct rtnl_handle *rth)
 	return 0;
 }
 
-int rtnl_listen(struct rtnl_handle *rtnl,
-		rtnl_listen_filter_t handler,
-		void *jarg)
+static int __rtnl_listen(struct rtnl_handle *rtnl,
+			 rtnl_listen_filter_t handler,
+			 rtnl_listen_tick_t tick,
+			 unsigned int interval_ms,
+			 void *jarg)
 {
 	int status;
 	struct nlmsghdr *h;
@@ -1210,23 +1481,62 @@ int rtnl_listen(struct rtnl_handle *rtnl,
 	};
 	char   buf[16384];
 	char   cmsgbuf[BUFSIZ];
+	unsigned int overruns = 0;
+	struct timespec deadline = {};
+	int recv_flags = 0;
+
+	if (tick) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		timespec_add_ms(&deadline, interval_ms);
+		recv_flags = MSG_DONTWAIT;
+	}
 
 	iov.iov_base = buf;
 	while (1) {
-		struct rtnl_ctrl_data ctrl;
+		struct rtnl_ctrl_data ctrl = {};
 		struct cmsghdr *cmsg;
 
+		if (tick) {
+			struct pollfd pfd = { .fd = rtnl->fd, .events = POLLIN };
+			struct timespec now;
+			int err, timeout;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			timeout = timespec_diff_ms(&deadline, &now);
+			if (timeout <= 0) {
+				err = tick(overruns, jarg);
+				fflush(stdout);
+				if (err < 0)
+					return err;
+				overruns = 0;
+				deadline = now;
+				timespec_add_ms(&deadline, interval_ms);
+				continue;
+			}
+
+			if (poll(&pfd, 1, timeout) < 0 && errno != EINTR) {
+				perror("poll");
+				return -1;
+			}
+			if (!(pfd.revents & POLLIN))
+				continue;
+		}
+
 		if (rtnl->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID) {
 			msg.msg_control = &cmsgbuf;
 			msg.msg_controllen = sizeof(cmsgbuf);
 		}
 
 		iov.iov_len = sizeof(buf);
-		status = recvmsg(rtnl->fd, &msg, 0);
+		status = recvmsg(rtnl->fd, &msg, recv_flags);
 
 		if (status < 0) {
 			if (errno == EINTR || errno == EAGAIN)
 				continue;
+			if (tick && errno == ENOBUFS) {
+				overruns++;
+				continue;
+			}
 			fprintf(stderr, "netlink receive error %s (%d)\n",
 				strerror(errno), errno);
 			if (errno == ENOBUFS)
@@ -1275,7 +1585,9 @@ int rtnl_listen(struct rtnl_handle *rtnl,
 			}
 
 			err = handler(&ctrl, h, jarg);
-			fflush(stdout);
+			/* in timed mode output is flushed once per tick */
+			if (!tick)
+				fflush(stdout);
 			if (err < 0)
 				return err;
 
@@ -1293,18 +1605,379 @@ int rtnl_listen(struct rtnl_handle *rtnl,
 	}
 }
 
-int rtnl_from_file(FILE *rtnl, rtnl_listen_filter_t handler,
-		   void *jarg)
+int rtnl_listen(struct rtnl_handle *rtnl,
+		rtnl_listen_filter_t handler,
+		void *jarg)
 {
-	size_t status;
-	char buf[16384];
-	struct nlmsghdr *h = (struct nlmsghdr *)buf;
+	return __rtnl_listen(rtnl, handler, NULL, 0, jarg);
+}
+
+int rtnl_listen_timed(struct rtnl_handle *rtnl,
+		      rtnl_listen_filter_t handler,
+		      rtnl_listen_tick_t tick,
+		      unsigned int interval_ms,
+		      void *jarg)
+{
+	return __rtnl_listen(rtnl, handler, tick, interval_ms, jarg);
+}
+
+/*
+ * Threaded listener: a reader thread drains the socket into a single
+ * producer, single consumer ring of received datagrams while the calling
+ * thread runs the handler, so slow formatting or output does not keep
+ * the socket from being read.  The ring positions are free running and
+ * each side only writes its own; the consumer sleeps on an eventfd that
+ * the producer signals only when the consumer announced it is waiting.
+ *
+ * Each record is a struct rtnl_ring_rec followed by the datagram, padded
+ * to 8 bytes; a record of length 0 means the rest of the buffer is unused
+ * and the next record starts at offset 0.  The reader stamps each record
+ * as it is received, so timestamps do not grow with the backlog.
+ */
+struct rtnl_ring_rec {
+	__u32		len;
+	int		nsid;
+	struct timeval	tstamp;
+};
+
+struct rtnl_ring {
+	struct rtnl_handle	*rth;
+	char			*buf;
+	size_t			size;
+	size_t			head;		/* written by the consumer */
+	size_t			tail;		/* written by the producer */
+	int			waiting;	/* consumer sleeps on efd */
+	int			efd;
+	int			error;		/* reader stopped */
+	unsigned int		overruns;	/* ENOBUFS on the socket */
+	unsigned int		stalls;		/* ring was full */
+};
+
+#define RTNL_RING_ALIGN(len)	(((len) + 7) & ~(size_t)7)
+
+/*
+ * Called after publishing tail.  The fence orders that store before the
+ * load of waiting and pairs with the one in the consumer after it sets
+ * waiting and before it rereads tail: at least one side sees the other's
+ * store, so either the consumer finds the new record or it gets woken.
+ */
+static void rtnl_ring_wake(struct rtnl_ring *r)
+{
+	__u64 one = 1;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->waiting, __ATOMIC_RELAXED) &&
+	    write(r->efd, &one, sizeof(one)) < 0)
+		perror("eventfd write");
+}
+
+/* wait until 'need' bytes are free at the producer's position */
+static void rtnl_ring_reserve(struct rtnl_ring *r, size_t need)
+{
+	const struct timespec pause = { .tv_nsec = 1000000 };
+	bool stalled = false;
+
+	while (r->tail + need -
+	       __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) > r->size) {
+		if (!stalled) {
+			__atomic_add_fetch(&r->stalls, 1, __ATOMIC_RELAXED);
+			stalled = true;
+		}
+		nanosleep(&pause, NULL);
+	}
+}
+
+static void *rtnl_ring_reader(void *arg)
+{
+	struct rtnl_ring *r = arg;
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	char buf[32768] __attribute__((aligned(8)));
+	char cmsgbuf[BUFSIZ];
+	struct iovec iov = { .iov_base = buf };
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	int error;
+
+	while (1) {
+		struct rtnl_ring_rec *rec;
+		struct cmsghdr *cmsg;
+		struct timeval tstamp;
+		size_t off, need;
+		int status, nsid = -1;
+
+		if (r->rth->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID) {
+			msg.msg_control = &cmsgbuf;
+			msg.msg_controllen = sizeof(cmsgbuf);
+		}
+
+		iov.iov_len = sizeof(buf);
+		status = recvmsg(r->rth->fd, &msg, 0);
+		if (status < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			if (errno == ENOBUFS) {
+				__atomic_add_fetch(&r->overruns, 1,
+						   __ATOMIC_RELAXED);
+				continue;
+			}
+			fprintf(stderr, "netlink receive error %s (%d)\n",
+				strerror(errno), errno);
+			error = -1;
+			break;
+		}
+		if (status == 0) {
+			fprintf(stderr, "EOF on netlink\n");
+			error = -1;
+			break;
+		}
+		if (msg.msg_flags & MSG_TRUNC) {
+			fprintf(stderr, "Message truncated\n");
+			continue;
+		}
+		/* before a full ring can hold us up */
+		gettimeofday(&tstamp, NULL);
+
+		if (r->rth->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID) {
+			for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+			     cmsg = CMSG_NXTHDR(&msg, cmsg))
+				if (cmsg->cmsg_level == SOL_NETLINK &&
+				    cmsg->cmsg_type == NETLINK_LISTEN_ALL_NSID &&
+				    cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+					nsid = *(int *)CMSG_DATA(cmsg);
+		}
+
+		need = RTNL_RING_ALIGN(sizeof(*rec) + status);
+		off = r->tail % r->size;
+		if (off + need > r->size) {
+			/* does not fit before the end, wrap around */
+			rtnl_ring_reserve(r, r->size - off);
+			rec = (struct rtnl_ring_rec *)(r->buf + off);
+			rec->len = 0;
+			__atomic_store_n(&r->tail, r->tail + r->size - off,
+					 __ATOMIC_RELEASE);
+			off = 0;
+		}
+		rtnl_ring_reserve(r, need);
+
+		rec = (struct rtnl_ring_rec *)(r->buf + off);
+		rec->len = status;
+		rec->nsid = nsid;
+		rec->tstamp = tstamp;
+		memcpy(rec + 1, buf, status);
+		__atomic_store_n(&r->tail, r->tail + need, __ATOMIC_RELEASE);
+		rtnl_ring_wake(r);
+	}
+
+	__atomic_store_n(&r->error, error, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->waiting, 1, __ATOMIC_SEQ_CST);
+	rtnl_ring_wake(r);
+	return NULL;
+}
+
+static int rtnl_ring_handle(struct rtnl_ring *r, struct rtnl_ring_rec *rec,
+			    rtnl_listen_filter_t handler, void *jarg)
+{
+	struct rtnl_ctrl_data ctrl = {
+		.nsid = rec->nsid,
+		.tstamp = &rec->tstamp,
+	};
+	struct nlmsghdr *h = (struct nlmsghdr *)(rec + 1);
+	int status = rec->len;
+
+	while (status >= sizeof(*h)) {
+		int len = h->nlmsg_len;
+		int err;
+
+		if (len < sizeof(*h) || len > status) {
+			fprintf(stderr, "!!!malformed message: len=%d\n", len);
+			return -1;
+		}
+
+		err = handler(&ctrl, h, jarg);
+		if (err < 0)
+			return err;
+
+		status -= NLMSG_ALIGN(len);
+		h = (struct nlmsghdr *)((char *)h + NLMSG_ALIGN(len));
+	}
+	return 0;
+}
+
+int rtnl_listen_threaded(struct rtnl_handle *rtnl,
+			 rtnl_listen_filter_t handler,
+			 size_t ring_size, void *jarg)
+{
+	struct rtnl_ring r = {
+		.rth = rtnl,
+		.size = RTNL_RING_ALIGN(ring_size),
+	};
+	unsigned int overruns = 0;
+	pthread_t reader;
+	size_t head = 0;
+	int ret = 0;
+
+	if (r.size < 2 * 32768)
+		r.size = 2 * 32768;
+	r.buf = malloc(r.size);
+	if (!r.buf) {
+		fprintf(stderr, "Cannot allocate %zu bytes of ring\n", r.size);
+		return -1;
+	}
+	r.efd = eventfd(0, EFD_CLOEXEC);
+	if (r.efd < 0) {
+		perror("eventfd");
+		free(r.buf);
+		return -1;
+	}
+	ret = pthread_create(&reader, NULL, rtnl_ring_reader, &r);
+	if (ret) {
+		fprintf(stderr, "Cannot start reader thread: %s\n",
+			strerror(ret));
+		close(r.efd);
+		free(r.buf);
+		return -1;
+	}
 
 	while (1) {
+		struct rtnl_ring_rec *rec;
+		unsigned int n;
+
+		if (head == __atomic_load_n(&r.tail, __ATOMIC_ACQUIRE)) {
+			__u64 cnt;
+
+			ret = __atomic_load_n(&r.error, __ATOMIC_ACQUIRE);
+			if (ret)
+				break;
+
+			/* idle: flush output, then sleep until woken */
+			fflush(stdout);
+			__atomic_store_n(&r.waiting, 1, __ATOMIC_RELAXED);
+			/* pairs with the fence in rtnl_ring_wake() */
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if (head == __atomic_load_n(&r.tail, __ATOMIC_ACQUIRE) &&
+			    read(r.efd, &cnt, sizeof(cnt)) < 0 && errno != EINTR) {
+				perror("eventfd read");
+				ret = -1;
+				break;
+			}
+			__atomic_store_n(&r.waiting, 0, __ATOMIC_SEQ_CST);
+			continue;
+		}
+
+		rec = (struct rtnl_ring_rec *)(r.buf + head % r.size);
+		if (rec->len) {
+			ret = rtnl_ring_handle(&r, rec, handler, jarg);
+			if (ret < 0)
+				break;
+			head += RTNL_RING_ALIGN(sizeof(*rec) + rec->len);
+		} else {
+			head += r.size - head % r.size;
+		}
+		__atomic_store_n(&r.head, head, __ATOMIC_RELEASE);
+
+		n = __atomic_load_n(&r.overruns, __ATOMIC_RELAXED);
+		if (n != overruns) {
+			overruns = n;
+			fflush(stdout);
+			fprintf(stderr,
+				"netlink receive error: %u socket overruns, ring full %u times\n",
+				n, __atomic_load_n(&r.stalls, __ATOMIC_RELAXED));
+		}
+	}
+
+	pthread_cancel(reader);
+	pthread_join(reader, NULL);
+	close(r.efd);
+	free(r.buf);
+	return ret;
+}
+
+/* upper bound for a block of the rtmon log, to catch corrupt headers */
+#define RTMON_BLOCK_MAX		(16 << 20)
+
+struct rtnl_file_ctx {
+	const struct rtnl_log_filter	*f;
+	rtnl_listen_filter_t		handler;
+	void				*jarg;
+	bool				done;
+
+	/* the last stamp, passed on with the next matching message */
+	__u32				now;
+	bool				stamp_pending;
+	struct {
+		struct nlmsghdr		n;
+		__u32			tv[2];
+	}				stamp;
+};
+
+static bool rtnl_log_types_match(const __u32 *want, const __u32 *have)
+{
+	__u32 any = 0;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (want[i] & have[i])
+			return true;
+		any |= want[i];
+	}
+	return !any;
+}
+
+static int rtnl_file_msg(struct rtnl_file_ctx *c, struct nlmsghdr *n)
+{
+	const struct rtnl_log_filter *f = c->f;
+	__u32 types[4] = {};
+	int err;
+
+	if (!f)
+		return c->handler(NULL, n, c->jarg);
+
+	if (n->nlmsg_type == NLMSG_TSTAMP) {
+		if (n->nlmsg_len < sizeof(c->stamp))
+			return 0;
+		memcpy(&c->stamp, n, sizeof(c->stamp));
+		c->now = c->stamp.tv[0];
+		c->stamp_pending = true;
+		if (c->now > f->to)
+			c->done = true;
+		return 0;
+	}
+
+	rtnl_log_type_set(types, n->nlmsg_type);
+	if (c->now < f->from || !rtnl_log_types_match(f->types, types)) {
+		/* keeps the device names of the capture known */
+		if (f->link && (n->nlmsg_type == RTM_NEWLINK ||
+				n->nlmsg_type == RTM_DELLINK))
+			return f->link(NULL, n, c->jarg);
+		return 0;
+	}
+
+	if (c->stamp_pending) {
+		c->stamp_pending = false;
+		err = c->handler(NULL, &c->stamp.n, c->jarg);
+		if (err < 0)
+			return err;
+	}
+	return c->handler(NULL, n, c->jarg);
+}
+
+/* plain capture: messages and stamps back to back */
+static int rtnl_from_stream(FILE *rtnl, struct rtnl_file_ctx *c,
+			    size_t have, char *buf, size_t size)
+{
+	struct nlmsghdr *h = (struct nlmsghdr *)buf;
+	size_t status;
+
+	while (!c->done) {
 		int err, len;
 		int l;
 
-		status = fread(&buf, 1, sizeof(*h), rtnl);
+		status = have + fread(buf + have, 1, sizeof(*h) - have, rtnl);
+		have = 0;
 
 		if (status == 0 && feof(rtnl))
 			return 0;
@@ -1312,14 +1985,14 @@ int rtnl_from_file(FILE *rtnl, rtnl_listen_filter_t handler,
 			if (ferror(rtnl))
 				perror("rtnl_from_file: fread");
 			if (feof(rtnl))
-				fprintf(stderr, "rtnl-from_file: truncated message\n");
+				fprintf(stderr, "rtnl_from_file: truncated message\n");
 			return -1;
 		}
 
 		len = h->nlmsg_len;
 		l = len - sizeof(*h);
 
-		if (l < 0 || len > sizeof(buf)) {
+		if (l < 0 || len > size) {
 			fprintf(stderr, "!!!malformed message: len=%d @%lu\n",
 				len, ftell(rtnl));
 			return -1;
@@ -1331,14 +2004,325 @@ int rtnl_from_file(FILE *rtnl, rtnl_listen_filter_t handler,
 			if (ferror(rtnl))
 				perror("rtnl_from_file: fread");
 			if (feof(rtnl))
-				fprintf(stderr, "rtnl-from_file: truncated message\n");
+				fprintf(stderr, "rtnl_from_file: truncated message\n");
+			return -1;
+		}
+
+		err = rtnl_file_msg(c, h);
+		if (err < 0)
+			return err;
+	}
+	return 0;
+}
+
+static int rtnl_file_skip(FILE *rtnl, size_t len)
+{
+	char buf[4096];
+
+	if (fseeko(rtnl, len, SEEK_CUR) == 0)
+		return 0;
+
+	/* not seekable, e.g. a pipe */
+	while (len) {
+		size_t n = fread(buf, 1, min(len, sizeof(buf)), rtnl);
+
+		if (!n)
+			return -1;
+		len -= n;
+	}
+	return 0;
+}
+
+static int rtnl_file_block(struct rtnl_file_ctx *c, char *buf, size_t len)
+{
+	while (len && !c->done) {
+		struct nlmsghdr *n = (struct nlmsghdr *)buf;
+		size_t l;
+		int err;
+
+		if (len < sizeof(*n) || n->nlmsg_len < sizeof(*n) ||
+		    NLMSG_ALIGN(n->nlmsg_len) > len) {
+			fprintf(stderr, "rtnl_from_file: malformed block\n");
+			return -1;
+		}
+
+		err = rtnl_file_msg(c, n);
+		if (err < 0)
+			return err;
+
+		l = NLMSG_ALIGN(n->nlmsg_len);
+		buf += l;
+		len -= l;
+	}
+	return 0;
+}
+
+static int rtnl_block_read(FILE *rtnl, const struct rtmon_block_hdr *bh,
+			   char *raw, char **zbuf, size_t *zsize)
+{
+	if (!(bh->flags & RTMON_BLOCK_ZLIB)) {
+		if (bh->len != bh->raw_len)
 			return -1;
+		return fread(raw, 1, bh->len, rtnl) == bh->len ? 0 : -1;
+	}
+
+#ifdef HAVE_ZLIB
+	{
+		uLongf raw_len = bh->raw_len;
+
+		if (*zsize < bh->len) {
+			char *p = realloc(*zbuf, bh->len);
+
+			if (!p)
+				return -1;
+			*zbuf = p;
+			*zsize = bh->len;
 		}
+		if (fread(*zbuf, 1, bh->len, rtnl) != bh->len)
+			return -1;
+		if (uncompress((Bytef *)raw, &raw_len,
+			       (Bytef *)*zbuf, bh->len) != Z_OK ||
+		    raw_len != bh->raw_len)
+			return -1;
+		return 0;
+	}
+#else
+	fprintf(stderr, "rtnl_from_file: compressed log, built without zlib\n");
+	return -1;
+#endif
+}
+
+/*
+ * Plain capture in a regular file: it is mapped, and with a start time
+ * bisected for the last stamp before it.  Messages are not self
+ * delimiting, so a probe resyncs on the next stamp record, told apart
+ * by its fixed header and by the messages following it chaining up.
+ */
+#define RTNL_MAP_STAMP_LEN	NLMSG_LENGTH(2 * sizeof(__u32))
+#define RTNL_MAP_CHAIN		8
+#define RTNL_MAP_SCAN		65536
+
+static bool rtnl_map_is_stamp(const char *p)
+{
+	const struct nlmsghdr *n = (const struct nlmsghdr *)p;
+	const __u32 *tv = NLMSG_DATA(n);
+
+	return n->nlmsg_len == RTNL_MAP_STAMP_LEN &&
+	       n->nlmsg_type == NLMSG_TSTAMP && !n->nlmsg_flags &&
+	       !n->nlmsg_seq && !n->nlmsg_pid && tv[1] < 1000000;
+}
+
+static bool rtnl_map_chains(const char *map, size_t len, size_t off)
+{
+	int i;
 
-		err = handler(NULL, h, jarg);
+	for (i = 0; i < RTNL_MAP_CHAIN && off < len; i++) {
+		const struct nlmsghdr *n = (const struct nlmsghdr *)(map + off);
+
+		if (len - off < sizeof(*n) || n->nlmsg_len < sizeof(*n) ||
+		    NLMSG_ALIGN(n->nlmsg_len) > len - off)
+			return false;
+		off += NLMSG_ALIGN(n->nlmsg_len);
+	}
+	return true;
+}
+
+/* offset of the first stamp at or after off, len if there is none */
+static size_t rtnl_map_sync(const char *map, size_t len, size_t off)
+{
+	for (off = NLMSG_ALIGN(off); off + RTNL_MAP_STAMP_LEN <= len;
+	     off += NLMSG_ALIGNTO)
+		if (rtnl_map_is_stamp(map + off) &&
+		    rtnl_map_chains(map, len, off))
+			return off;
+	return len;
+}
+
+static size_t rtnl_map_seek(const char *map, size_t len, __u32 from)
+{
+	size_t lo = 0, hi = len;
+
+	/* lo is always a message boundary before the first stamp >= from */
+	while (hi - lo > RTNL_MAP_SCAN) {
+		size_t mid = lo + (hi - lo) / 2;
+		size_t off = rtnl_map_sync(map, len, mid);
+		const __u32 *tv;
+
+		if (off == len) {
+			hi = mid;
+			continue;
+		}
+		tv = NLMSG_DATA((const struct nlmsghdr *)(map + off));
+		if (tv[0] >= from) {
+			hi = mid;
+		} else {
+			lo = off;
+			if (hi < lo)
+				hi = lo;
+		}
+	}
+	return lo;
+}
+
+/* 1 if the file cannot be mapped and has to be read as a stream */
+static int rtnl_from_map(FILE *rtnl, struct rtnl_file_ctx *c, off_t start)
+{
+	struct stat st;
+	size_t len, off = 0;
+	char *map;
+	int err = 0;
+
+	if (fstat(fileno(rtnl), &st) < 0 || !S_ISREG(st.st_mode) ||
+	    start < 0 || start % NLMSG_ALIGNTO || st.st_size <= start)
+		return 1;
+
+	/* private and writable, handlers may scribble on the message */
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		   fileno(rtnl), 0);
+	if (map == MAP_FAILED)
+		return 1;
+	len = st.st_size - start;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	/* the link messages before from are needed too */
+	if (c->f && c->f->from && !c->f->link)
+		off = rtnl_map_seek(map + start, len, c->f->from);
+
+	while (off < len && !c->done) {
+		struct nlmsghdr *n = (struct nlmsghdr *)(map + start + off);
+
+		if (len - off < sizeof(*n)) {
+			fprintf(stderr, "rtnl_from_file: truncated message\n");
+			err = -1;
+			break;
+		}
+		if (n->nlmsg_len < sizeof(*n) || n->nlmsg_len > len - off) {
+			fprintf(stderr, "!!!malformed message: len=%u @%llu\n",
+				n->nlmsg_len,
+				(unsigned long long)(start + off));
+			err = -1;
+			break;
+		}
+
+		err = rtnl_file_msg(c, n);
+		if (err < 0)
+			break;
+		off += NLMSG_ALIGN(n->nlmsg_len);
+	}
+
+	munmap(map, st.st_size);
+	fseeko(rtnl, 0, SEEK_END);
+	return err;
+}
+
+/*
+ * rtmon log: blocks outside the filter are skipped without reading them,
+ * unless they hold link messages wanted by f->link
+ */
+static int rtnl_from_log(FILE *rtnl, struct rtnl_file_ctx *c)
+{
+	const struct rtnl_log_filter *f = c->f;
+	__u32 links[4] = {};
+	char *raw = NULL, *zbuf = NULL;
+	size_t raw_size = 0, zsize = 0;
+	struct rtmon_block_hdr bh;
+	int err = 0;
+
+	rtnl_log_type_set(links, RTM_NEWLINK);
+	rtnl_log_type_set(links, RTM_DELLINK);
+
+	while (!c->done) {
+		size_t status = fread(&bh, 1, sizeof(bh), rtnl);
+
+		if (status == 0 && feof(rtnl))
+			break;
+		if (status != sizeof(bh) || bh.magic != RTMON_BLOCK_MAGIC ||
+		    bh.len > RTMON_BLOCK_MAX || bh.raw_len > RTMON_BLOCK_MAX) {
+			fprintf(stderr, "rtnl_from_file: malformed block header @%lu\n",
+				ftell(rtnl));
+			err = -1;
+			break;
+		}
+
+		if (f && bh.first_sec > f->to)
+			break;
+		if (f && (bh.last_sec < f->from ||
+			  !rtnl_log_types_match(f->types, bh.types)) &&
+		    !(f->link && rtnl_log_types_match(links, bh.types))) {
+			if (rtnl_file_skip(rtnl, bh.len) < 0) {
+				fprintf(stderr, "rtnl_from_file: truncated block\n");
+				err = -1;
+				break;
+			}
+			continue;
+		}
+
+		if (raw_size < bh.raw_len) {
+			char *p = realloc(raw, bh.raw_len);
+
+			if (!p) {
+				fprintf(stderr, "rtnl_from_file: out of memory\n");
+				err = -1;
+				break;
+			}
+			raw = p;
+			raw_size = bh.raw_len;
+		}
+		if (rtnl_block_read(rtnl, &bh, raw, &zbuf, &zsize) < 0) {
+			fprintf(stderr, "rtnl_from_file: cannot read block @%lu\n",
+				ftell(rtnl));
+			err = -1;
+			break;
+		}
+
+		err = rtnl_file_block(c, raw, bh.raw_len);
 		if (err < 0)
+			break;
+	}
+
+	free(raw);
+	free(zbuf);
+	return err;
+}
+
+int rtnl_from_file_filter(FILE *rtnl, const struct rtnl_log_filter *filter,
+			  rtnl_listen_filter_t handler, void *jarg)
+{
+	struct rtnl_file_ctx c = {
+		.f = filter,
+		.handler = handler,
+		.jarg = jarg,
+	};
+	char buf[16384] __aligned(4);
+	struct rtmon_log_hdr *lh = (struct rtmon_log_hdr *)buf;
+	size_t status;
+
+	/* a plain capture starts with a message, whose length is never
+	 * the magic number of the block format
+	 */
+	status = fread(buf, 1, sizeof(*lh), rtnl);
+	if (status == sizeof(*lh) && lh->magic == RTMON_LOG_MAGIC) {
+		if (lh->version != RTMON_LOG_VERSION) {
+			fprintf(stderr, "rtnl_from_file: unsupported log version %u\n",
+				lh->version);
+			return -1;
+		}
+		return rtnl_from_log(rtnl, &c);
+	}
+
+	if (status == sizeof(*lh)) {
+		int err = rtnl_from_map(rtnl, &c, ftello(rtnl) - status);
+
+		if (err <= 0)
 			return err;
 	}
+	return rtnl_from_stream(rtnl, &c, status, buf, sizeof(buf));
+}
+
+int rtnl_from_file(FILE *rtnl, rtnl_listen_filter_t handler,
+		   void *jarg)
+{
+	return rtnl_from_file_filter(rtnl, NULL, handler, jarg);
 }
 
 int addattr(struct nlmsghdr *n, int maxlen, int type)
@@ -4,8 +4,12 @@
  */
 
 #include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <libmnl/libmnl.h>
 #include <linux/genetlink.h>
 
@@ -131,9 +135,15 @@ static int ctrl_attrs_cb(const struct nlattr *attr, void *data)
 	if (type == CTRL_ATTR_FAMILY_ID &&
 	    mnl_attr_validate(attr, MNL_TYPE_U16) < 0)
 		return MNL_CB_ERROR;
+	if (type == CTRL_ATTR_VERSION &&
+	    mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
+		return MNL_CB_ERROR;
 	if (type == CTRL_ATTR_MAXATTR &&
 	    mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
 		return MNL_CB_ERROR;
+	if (type == CTRL_ATTR_MCAST_GROUPS &&
+	    mnl_attr_validate(attr, MNL_TYPE_NESTED) < 0)
+		return MNL_CB_ERROR;
 	if (type == CTRL_ATTR_POLICY &&
 	    mnl_attr_validate(attr, MNL_TYPE_NESTED) < 0)
 		return MNL_CB_ERROR;
@@ -144,23 +154,71 @@ static int ctrl_attrs_cb(const struct nlattr *attr, void *data)
 	return MNL_CB_OK;
 }
 
+static int family_grp_attrs_cb(const struct nlattr *attr, void *data)
+{
+	int type = mnl_attr_get_type(attr);
+	const struct nlattr **tb = data;
+
+	if (mnl_attr_type_valid(attr, CTRL_ATTR_MCAST_GRP_MAX) < 0)
+		return MNL_CB_OK;
+
+	if (type == CTRL_ATTR_MCAST_GRP_ID &&
+	    mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
+		return MNL_CB_ERROR;
+	if (type == CTRL_ATTR_MCAST_GRP_NAME &&
+	    mnl_attr_validate(attr, MNL_TYPE_STRING) < 0)
+		return MNL_CB_ERROR;
+	tb[type] = attr;
+	return MNL_CB_OK;
+}
+
+/* groups past MNLU_GENL_MAX_GROUPS are looked up by mnlg when needed */
+static void get_family_groups(const struct nlattr *nested,
+			      struct mnlu_genl_family *fam)
+{
+	const struct nlattr *pos;
+
+	mnl_attr_for_each_nested(pos, nested) {
+		struct nlattr *tb[CTRL_ATTR_MCAST_GRP_MAX + 1] = {};
+
+		if (fam->ngroups == MNLU_GENL_MAX_GROUPS)
+			break;
+		if (mnl_attr_parse_nested(pos, family_grp_attrs_cb, tb) < 0 ||
+		    !tb[CTRL_ATTR_MCAST_GRP_NAME] ||
+		    !tb[CTRL_ATTR_MCAST_GRP_ID])
+			continue;
+
+		strlcpy(fam->groups[fam->ngroups].name,
+			mnl_attr_get_str(tb[CTRL_ATTR_MCAST_GRP_NAME]),
+			GENL_NAMSIZ);
+		fam->groups[fam->ngroups].id =
+			mnl_attr_get_u32(tb[CTRL_ATTR_MCAST_GRP_ID]);
+		fam->ngroups++;
+	}
+}
+
 static int get_family_cb(const struct nlmsghdr *nlh, void *data)
 {
 	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
 	struct nlattr *tb[CTRL_ATTR_MAX + 1] = {};
-	struct mnlu_gen_socket *nlg = data;
+	struct mnlu_genl_family *fam = data;
 
 	mnl_attr_parse(nlh, sizeof(*genl), ctrl_attrs_cb, tb);
 	if (!tb[CTRL_ATTR_FAMILY_ID])
 		return MNL_CB_ERROR;
 	if (!tb[CTRL_ATTR_MAXATTR])
 		return MNL_CB_ERROR;
-	nlg->family = mnl_attr_get_u16(tb[CTRL_ATTR_FAMILY_ID]);
-	nlg->maxattr = mnl_attr_get_u32(tb[CTRL_ATTR_MAXATTR]);
+	fam->id = mnl_attr_get_u16(tb[CTRL_ATTR_FAMILY_ID]);
+	fam->maxattr = mnl_attr_get_u32(tb[CTRL_ATTR_MAXATTR]);
+	if (tb[CTRL_ATTR_VERSION])
+		fam->version = mnl_attr_get_u32(tb[CTRL_ATTR_VERSION]);
+	if (tb[CTRL_ATTR_MCAST_GROUPS])
+		get_family_groups(tb[CTRL_ATTR_MCAST_GROUPS], fam);
 	return MNL_CB_OK;
 }
 
-static int family_get(struct mnlu_gen_socket *nlg, const char *family_name)
+static int family_get(struct mnlu_gen_socket *nlg, const char *family_name,
+		      struct mnlu_genl_family *fam)
 {
 	struct genlmsghdr hdr = {};
 	struct nlmsghdr *nlh;
@@ -179,16 +237,253 @@ static int family_get(struct mnlu_gen_socket *nlg, const char *family_name)
 	if (err < 0)
 		return err;
 
+	memset(fam, 0, sizeof(*fam));
+	strlcpy(fam->name, family_name, sizeof(fam->name));
 	err = mnlu_socket_recv_run(nlg->nl, nlh->nlmsg_seq, nlg->buf,
 				   MNL_SOCKET_BUFFER_SIZE,
-				   get_family_cb, nlg);
+				   get_family_cb, fam);
 	return err;
 }
 
+/*
+ * Families resolved so far, so that further sockets of the process do
+ * without CTRL_CMD_GETFAMILY.  If GENL_FAMILY_CACHE names a file they
+ * are kept there for later processes too.  A family only gets a new ID
+ * when it is registered again, after a reboot or a module reload, so
+ * the file is tagged with the boot ID and a hash of /proc/modules and
+ * ignored once either changed.  The hash includes the module addresses,
+ * which tell a reload apart; when they are hidden (kptr_restrict) the
+ * file is not used at all.
+ */
+#define GENL_CACHE_MAGIC	"genl-cache 1"
+
+struct mnlu_genl_entry {
+	struct mnlu_genl_family	fam;
+	struct mnlu_genl_entry	*next;
+};
+
+static struct mnlu_genl_entry *genl_families;
+static bool genl_cache_loaded;
+
+static uint32_t genl_cache_hash(uint32_t hash, const char *s)
+{
+	while (*s) {
+		hash ^= (unsigned char)*s++;
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+static int genl_cache_tag(char *tag, size_t len)
+{
+	char boot_id[64], line[512];
+	uint32_t hash = 2166136261u;
+	FILE *fp;
+
+	fp = fopen("/proc/sys/kernel/random/boot_id", "r");
+	if (!fp)
+		return -1;
+	if (!fgets(boot_id, sizeof(boot_id), fp)) {
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	boot_id[strcspn(boot_id, "\n")] = '\0';
+
+	/* without module support the families never change */
+	fp = fopen("/proc/modules", "r");
+	if (fp) {
+		while (fgets(line, sizeof(line), fp)) {
+			unsigned long long addr;
+			char name[64], state[16];
+			unsigned long size;
+
+			/* name size refcount users state address */
+			if (sscanf(line, "%63s %lu %*s %*s %15s %llx",
+				   name, &size, state, &addr) != 4)
+				continue;
+			if (!addr) {
+				fclose(fp);
+				return -1;
+			}
+			snprintf(line, sizeof(line), "%s %lu %s %llx\n",
+				 name, size, state, addr);
+			hash = genl_cache_hash(hash, line);
+		}
+		fclose(fp);
+	}
+
+	snprintf(tag, len, "%s %s %08x", GENL_CACHE_MAGIC, boot_id, hash);
+	return 0;
+}
+
+static struct mnlu_genl_family *
+genl_cache_add(const struct mnlu_genl_family *fam)
+{
+	struct mnlu_genl_entry *e = malloc(sizeof(*e));
+
+	if (!e)
+		return NULL;
+	e->fam = *fam;
+	e->next = genl_families;
+	genl_families = e;
+	return &e->fam;
+}
+
+static const struct mnlu_genl_family *genl_cache_find(const char *name)
+{
+	struct mnlu_genl_entry *e;
+
+	for (e = genl_families; e; e = e->next)
+		if (strcmp(e->fam.name, name) == 0)
+			return &e->fam;
+	return NULL;
+}
+
+/* NAME ID VERSION MAXATTR [ GROUP=ID ]... */
+static int genl_cache_parse(char *line, struct mnlu_genl_family *fam)
+{
+	char *tok, *save, *eq;
+	unsigned int id;
+
+	memset(fam, 0, sizeof(*fam));
+	tok = strtok_r(line, " \n", &save);
+	if (!tok || strlen(tok) >= sizeof(fam->name))
+		return -1;
+	strcpy(fam->name, tok);
+
+	tok = strtok_r(NULL, " \n", &save);
+	if (!tok || get_unsigned(&id, tok, 10) || id > UINT16_MAX)
+		return -1;
+	fam->id = id;
+	tok = strtok_r(NULL, " \n", &save);
+	if (!tok || get_u32(&fam->version, tok, 10))
+		return -1;
+	tok = strtok_r(NULL, " \n", &save);
+	if (!tok || get_u32(&fam->maxattr, tok, 10))
+		return -1;
+
+	while ((tok = strtok_r(NULL, " \n", &save)) &&
+	       fam->ngroups < MNLU_GENL_MAX_GROUPS) {
+		eq = strchr(tok, '=');
+		if (!eq || eq - tok >= GENL_NAMSIZ)
+			return -1;
+		*eq = '\0';
+		strcpy(fam->groups[fam->ngroups].name, tok);
+		if (get_u32(&fam->groups[fam->ngroups].id, eq + 1, 10))
+			return -1;
+		fam->ngroups++;
+	}
+	return 0;
+}
+
+static void genl_cache_load(void)
+{
+	const char *path = getenv("GENL_FAMILY_CACHE");
+	char tag[128], line[1024];
+	struct mnlu_genl_family fam;
+	FILE *fp;
+
+	genl_cache_loaded = true;
+	if (!path || genl_cache_tag(tag, sizeof(tag)))
+		return;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return;
+	if (fgets(line, sizeof(line), fp) &&
+	    strncmp(line, tag, strlen(tag)) == 0 && line[strlen(tag)] == '\n') {
+		while (fgets(line, sizeof(line), fp))
+			if (!genl_cache_parse(line, &fam) &&
+			    !genl_cache_find(fam.name))
+				genl_cache_add(&fam);
+	}
+	fclose(fp);
+}
+
+/* written aside and renamed, so readers never see a partial file */
+static void genl_cache_save(void)
+{
+	const char *path = getenv("GENL_FAMILY_CACHE");
+	struct mnlu_genl_entry *e;
+	char tag[128], *tmp;
+	unsigned int i;
+	FILE *fp;
+	int fd;
+
+	if (!path || genl_cache_tag(tag, sizeof(tag)))
+		return;
+	if (asprintf(&tmp, "%s.XXXXXX", path) < 0)
+		return;
+
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto out;
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+
+	fprintf(fp, "%s\n", tag);
+	for (e = genl_families; e; e = e->next) {
+		fprintf(fp, "%s %u %u %u", e->fam.name, e->fam.id,
+			e->fam.version, e->fam.maxattr);
+		for (i = 0; i < e->fam.ngroups; i++)
+			fprintf(fp, " %s=%u", e->fam.groups[i].name,
+				e->fam.groups[i].id);
+		fprintf(fp, "\n");
+	}
+	if (fclose(fp) || rename(tmp, path))
+		unlink(tmp);
+out:
+	free(tmp);
+}
+
+static const struct mnlu_genl_family *
+genl_family_resolve(struct mnlu_gen_socket *nlg, const char *family_name)
+{
+	const struct mnlu_genl_family *cached;
+	struct mnlu_genl_family fam;
+
+	if (!genl_cache_loaded)
+		genl_cache_load();
+
+	cached = genl_cache_find(family_name);
+	if (cached)
+		return cached;
+
+	if (family_get(nlg, family_name, &fam))
+		return NULL;
+
+	cached = genl_cache_add(&fam);
+	if (cached)
+		genl_cache_save();
+	else
+		fprintf(stderr, "Not enough memory to cache genl family %s\n",
+			family_name);
+	return cached;
+}
+
+int mnlu_genl_family_group(const struct mnlu_genl_family *fam,
+			   const char *name, uint32_t *id)
+{
+	unsigned int i;
+
+	for (i = 0; i < fam->ngroups; i++) {
+		if (strcmp(fam->groups[i].name, name) == 0) {
+			*id = fam->groups[i].id;
+			return 0;
+		}
+	}
+	return -ENOENT;
+}
+
 int mnlu_gen_socket_open(struct mnlu_gen_socket *nlg, const char *family_name,
 			 uint8_t version)
 {
-	int err;
+	const struct mnlu_genl_family *fam;
 
 	nlg->buf = malloc(MNL_SOCKET_BUFFER_SIZE);
 	if (!nlg->buf)
@@ -199,11 +494,15 @@ int mnlu_gen_socket_open(struct mnlu_gen_socket *nlg, const char *family_name,
 		goto err_socket_open;
 
 	nlg->version = version;
+	nlg->batch = NULL;
 
-	err = family_get(nlg, family_name);
-	if (err)
+	fam = genl_family_resolve(nlg, family_name);
+	if (!fam)
 		goto err_socket;
 
+	nlg->fam = fam;
+	nlg->family = fam->id;
+	nlg->maxattr = fam->maxattr;
 	return 0;
 
 err_socket:
@@ -242,11 +541,31 @@ struct nlmsghdr *mnlu_gen_socket_cmd_prepare(struct mnlu_gen_socket *nlg,
 					    nlg->version);
 }
 
+/*
+ * Queued requests are sent before anything else is exchanged on the
+ * socket, so their acks are out of the way and the order is kept.
+ */
+int mnlu_gen_socket_batch_flush(struct mnlu_gen_socket *nlg)
+{
+	if (!nlg->batch)
+		return 0;
+	return rtnl_batch_flush(nlg->batch);
+}
+
 int mnlu_gen_socket_sndrcv(struct mnlu_gen_socket *nlg, const struct nlmsghdr *nlh,
 			   mnl_cb_t data_cb, void *data)
 {
 	int err;
 
+	/* in batch mode the cookie is the line, failures are reported by it */
+	if (nlg->batch && !data_cb)
+		return rtnl_batch_add(nlg->batch, (struct nlmsghdr *)nlh,
+				      cmdlineno);
+
+	err = mnlu_gen_socket_batch_flush(nlg);
+	if (err < 0)
+		return err;
+
 	err = mnl_socket_sendto(nlg->nl, nlh, nlh->nlmsg_len);
 	if (err < 0) {
 		perror("Failed to send data");
@@ -266,6 +585,8 @@ int mnlu_gen_socket_sndrcv(struct mnlu_gen_socket *nlg, const struct nlmsghdr *n
 int mnlu_gen_socket_recv_run(struct mnlu_gen_socket *nlg, mnl_cb_t cb,
 			     void *data)
 {
+	if (mnlu_gen_socket_batch_flush(nlg) < 0)
+		return -1;
 	return mnlu_socket_recv_run(nlg->nl, nlg->seq, nlg->buf,
 				    MNL_SOCKET_BUFFER_SIZE,
 				    cb, data);
@@ -20,6 +20,8 @@
 
 int mnlg_socket_send(struct mnlu_gen_socket *nlg, const struct nlmsghdr *nlh)
 {
+	if (mnlu_gen_socket_batch_flush(nlg) < 0)
+		return -1;
 	return mnl_socket_sendto(nlg->nl, nlh, nlh->nlmsg_len);
 }
 
@@ -108,6 +110,11 @@ int mnlg_socket_group_add(struct mnlu_gen_socket *nlg, const char *group_name)
 	struct group_info group_info;
 	int err;
 
+	/* usually known from resolving the family already */
+	if (nlg->fam &&
+	    !mnlu_genl_family_group(nlg->fam, group_name, &group_info.id))
+		goto add_membership;
+
 	nlh = _mnlu_gen_socket_cmd_prepare(nlg, CTRL_CMD_GETFAMILY,
 					   NLM_F_REQUEST | NLM_F_ACK,
 					   GENL_ID_CTRL, 1);
@@ -129,6 +136,7 @@ int mnlg_socket_group_add(struct mnlu_gen_socket *nlg, const char *group_name)
 		return -1;
 	}
 
+add_membership:
 	err = mnl_socket_setsockopt(nlg->nl, NETLINK_ADD_MEMBERSHIP,
 				    &group_info.id, sizeof(group_info.id));
 	if (err < 0)
@@ -63,6 +63,34 @@ struct db_names *db_names_alloc(void)
 	return db;
 }
 
+/* Keep the average chain length at most one as the database grows */
+static int db_names_grow(struct db_names *db)
+{
+	unsigned int i, size = db->size * 2;
+	struct db_entry **hash;
+
+	hash = calloc(size, sizeof(struct db_entry *));
+	if (!hash)
+		return -ENOMEM;
+
+	for (i = 0; i < db->size; i++) {
+		struct db_entry *entry = db->hash[i];
+
+		while (entry) {
+			struct db_entry *next = entry->next;
+
+			entry->next = hash[entry->id & (size - 1)];
+			hash[entry->id & (size - 1)] = entry;
+			entry = next;
+		}
+	}
+
+	free(db->hash);
+	db->hash = hash;
+	db->size = size;
+	return 0;
+}
+
 int db_names_load(struct db_names *db, const char *path)
 {
 	struct db_entry *entry;
@@ -86,6 +114,9 @@ int db_names_load(struct db_names *db, const char *path)
 		if (id < 0)
 			continue;
 
+		if (db->count >= db->size && db_names_grow(db))
+			goto Exit;
+
 		entry = malloc(sizeof(*entry));
 		if (!entry)
 			goto Exit;
@@ -99,6 +130,7 @@ int db_names_load(struct db_names *db, const char *path)
 		entry->id   = id;
 		entry->next = db->hash[id & (db->size - 1)];
 		db->hash[id & (db->size - 1)] = entry;
+		db->count++;
 	}
 	ret = 0;
 
@@ -97,6 +97,125 @@ rtnl_hash_initialize(const char *file, struct rtnl_hash_entry **hash, int size)
 	return 0;
 }
 
+/*
+ * Open addressing index over a loaded rtnl_hash_entry table.  The table
+ * itself only has 256 buckets, which makes lookups linear once
+ * thousands of table or group names are configured.  The index is
+ * built once after the files are read and keeps id and name lookups
+ * O(1); without it lookups fall back to walking the table.
+ */
+struct rtnl_hash_index {
+	struct rtnl_hash_entry	**hash;
+	int			hsize;
+	struct rtnl_hash_entry	**by_id;
+	struct rtnl_hash_entry	**by_name;
+	unsigned int		mask;
+};
+
+static unsigned int rtnl_name_hash(const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static unsigned int rtnl_id_hash(unsigned int id)
+{
+	return id * 0x9e3779b1u;
+}
+
+static void rtnl_hash_index_build(struct rtnl_hash_index *idx,
+				  struct rtnl_hash_entry **hash, int size)
+{
+	struct rtnl_hash_entry *entry;
+	unsigned int count = 0, nsize = 16, j;
+	int i;
+
+	idx->hash = hash;
+	idx->hsize = size;
+
+	for (i = 0; i < size; i++)
+		for (entry = hash[i]; entry; entry = entry->next)
+			count++;
+	while (nsize < 2 * count)
+		nsize <<= 1;
+
+	idx->by_id = calloc(nsize, sizeof(*idx->by_id));
+	idx->by_name = calloc(nsize, sizeof(*idx->by_name));
+	if (!idx->by_id || !idx->by_name) {
+		free(idx->by_id);
+		free(idx->by_name);
+		idx->by_id = idx->by_name = NULL;
+		return;
+	}
+	idx->mask = nsize - 1;
+
+	/* insert in walk order, so the first entry found wins as before */
+	for (i = 0; i < size; i++) {
+		for (entry = hash[i]; entry; entry = entry->next) {
+			j = rtnl_id_hash(entry->id) & idx->mask;
+			while (idx->by_id[j] && idx->by_id[j]->id != entry->id)
+				j = (j + 1) & idx->mask;
+			if (!idx->by_id[j])
+				idx->by_id[j] = entry;
+
+			j = rtnl_name_hash(entry->name) & idx->mask;
+			while (idx->by_name[j] &&
+			       strcmp(idx->by_name[j]->name, entry->name))
+				j = (j + 1) & idx->mask;
+			if (!idx->by_name[j])
+				idx->by_name[j] = entry;
+		}
+	}
+}
+
+static struct rtnl_hash_entry *
+rtnl_hash_index_id(const struct rtnl_hash_index *idx, unsigned int id)
+{
+	struct rtnl_hash_entry *entry;
+	unsigned int j;
+
+	if (!idx->by_id) {
+		entry = idx->hash[id & (idx->hsize - 1)];
+		while (entry && entry->id != id)
+			entry = entry->next;
+		return entry;
+	}
+
+	j = rtnl_id_hash(id) & idx->mask;
+	while ((entry = idx->by_id[j]) && entry->id != id)
+		j = (j + 1) & idx->mask;
+	return entry;
+}
+
+static struct rtnl_hash_entry *
+rtnl_hash_index_name(const struct rtnl_hash_index *idx, const char *name)
+{
+	struct rtnl_hash_entry *entry;
+	unsigned int j;
+	int i;
+
+	if (!idx->by_name) {
+		for (i = 0; i < idx->hsize; i++) {
+			entry = idx->hash[i];
+			while (entry && strcmp(entry->name, name))
+				entry = entry->next;
+			if (entry)
+				return entry;
+		}
+		return NULL;
+	}
+
+	j = rtnl_name_hash(name) & idx->mask;
+	while ((entry = idx->by_name[j]) && strcmp(entry->name, name))
+		j = (j + 1) & idx->mask;
+	return entry;
+}
+
 static int rtnl_tab_initialize(const char *file, char **tab, int size)
 {
 	FILE *fp;
@@ -514,6 +633,7 @@ static struct rtnl_hash_entry *rtnl_rttable_hash[256] = {
 };
 
 static int rtnl_rttable_init;
+static struct rtnl_hash_index rtnl_rttable_index;
 
 static void rtnl_rttable_initialize(void)
 {
@@ -532,6 +652,8 @@ static void rtnl_rttable_initialize(void)
 				     rtnl_rttable_hash, 256);
 
 	rtnl_hash_initialize_dir("rt_tables.d", rtnl_rttable_hash, 256);
+
+	rtnl_hash_index_build(&rtnl_rttable_index, rtnl_rttable_hash, 256);
 }
 
 const char *rtnl_rttable_n2a(__u32 id, char *buf, int len)
@@ -540,9 +662,7 @@ const char *rtnl_rttable_n2a(__u32 id, char *buf, int len)
 
 	if (!rtnl_rttable_init)
 		rtnl_rttable_initialize();
-	entry = rtnl_rttable_hash[id & 255];
-	while (entry && entry->id != id)
-		entry = entry->next;
+	entry = rtnl_hash_index_id(&rtnl_rttable_index, id);
 	if (!numeric && entry)
 		return entry->name;
 	snprintf(buf, len, "%u", id);
@@ -565,16 +685,12 @@ int rtnl_rttable_a2n(__u32 *id, const char *arg)
 	if (!rtnl_rttable_init)
 		rtnl_rttable_initialize();
 
-	for (i = 0; i < 256; i++) {
-		entry = rtnl_rttable_hash[i];
-		while (entry && strcmp(entry->name, arg))
-			entry = entry->next;
-		if (entry) {
-			cache = entry->name;
-			res = entry->id;
-			*id = res;
-			return 0;
-		}
+	entry = rtnl_hash_index_name(&rtnl_rttable_index, arg);
+	if (entry) {
+		cache = entry->name;
+		res = entry->id;
+		*id = res;
+		return 0;
 	}
 
 	i = strtoul(arg, &end, 0);
@@ -697,6 +813,7 @@ static struct rtnl_hash_entry *rtnl_group_hash[256] = {
 };
 
 static int rtnl_group_init;
+static struct rtnl_hash_index rtnl_group_index;
 
 static void rtnl_group_initialize(void)
 {
@@ -708,6 +825,8 @@ static void rtnl_group_initialize(void)
 	if (ret == -ENOENT)
 		rtnl_hash_initialize(CONF_USR_DIR "/group",
 				     rtnl_group_hash, 256);
+
+	rtnl_hash_index_build(&rtnl_group_index, rtnl_group_hash, 256);
 }
 
 int rtnl_group_a2n(int *id, const char *arg)
@@ -726,16 +845,12 @@ int rtnl_group_a2n(int *id, const char *arg)
 	if (!rtnl_group_init)
 		rtnl_group_initialize();
 
-	for (i = 0; i < 256; i++) {
-		entry = rtnl_group_hash[i];
-		while (entry && strcmp(entry->name, arg))
-			entry = entry->next;
-		if (entry) {
-			cache = entry->name;
-			res = entry->id;
-			*id = res;
-			return 0;
-		}
+	entry = rtnl_hash_index_name(&rtnl_group_index, arg);
+	if (entry) {
+		cache = entry->name;
+		res = entry->id;
+		*id = res;
+		return 0;
 	}
 
 	i = strtol(arg, &end, 0);
@@ -748,20 +863,13 @@ int rtnl_group_a2n(int *id, const char *arg)
 const char *rtnl_group_n2a(int id, char *buf, int len)
 {
 	struct rtnl_hash_entry *entry;
-	int i;
 
 	if (!rtnl_group_init)
 		rtnl_group_initialize();
 
-	for (i = 0; !numeric && i < 256; i++) {
-		entry = rtnl_group_hash[i];
-
-		while (entry) {
-			if (entry->id == id)
-				return entry->name;
-			entry = entry->next;
-		}
-	}
+	entry = rtnl_hash_index_id(&rtnl_group_index, id);
+	if (!numeric && entry)
+		return entry->name;
 
 	snprintf(buf, len, "%d", id);
 	return buf;
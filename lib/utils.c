@@ -27,6 +27,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <setjmp.h>
 #ifdef HAVE_LIBCAP
 #include <sys/capability.h>
 #endif
@@ -39,6 +40,7 @@
 int resolve_hosts;
 int timestamp_short;
 int pretty;
+int cbor;
 int use_iec;
 int human_readable;
 const char *_SL_ = "\n";
@@ -807,22 +809,36 @@ __u32 get_addr32(const char *name)
 	return addr.data[0];
 }
 
+/* set while do_batch_rtnl() runs a line */
+static jmp_buf *batch_line_jmp;
+
+/*
+ * Exit on a command line error; in do_batch_rtnl() only the line fails,
+ * so that the requests queued before it are still sent.
+ */
+void parse_exit(int status)
+{
+	if (batch_line_jmp)
+		longjmp(*batch_line_jmp, 1);
+	exit(status);
+}
+
 void incomplete_command(void)
 {
 	fprintf(stderr, "Command line is not complete. Try option \"help\"\n");
-	exit(-1);
+	parse_exit(-1);
 }
 
 void missarg(const char *key)
 {
 	fprintf(stderr, "Error: argument \"%s\" is required\n", key);
-	exit(-1);
+	parse_exit(-1);
 }
 
 void invarg(const char *msg, const char *arg)
 {
 	fprintf(stderr, "Error: argument \"%s\" is wrong: %s\n", arg, msg);
-	exit(-1);
+	parse_exit(-1);
 }
 
 void duparg(const char *key, const char *arg)
@@ -830,7 +846,7 @@ void duparg(const char *key, const char *arg)
 	fprintf(stderr,
 		"Error: duplicate \"%s\": \"%s\" is the second value.\n",
 		key, arg);
-	exit(-1);
+	parse_exit(-1);
 }
 
 void duparg2(const char *key, const char *arg)
@@ -838,7 +854,7 @@ void duparg2(const char *key, const char *arg)
 	fprintf(stderr,
 		"Error: either \"%s\" is duplicate, or \"%s\" is garbage.\n",
 		key, arg);
-	exit(-1);
+	parse_exit(-1);
 }
 
 int nodev(const char *dev)
@@ -1276,23 +1292,30 @@ void print_escape_buf(const __u8 *buf, size_t len, const char *escape)
 int print_timestamp(FILE *fp)
 {
 	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return print_timestamp_tv(fp, &tv);
+}
+
+int print_timestamp_tv(FILE *fp, const struct timeval *tv)
+{
 	struct tm *tm;
 	char ts[40];
 
-	gettimeofday(&tv, NULL);
-	tm = localtime(&tv.tv_sec);
+	tm = localtime(&tv->tv_sec);
 
 	if (timestamp_short) {
 		size_t len;
 
 		len = strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", tm);
-		snprintf(ts + len, sizeof(ts) - len, ".%06ld", tv.tv_usec);
+		snprintf(ts + len, sizeof(ts) - len, ".%06ld",
+			 (long)tv->tv_usec);
 		print_string(PRINT_ANY, "timestamp_short", "[%s] ", ts);
 	} else {
 		char *tstr = asctime(tm);
 
 		tstr[strlen(tstr)-1] = 0;
-		snprintf(ts, sizeof(ts), "%s %ld usec", tstr, tv.tv_usec);
+		snprintf(ts, sizeof(ts), "%s %ld usec", tstr, (long)tv->tv_usec);
 		print_string(PRINT_ANY, "timestamp", "Timestamp: %s\n", ts);
 	}
 
@@ -1740,24 +1763,19 @@ char *sprint_time64(__s64 time, char *buf)
 	return buf;
 }
 
-int do_batch(const char *name, bool force,
-	     int (*cmd)(int argc, char *argv[], void *data), void *data)
+/*
+ * Run cmd for every line of an already open file.  Unlike do_batch()
+ * this leaves stdin alone, so it can be used from within a batch.
+ */
+int do_batch_fp(FILE *in, const char *name, bool force,
+		int (*cmd)(int argc, char *argv[], void *data), void *data)
 {
 	char *line = NULL;
 	size_t len = 0;
 	int ret = EXIT_SUCCESS;
 
-	if (name && strcmp(name, "-") != 0) {
-		if (freopen(name, "r", stdin) == NULL) {
-			fprintf(stderr,
-				"Cannot open file \"%s\" for reading: %s\n",
-				name, strerror(errno));
-			return EXIT_FAILURE;
-		}
-	}
-
 	cmdlineno = 0;
-	while (getcmdline(&line, &len, stdin) != -1) {
+	while (getcmdline(&line, &len, in) != -1) {
 		char *largv[MAX_ARGS];
 		int largc;
 
@@ -1779,6 +1797,158 @@ int do_batch(const char *name, bool force,
 	return ret;
 }
 
+int do_batch(const char *name, bool force,
+	     int (*cmd)(int argc, char *argv[], void *data), void *data)
+{
+	if (name && strcmp(name, "-") != 0) {
+		if (freopen(name, "r", stdin) == NULL) {
+			fprintf(stderr,
+				"Cannot open file \"%s\" for reading: %s\n",
+				name, strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	return do_batch_fp(stdin, name, force, cmd, data);
+}
+
+/*
+ * Print how many of the lines read from name failed, counting both the
+ * lines rejected before anything was sent and the failed requests.
+ */
+int batch_report(const char *name, const char *what, __u64 failed,
+		 __u64 total)
+{
+	if (!failed)
+		return 0;
+	fprintf(stderr, "%s: %llu of %llu %s failed\n", name,
+		(unsigned long long)failed, (unsigned long long)total, what);
+	return -1;
+}
+
+struct batch_rtnl_line {
+	int	(*cmd)(int argc, char *argv[], void *data);
+	void	*data;
+	int	failed;
+};
+
+static int batch_rtnl_line(int argc, char *argv[], void *data)
+{
+	struct batch_rtnl_line *line = data;
+	jmp_buf jb;
+	int ret;
+
+	if (setjmp(jb)) {
+		batch_line_jmp = NULL;
+		line->failed++;
+		return -1;
+	}
+	batch_line_jmp = &jb;
+	ret = line->cmd(argc, argv, line->data);
+	batch_line_jmp = NULL;
+	if (ret)
+		line->failed++;
+	return ret;
+}
+
+/*
+ * do_batch_fp() for commands that queue requests or answer them as they
+ * go: a command line error fails only its line instead of exiting, so
+ * the work of the other lines is not lost.  Returns the number of lines
+ * that failed.
+ */
+int do_batch_fp_rtnl(FILE *fp, const char *name,
+		     int (*cmd)(int argc, char *argv[], void *data),
+		     void *data)
+{
+	struct batch_rtnl_line line = { .cmd = cmd, .data = data };
+
+	do_batch_fp(fp, name, true, batch_rtnl_line, &line);
+	return line.failed;
+}
+
+/*
+ * Run cmd for every line of file name ("-" for stdin) with a request
+ * batch as its data argument, so requests it queues with
+ * rtnl_batch_add() are sent in bulk.  Failures are reported per line.
+ */
+int do_batch_rtnl(struct rtnl_handle *rth, const char *name,
+		  int (*cmd)(int argc, char *argv[], void *batch))
+{
+	struct rtnl_batch batch;
+	int saved_lineno = cmdlineno;
+	FILE *fp = stdin;
+	int ret, failed;
+
+	if (strcmp(name, "-") != 0) {
+		fp = fopen(name, "r");
+		if (!fp) {
+			fprintf(stderr,
+				"Cannot open file \"%s\" for reading: %s\n",
+				name, strerror(errno));
+			return -1;
+		}
+	}
+
+	if (rtnl_batch_init(&batch, rth, rtnl_batch_report_line,
+			    (void *)name) < 0) {
+		ret = -1;
+		goto out;
+	}
+
+	failed = do_batch_fp_rtnl(fp, name, cmd, &batch);
+	ret = rtnl_batch_flush(&batch) < 0 ? -1 : 0;
+	if (batch_report(name, "requests", batch.errors + failed,
+			 batch.sent + failed))
+		ret = -1;
+
+	rtnl_batch_free(&batch);
+out:
+	if (fp != stdin)
+		fclose(fp);
+	cmdlineno = saved_lineno;
+	return ret;
+}
+
+void bulk_progress_init(struct bulk_progress *p, const char *what)
+{
+	p->what = what;
+	clock_gettime(CLOCK_MONOTONIC, &p->start);
+	p->last = p->start;
+}
+
+static __u64 bulk_rate(__u64 done, long ms)
+{
+	return ms > 0 ? done * 1000 / ms : done;
+}
+
+/* report at most once per second */
+void bulk_progress_update(struct bulk_progress *p, __u64 done, __u64 total)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (timespec_diff_ms(&now, &p->last) < 1000)
+		return;
+	p->last = now;
+
+	fprintf(stderr, "%s: %llu of %llu (%llu/s)\n", p->what,
+		done, total, bulk_rate(done, timespec_diff_ms(&now, &p->start)));
+}
+
+void bulk_progress_done(struct bulk_progress *p, __u64 done, __u64 failed)
+{
+	struct timespec now;
+	long ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = timespec_diff_ms(&now, &p->start);
+
+	fprintf(stderr, "%s: %llu done, %llu failed in %ld.%03lds (%llu/s)\n",
+		p->what, done, failed, ms / 1000, ms % 1000,
+		bulk_rate(done, ms));
+}
+
 static int
 __parse_one_of(const char *msg, const char *realval,
 	       const char * const *list, size_t len, int *p_err,
@@ -13,9 +13,13 @@
 #include <math.h>
 #include <malloc.h>
 #include <string.h>
+#include <unistd.h>
+#include <endian.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include "netem_dist.h"
+
 
 double *
 readdoubles(FILE *fp, int *number)
@@ -77,6 +81,7 @@ arraystats(double *x, int limit, double *mu, double *sigma, double *rho)
  */
 
 #define TABLESIZE	16384/4
+#define TABLEMAX	16384	/* NETEM_DIST_MAX in the kernel */
 #define TABLEFACTOR	8192
 #ifndef MINSHORT
 #define MINSHORT	-32768
@@ -195,6 +200,48 @@ printtable(const short *table, int limit)
 	}
 }
 
+/* Write the table in the binary format described in netem_dist.h */
+static void
+writetable(const short *table, int limit)
+{
+	struct netem_bdist_hdr hdr;
+	uint16_t *data;
+	int i;
+
+	data = malloc(limit * sizeof(*data));
+	if (!data) {
+		perror("table alloc");
+		exit(3);
+	}
+	for (i = 0; i < limit; ++i)
+		data[i] = htole16((uint16_t)table[i]);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = htole32(NETEM_BDIST_MAGIC);
+	hdr.version = htole16(NETEM_BDIST_VERSION);
+	hdr.size = htole32(limit);
+	hdr.csum = htole32(netem_bdist_csum(data, limit * sizeof(*data)));
+
+	if (fwrite(&hdr, sizeof(hdr), 1, stdout) != 1 ||
+	    fwrite(data, sizeof(*data), limit, stdout) != (size_t)limit ||
+	    fflush(stdout)) {
+		perror("write");
+		exit(4);
+	}
+	free(data);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: maketable [ -b ] [ -s SIZE ] [ FILE ]\n"
+		"	-b	write a binary table (NAME.bdist) instead of text\n"
+		"	-s	number of table entries (default %d, max %d)\n",
+		TABLESIZE, TABLEMAX);
+	exit(1);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -205,10 +252,28 @@ main(int argc, char **argv)
 	int *table;
 	short *inverse;
 	int total;
+	int tablesize = TABLESIZE;
+	int binary = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "bs:")) != -1) {
+		switch (opt) {
+		case 'b':
+			binary = 1;
+			break;
+		case 's':
+			tablesize = atoi(optarg);
+			if (tablesize <= 0 || tablesize > TABLEMAX)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
 
-	if (argc > 1) {
-		if (!(fp = fopen(argv[1], "r"))) {
-			perror(argv[1]);
+	if (optind < argc) {
+		if (!(fp = fopen(argv[optind], "r"))) {
+			perror(argv[optind]);
 			exit(1);
 		}
 	} else {
@@ -228,8 +293,11 @@ main(int argc, char **argv)
 	table = makedist(x, limit, mu, sigma);
 	free((void *) x);
 	cumulativedist(table, DISTTABLESIZE, &total);
-	inverse = inverttable(table, TABLESIZE, DISTTABLESIZE, total);
-	interpolatetable(inverse, TABLESIZE);
-	printtable(inverse, TABLESIZE);
+	inverse = inverttable(table, tablesize, DISTTABLESIZE, total);
+	interpolatetable(inverse, tablesize);
+	if (binary)
+		writetable(inverse, tablesize);
+	else
+		printtable(inverse, tablesize);
 	return 0;
 }
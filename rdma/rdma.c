@@ -16,7 +16,7 @@ static void help(char *name)
 	pr_out("Usage: %s [ OPTIONS ] OBJECT { COMMAND | help }\n"
 	       "       %s [ -f[orce] ] -b[atch] filename\n"
 	       "where  OBJECT := { dev | link | resource | monitor | system | statistic | help }\n"
-	       "       OPTIONS := { -V[ersion] | -d[etails] | -j[son] | -p[retty] | -r[aw]}\n", name, name);
+	       "       OPTIONS := { -V[ersion] | -d[etails] | -j[son] | --cbor | -p[retty] | -r[aw]}\n", name, name);
 }
 
 static int cmd_help(struct rd *rd)
@@ -84,12 +84,15 @@ static void rd_cleanup(struct rd *rd)
 	rd_free(rd);
 }
 
+#define OPT_CBOR 256
+
 int main(int argc, char **argv)
 {
 	static const struct option long_options[] = {
 		{ "version",		no_argument,		NULL, 'V' },
 		{ "help",		no_argument,		NULL, 'h' },
 		{ "json",		no_argument,		NULL, 'j' },
+		{ "cbor",		no_argument,		NULL, OPT_CBOR },
 		{ "oneline",		no_argument,            NULL, 'o' },
 		{ "pretty",		no_argument,		NULL, 'p' },
 		{ "details",		no_argument,		NULL, 'd' },
@@ -135,6 +138,10 @@ int main(int argc, char **argv)
 		case 'j':
 			++json;
 			break;
+		case OPT_CBOR:
+			++json;
+			++cbor;
+			break;
 		case 'f':
 			force = true;
 			break;
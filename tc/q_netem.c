@@ -15,10 +15,14 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <errno.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "utils.h"
 #include "tc_util.h"
 #include "tc_common.h"
+#include "netem_dist.h"
 
 static void explain(void)
 {
@@ -45,10 +49,10 @@ static void explain1(const char *arg)
 	fprintf(stderr, "Illegal \"%s\"\n", arg);
 }
 
-/* Upper bound on size of distribution
- *  really (TCA_BUF_MAX - other headers) / sizeof (__s16)
+/* Upper bound on size of distribution, the kernel limit.
+ * A full size table uses half of the TCA_BUF_MAX request buffer.
  */
-#define MAX_DIST	(16*1024)
+#define MAX_DIST	NETEM_DIST_MAX
 
 /* Print values only if they are non-zero */
 static void __attribute__((format(printf, 2, 0)))
@@ -122,22 +126,13 @@ static void print_corr(bool present, __u32 value)
  *	# comment line(s)
  *	data0 data1 ...
  */
-static int get_distribution(const char *type, __s16 *data, int maxdata)
+static int get_text_distribution(const char *name, FILE *f,
+				 __s16 *data, int maxdata)
 {
-	FILE *f;
 	int n;
 	long x;
 	size_t len;
 	char *line = NULL;
-	char name[128];
-
-	snprintf(name, sizeof(name), "%s/%s.dist", get_tc_lib(), type);
-	f = fopen(name, "r");
-	if (f == NULL) {
-		fprintf(stderr, "No distribution data for %s (%s: %s)\n",
-			type, name, strerror(errno));
-		return -1;
-	}
 
 	n = 0;
 	while (getline(&line, &len, f) != -1) {
@@ -162,10 +157,141 @@ static int get_distribution(const char *type, __s16 *data, int maxdata)
 	}
  error:
 	free(line);
-	fclose(f);
 	return n;
 }
 
+/*
+ * Binary distribution table written by "maketable -b",
+ * see netem_dist.h for the format.
+ */
+static int get_binary_distribution(const char *name, int fd,
+				   __s16 *data, int maxdata)
+{
+	const struct netem_bdist_hdr *hdr;
+	const __u16 *ent;
+	struct stat st;
+	__u32 size;
+	void *map;
+	int i, n = -1;
+
+	if (fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		return -1;
+	}
+	if (st.st_size < sizeof(*hdr)) {
+		fprintf(stderr, "%s: truncated distribution table\n", name);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap failed: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	hdr = map;
+	size = le32toh(hdr->size);
+	ent = (const __u16 *)(hdr + 1);
+
+	if (le32toh(hdr->magic) != NETEM_BDIST_MAGIC ||
+	    le16toh(hdr->version) != NETEM_BDIST_VERSION) {
+		fprintf(stderr, "%s: not a netem distribution table\n", name);
+		goto out;
+	}
+	if (size == 0 || size > maxdata) {
+		fprintf(stderr, "%s: invalid table size %u (max %d)\n",
+			name, size, maxdata);
+		goto out;
+	}
+	if (st.st_size < sizeof(*hdr) + size * sizeof(*ent)) {
+		fprintf(stderr, "%s: truncated distribution table\n", name);
+		goto out;
+	}
+	if (netem_bdist_csum(ent, size * sizeof(*ent)) != le32toh(hdr->csum)) {
+		fprintf(stderr, "%s: checksum mismatch\n", name);
+		goto out;
+	}
+
+	for (i = 0; i < size; i++)
+		data[i] = (__s16)le16toh(ent[i]);
+	n = size;
+out:
+	munmap(map, st.st_size);
+	return n;
+}
+
+/*
+ * Distributions already loaded by this process, so that a batch
+ * configuring many qdiscs with the same table reads it only once.
+ */
+struct netem_dist {
+	struct netem_dist	*next;
+	char			*type;
+	int			size;
+	__s16			data[];
+};
+
+static struct netem_dist *dist_cache;
+
+/*
+ * Look up distribution TYPE, preferring the binary TYPE.bdist table
+ * over the text TYPE.dist one.  Returns the cached table, which must
+ * not be freed by the caller.
+ */
+static const __s16 *get_distribution(const char *type, int *size)
+{
+	struct netem_dist *d;
+	char name[128];
+	FILE *f;
+	int fd, n;
+
+	for (d = dist_cache; d; d = d->next) {
+		if (strcmp(d->type, type) == 0) {
+			*size = d->size;
+			return d->data;
+		}
+	}
+
+	d = calloc(1, sizeof(*d) + MAX_DIST * sizeof(d->data[0]));
+	if (!d)
+		return NULL;
+
+	snprintf(name, sizeof(name), "%s/%s.bdist", get_tc_lib(), type);
+	fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		n = get_binary_distribution(name, fd, d->data, MAX_DIST);
+		close(fd);
+	} else {
+		snprintf(name, sizeof(name), "%s/%s.dist", get_tc_lib(), type);
+		f = fopen(name, "r");
+		if (f == NULL) {
+			fprintf(stderr, "No distribution data for %s (%s: %s)\n",
+				type, name, strerror(errno));
+			free(d);
+			return NULL;
+		}
+		n = get_text_distribution(name, f, d->data, MAX_DIST);
+		fclose(f);
+	}
+
+	if (n <= 0) {
+		free(d);
+		return NULL;
+	}
+
+	d->type = strdup(type);
+	if (!d->type) {
+		free(d);
+		return NULL;
+	}
+	d->size = n;
+	d->next = dist_cache;
+	dist_cache = d;
+
+	*size = n;
+	return d->data;
+}
+
 #define NEXT_IS_NUMBER() (NEXT_ARG_OK() && isdigit(argv[1][0]))
 #define NEXT_IS_SIGNED_NUMBER() \
 	(NEXT_ARG_OK() && (isdigit(argv[1][0]) || argv[1][0] == '-'))
@@ -185,8 +311,8 @@ static int netem_parse_opt(const struct qdisc_util *qu, int argc, char **argv,
 	struct tc_netem_gemodel gemodel;
 	struct tc_netem_rate rate = {};
 	struct tc_netem_slot slot = {};
-	__s16 *dist_data = NULL;
-	__s16 *slot_dist_data = NULL;
+	const __s16 *dist_data = NULL;
+	const __s16 *slot_dist_data = NULL;
 	__u16 loss_type = NETEM_LOSS_UNSPEC;
 	int present[__TCA_NETEM_MAX] = {};
 	__s64 latency64 = 0;
@@ -414,15 +540,9 @@ random_loss_model:
 			}
 		} else if (matches(*argv, "distribution") == 0) {
 			NEXT_ARG();
-			dist_data = calloc(MAX_DIST, sizeof(dist_data[0]));
+			dist_data = get_distribution(*argv, &dist_size);
 			if (dist_data == NULL)
 				return -1;
-
-			dist_size = get_distribution(*argv, dist_data, MAX_DIST);
-			if (dist_size <= 0) {
-				free(dist_data);
-				return -1;
-			}
 		} else if (matches(*argv, "rate") == 0) {
 			++present[TCA_NETEM_RATE];
 			NEXT_ARG();
@@ -479,14 +599,9 @@ random_loss_model:
 				if (strcmp(*argv, "distribution") == 0) {
 					present[TCA_NETEM_SLOT] = 1;
 					NEXT_ARG();
-					slot_dist_data = calloc(MAX_DIST, sizeof(slot_dist_data[0]));
+					slot_dist_data = get_distribution(*argv, &slot_dist_size);
 					if (!slot_dist_data)
 						return -1;
-					slot_dist_size = get_distribution(*argv, slot_dist_data, MAX_DIST);
-					if (slot_dist_size <= 0) {
-						free(slot_dist_data);
-						return -1;
-					}
 					NEXT_ARG();
 					if (get_time64(&slot.dist_delay, *argv)) {
 						explain1("slot delay");
@@ -640,19 +755,17 @@ random_loss_model:
 
 
 	if (dist_data) {
-		if (addattr_l(n, MAX_DIST * sizeof(dist_data[0]),
+		if (addattr_l(n, TCA_BUF_MAX,
 			      TCA_NETEM_DELAY_DIST,
 			      dist_data, dist_size * sizeof(dist_data[0])) < 0)
 			return -1;
-		free(dist_data);
 	}
 
 	if (slot_dist_data) {
-		if (addattr_l(n, MAX_DIST * sizeof(slot_dist_data[0]),
+		if (addattr_l(n, TCA_BUF_MAX,
 			      TCA_NETEM_SLOT_DIST,
 			      slot_dist_data, slot_dist_size * sizeof(slot_dist_data[0])) < 0)
 			return -1;
-		free(slot_dist_data);
 	}
 	tail->rta_len = (void *) NLMSG_TAIL(n) - (void *) tail;
 	return 0;
@@ -194,7 +194,7 @@ static void usage(void)
 		"where  OBJECT := { qdisc | class | filter | chain |\n"
 		"		    action | monitor | exec }\n"
 		"       OPTIONS := { -V[ersion] | -s[tatistics] | -d[etails] | -r[aw] |\n"
-		"		    -o[neline] | -j[son] | -p[retty] | -c[olor]\n"
+		"		    -o[neline] | -j[son] | -cbor | -p[retty] | -c[olor]\n"
 		"		    -b[atch] [filename] | -n[etns] name | -N[umeric] |\n"
 		"		     -nm | -nam[es] | { -cf | -conf } path\n"
 		"		     -br[ief] | -echo }\n");
@@ -311,6 +311,9 @@ int main(int argc, char **argv)
 			++timestamp_short;
 		} else if (matches(argv[1], "-json") == 0) {
 			++json;
+		} else if (strcmp(argv[1], "-cbor") == 0) {
+			++json;
+			++cbor;
 		} else if (matches(argv[1], "-oneline") == 0) {
 			++oneline;
 		} else if (matches(argv[1], "-brief") == 0) {
@@ -330,12 +333,19 @@ int main(int argc, char **argv)
 
 	check_enable_color(color, json);
 
-	if (batch_file)
-		return batch(batch_file);
+	/* class names are loaded once and shared by all batch commands */
+	if (use_names && cls_names_init(conf_file))
+		return -1;
+
+	if (batch_file) {
+		ret = batch(batch_file);
+		goto Exit;
+	}
 
 	if (argc <= 1) {
 		usage();
-		return 0;
+		ret = 0;
+		goto Exit;
 	}
 
 	tc_core_init();
@@ -344,15 +354,9 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	if (use_names && cls_names_init(conf_file)) {
-		ret = -1;
-		goto Exit;
-	}
-
 	ret = do_cmd(argc-1, argv+1);
-Exit:
 	rtnl_close(&rth);
-
+Exit:
 	if (use_names)
 		cls_names_uninit();
 
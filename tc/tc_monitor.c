@@ -16,6 +16,7 @@
 #include <time.h>
 #include "rt_names.h"
 #include "utils.h"
+#include "hashtab.h"
 #include "tc_util.h"
 #include "tc_common.h"
 
@@ -24,10 +25,248 @@ static void usage(void) __attribute__((noreturn));
 
 static void usage(void)
 {
-	fprintf(stderr, "Usage: tc [-timestamp [-tshort] monitor\n");
+	fprintf(stderr,
+		"Usage: tc [-timestamp [-tshort] monitor [ file FILE ]\n"
+		"                                        [ summary [ interval MSECS ] ]\n");
 	exit(-1);
 }
 
+/*
+ * Summary mode: instead of printing every event, classify it into
+ * counters and coalesce repeated events for the same object.  The
+ * counters are printed and reset once per interval.
+ */
+enum {
+	MON_QDISC,
+	MON_CLASS,
+	MON_FILTER,
+	MON_CHAIN,
+	MON_ACTION,
+	MON_KIND_MAX,
+};
+
+static const char * const mon_kind_names[MON_KIND_MAX] = {
+	[MON_QDISC]	= "qdisc",
+	[MON_CLASS]	= "class",
+	[MON_FILTER]	= "filter",
+	[MON_CHAIN]	= "chain",
+	[MON_ACTION]	= "action",
+};
+
+struct mon_obj {
+	__u32	kind;
+	__s32	ifindex;
+	__u32	parent;
+	__u32	handle;
+	__u32	info;
+	__u32	chain;
+	__u32	count;	/* not part of the key */
+};
+
+struct mon_summary {
+	unsigned int	interval;
+	__u64		events;
+	__u64		coalesced;
+	__u64		overruns;
+	__u64		new[MON_KIND_MAX];
+	__u64		del[MON_KIND_MAX];
+
+	struct hashtab	objs;
+	struct hashtab	devs;
+	struct hashtab	chains;
+};
+
+static void mon_summary_init(struct mon_summary *s)
+{
+	hashtab_init(&s->objs, sizeof(struct mon_obj),
+		     offsetof(struct mon_obj, count));
+	hashtab_counter_init(&s->devs);
+	hashtab_counter_init(&s->chains);
+}
+
+static void mon_oom(void)
+{
+	fprintf(stderr, "tc monitor: out of memory\n");
+	exit(1);
+}
+
+static void mon_obj_add(struct mon_summary *s, const struct mon_obj *key)
+{
+	struct mon_obj *slot;
+	bool found;
+
+	slot = hashtab_insert(&s->objs, key, &found);
+	if (!slot)
+		mon_oom();
+	if (found)
+		s->coalesced++;
+	slot->count++;
+}
+
+static void mon_counter_inc(struct hashtab *t, __u32 key)
+{
+	if (hashtab_count(t, key))
+		mon_oom();
+}
+
+static void mon_summary_reset(struct mon_summary *s)
+{
+	s->events = s->coalesced = s->overruns = 0;
+	memset(s->new, 0, sizeof(s->new));
+	memset(s->del, 0, sizeof(s->del));
+	hashtab_reset(&s->objs);
+	hashtab_reset(&s->devs);
+	hashtab_reset(&s->chains);
+}
+
+static int accept_tcmsg_summary(struct rtnl_ctrl_data *ctrl,
+				struct nlmsghdr *n, void *arg)
+{
+	struct mon_summary *s = arg;
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct rtattr *tb[TCA_MAX + 1];
+	struct mon_obj key = {};
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	bool del;
+
+	switch (n->nlmsg_type) {
+	case RTM_NEWQDISC:
+	case RTM_DELQDISC:
+		key.kind = MON_QDISC;
+		break;
+	case RTM_NEWTCLASS:
+	case RTM_DELTCLASS:
+		key.kind = MON_CLASS;
+		break;
+	case RTM_NEWTFILTER:
+	case RTM_DELTFILTER:
+		key.kind = MON_FILTER;
+		break;
+	case RTM_NEWCHAIN:
+	case RTM_DELCHAIN:
+		key.kind = MON_CHAIN;
+		break;
+	case RTM_NEWACTION:
+	case RTM_DELACTION:
+	case RTM_GETACTION:
+		/* actions have no per-object key in the header */
+		s->events++;
+		if (n->nlmsg_type == RTM_DELACTION)
+			s->del[MON_ACTION]++;
+		else
+			s->new[MON_ACTION]++;
+		return 0;
+	default:
+		return 0;
+	}
+
+	if (len < 0)
+		return 0;
+
+	del = n->nlmsg_type == RTM_DELQDISC ||
+	      n->nlmsg_type == RTM_DELTCLASS ||
+	      n->nlmsg_type == RTM_DELTFILTER ||
+	      n->nlmsg_type == RTM_DELCHAIN;
+
+	s->events++;
+	if (del)
+		s->del[key.kind]++;
+	else
+		s->new[key.kind]++;
+
+	key.ifindex = t->tcm_ifindex;
+	key.parent = t->tcm_parent;
+	key.handle = t->tcm_handle;
+	key.info = t->tcm_info;
+
+	mon_counter_inc(&s->devs, t->tcm_ifindex);
+
+	if (key.kind == MON_FILTER || key.kind == MON_CHAIN) {
+		parse_rtattr(tb, TCA_MAX, TCA_RTA(t), len);
+		if (tb[TCA_CHAIN])
+			key.chain = rta_getattr_u32(tb[TCA_CHAIN]);
+		mon_counter_inc(&s->chains, key.chain);
+	}
+
+	mon_obj_add(s, &key);
+	return 0;
+}
+
+static void print_mon_summary(struct mon_summary *s)
+{
+	struct hashtab_counter *c;
+	unsigned int i, n;
+
+	new_json_obj_plain(json);
+	open_json_object(NULL);
+
+	if (timestamp)
+		print_timestamp(stdout);
+
+	/* 0 for the summary of a whole file */
+	if (s->interval)
+		print_uint(PRINT_ANY, "interval_ms", "interval %ums ",
+			   s->interval);
+	print_u64(PRINT_ANY, "events", "events %llu", s->events);
+	print_u64(PRINT_ANY, "objects", " objects %llu",
+		  s->events - s->coalesced);
+	print_u64(PRINT_ANY, "coalesced", " coalesced %llu", s->coalesced);
+	print_u64(PRINT_ANY, "overruns", " overruns %llu", s->overruns);
+	if (s->overruns)
+		print_string(PRINT_FP, NULL, "%s", " (events lost)");
+	print_nl();
+
+	open_json_object("types");
+	for (i = 0; i < MON_KIND_MAX; i++) {
+		if (!s->new[i] && !s->del[i])
+			continue;
+		open_json_object(mon_kind_names[i]);
+		print_string(PRINT_FP, NULL, "  %s:", mon_kind_names[i]);
+		print_u64(PRINT_ANY, "new", " new %llu", s->new[i]);
+		print_u64(PRINT_ANY, "del", " del %llu", s->del[i]);
+		print_nl();
+		close_json_object();
+	}
+	close_json_object();
+
+	/* sorting leaves the counter tables empty */
+	open_json_array(PRINT_JSON, "devices");
+	n = hashtab_sort(&s->devs, hashtab_counter_cmp);
+	for (c = (struct hashtab_counter *)s->devs.slots; n; n--, c++) {
+		open_json_object(NULL);
+		print_string(PRINT_ANY, "dev", "  dev %s:",
+			     c->key ? ll_index_to_name(c->key) : "none");
+		print_u64(PRINT_ANY, "events", " %llu", c->count);
+		print_nl();
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+
+	open_json_array(PRINT_JSON, "chains");
+	n = hashtab_sort(&s->chains, hashtab_counter_cmp);
+	for (c = (struct hashtab_counter *)s->chains.slots; n; n--, c++) {
+		open_json_object(NULL);
+		print_uint(PRINT_ANY, "chain", "  chain %u:", c->key);
+		print_u64(PRINT_ANY, "events", " %llu", c->count);
+		print_nl();
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+
+	close_json_object();
+	delete_json_obj_plain();
+}
+
+static int tick_tcmsg_summary(unsigned int overruns, void *arg)
+{
+	struct mon_summary *s = arg;
+
+	s->overruns += overruns;
+	print_mon_summary(s);
+	mon_summary_reset(s);
+	return 0;
+}
+
 
 static int accept_tcmsg(struct rtnl_ctrl_data *ctrl,
 			struct nlmsghdr *n, void *arg)
@@ -70,11 +309,21 @@ int do_tcmonitor(int argc, char **argv)
 	struct rtnl_handle rth;
 	char *file = NULL;
 	unsigned int groups = nl_mgrp(RTNLGRP_TC);
+	struct mon_summary summary = { .interval = 1000 };
+	bool do_summary = false;
 
+	mon_summary_init(&summary);
 	while (argc > 0) {
 		if (matches(*argv, "file") == 0) {
 			NEXT_ARG();
 			file = *argv;
+		} else if (matches(*argv, "summary") == 0) {
+			do_summary = true;
+		} else if (matches(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&summary.interval, *argv, 0) ||
+			    !summary.interval)
+				invarg("invalid interval", *argv);
 		} else {
 			if (matches(*argv, "help") == 0) {
 				usage();
@@ -95,7 +344,14 @@ int do_tcmonitor(int argc, char **argv)
 			exit(-1);
 		}
 
-		ret = rtnl_from_file(fp, accept_tcmsg, stdout);
+		if (do_summary) {
+			ret = rtnl_from_file(fp, accept_tcmsg_summary,
+					     &summary);
+			summary.interval = 0;
+			print_mon_summary(&summary);
+		} else {
+			ret = rtnl_from_file(fp, accept_tcmsg, stdout);
+		}
 		fclose(fp);
 		return ret;
 	}
@@ -105,7 +361,14 @@ int do_tcmonitor(int argc, char **argv)
 
 	ll_init_map(&rth);
 
-	if (rtnl_listen(&rth, accept_tcmsg, (void *)stdout) < 0) {
+	if (do_summary) {
+		if (rtnl_listen_timed(&rth, accept_tcmsg_summary,
+				      tick_tcmsg_summary, summary.interval,
+				      &summary) < 0) {
+			rtnl_close(&rth);
+			exit(2);
+		}
+	} else if (rtnl_listen(&rth, accept_tcmsg, (void *)stdout) < 0) {
 		rtnl_close(&rth);
 		exit(2);
 	}
@@ -0,0 +1,110 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+ts_log "[Testing -cbor output against -json]"
+
+if ! python3 -c "" 2>/dev/null; then
+	ts_log "python3 is needed to decode CBOR, skipping"
+	ts_skip
+fi
+
+# Decode the CBOR in $1 and compare it to the JSON in $2.
+cbor_cmp()
+{
+	python3 - "$1" "$2" <<'EOF'
+import json, math, struct, sys
+
+data = open(sys.argv[1], "rb").read()
+pos = 0
+
+def arg(info):
+    global pos
+    if info < 24:
+        return info
+    n = 1 << (info - 24)
+    v = int.from_bytes(data[pos:pos + n], "big")
+    pos += n
+    return v
+
+def item():
+    global pos
+    ib = data[pos]
+    pos += 1
+    major, info = ib >> 5, ib & 31
+    if ib == 0xf4:
+        return False
+    if ib == 0xf5:
+        return True
+    if ib == 0xf6:
+        return None
+    if ib == 0xfb:
+        pos += 8
+        return struct.unpack(">d", data[pos - 8:pos])[0]
+    if major in (4, 5) and info == 31:
+        out = [] if major == 4 else {}
+        while data[pos] != 0xff:
+            if major == 4:
+                out.append(item())
+            else:
+                k = item()
+                out[k] = item()
+        pos += 1
+        return out
+    v = arg(info)
+    if major == 0:
+        return v
+    if major == 1:
+        return -1 - v
+    if major == 3:
+        pos += v
+        return data[pos - v:pos].decode()
+    raise ValueError("unexpected CBOR item 0x%02x" % ib)
+
+def same(a, b):
+    if isinstance(a, float) or isinstance(b, float):
+        return math.isclose(a, b, rel_tol=1e-5)
+    if isinstance(a, dict):
+        return a.keys() == b.keys() and all(same(a[k], b[k]) for k in a)
+    if isinstance(a, list):
+        return len(a) == len(b) and all(map(same, a, b))
+    return a == b
+
+decoded = item()
+if pos != len(data):
+    sys.exit("trailing data after CBOR item")
+if not same(decoded, json.load(open(sys.argv[2]))):
+    sys.exit("CBOR and JSON output differ")
+EOF
+}
+
+cbor_test()
+{
+	DESC=$1; shift
+	CMD=$1; shift
+
+	$CMD -j "$@" > "$STD_OUT.json" 2> $STD_ERR
+	$CMD -cbor "$@" > "$STD_OUT.cbor" 2>> $STD_ERR
+
+	echo -n "test on: $DESC"
+	if [ -s $STD_ERR ]; then
+		pr_failed
+		ts_err_cat $STD_ERR
+	elif cbor_cmp "$STD_OUT.cbor" "$STD_OUT.json" 2> $STD_ERR; then
+		pr_success
+	else
+		pr_failed
+		ts_err_cat $STD_ERR
+	fi
+	rm -f "$STD_OUT.json" "$STD_OUT.cbor"
+}
+
+NEW_DEV="$(rand_dev)"
+ts_ip "$0" "Add $NEW_DEV dummy interface" link add dev $NEW_DEV type dummy
+ts_ip "$0" "Add address to $NEW_DEV" address add 192.0.2.1/24 dev $NEW_DEV
+
+cbor_test "ip link show" "$IP" -d link show dev $NEW_DEV
+cbor_test "ip address show" "$IP" address show dev $NEW_DEV
+cbor_test "tc qdisc show" "$TC" -s qdisc show dev $NEW_DEV
+
+ts_ip "$0" "Del $NEW_DEV dummy interface" link del dev $NEW_DEV
@@ -0,0 +1,79 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+ts_log "[Testing route sync]"
+
+DEV1=$(rand_dev)
+DEV2=$(rand_dev)
+ROUTES=`mktemp`
+
+# the summary of "ip route sync" goes to stderr, check it with the changes
+ts_sync_diff()
+{
+	DESC=$1; shift
+	echo "$0: $DESC"
+	$IP "$@" diff > $STD_OUT 2>&1
+}
+
+ts_ip "$0" "Add new interface $DEV1" link add $DEV1 type dummy
+ts_ip "$0" "Add new interface $DEV2" link add $DEV2 type dummy
+ts_ip "$0" "Set $DEV1 into UP state" link set up dev $DEV1
+ts_ip "$0" "Set $DEV2 into UP state" link set up dev $DEV2
+ts_ip "$0" "Add 10.10.1.1/24 addr on $DEV1" addr add 10.10.1.1/24 dev $DEV1
+ts_ip "$0" "Add 10.10.2.1/24 addr on $DEV2" addr add 10.10.2.1/24 dev $DEV2
+ts_ip "$0" "Add dead:beef::1/64 addr on $DEV1" -6 addr add dead:beef::1/64 dev $DEV1 nodad
+ts_ip "$0" "Add IPv6 route dst cafe:babe::/64" -6 route add cafe:babe::/64 via dead:beef::2 proto static
+
+echo "10.20.0.0/24 via 10.10.1.2 proto static" >> $ROUTES
+echo "10.30.0.0/24 proto static nexthop via 10.10.1.2 dev $DEV1 nexthop via 10.10.2.2 dev $DEV2 weight 2" >> $ROUTES
+ts_sync_diff "Diff IPv4 routes" route sync proto static $ROUTES
+test_on "2 added, 0 replaced, 0 deleted, 0 unchanged"
+ts_ip "$0" "Sync IPv4 routes" route sync proto static $ROUTES
+
+ts_sync_diff "Diff the same routes again" route sync proto static $ROUTES
+test_on "0 added, 0 replaced, 0 deleted, 2 unchanged"
+test_lines_count 1
+
+ts_ip "$0" "Show IPv6 route cafe:babe::/64" -6 route show cafe:babe::/64
+test_on "cafe:babe::/64 via dead:beef::2 dev $DEV1"
+test_lines_count 1
+
+: > $ROUTES
+echo "10.20.0.0/24 via 10.10.1.2 proto static" >> $ROUTES
+echo "10.30.0.0/24 proto static nexthop via 10.10.2.2 dev $DEV2 weight 2 nexthop via 10.10.1.2 dev $DEV1" >> $ROUTES
+ts_sync_diff "Diff ECMP route with reordered nexthops" route sync proto static $ROUTES
+test_on "0 added, 0 replaced, 0 deleted, 2 unchanged"
+
+: > $ROUTES
+echo "10.30.0.0/24 proto static nexthop via 10.10.2.2 dev $DEV2 weight 3 nexthop via 10.10.1.2 dev $DEV1" >> $ROUTES
+ts_sync_diff "Diff ECMP route with another weight" route sync proto static $ROUTES
+test_on "0 added, 1 replaced, 1 deleted, 0 unchanged"
+ts_ip "$0" "Sync ECMP route with another weight" route sync proto static $ROUTES
+
+ts_ip "$0" "Show ECMP route 10.30.0.0/24" -4 route show 10.30.0.0/24
+test_on "nexthop via 10.10.2.2 dev $DEV2 weight 3"
+
+ts_ip "$0" "Add route 10.40.0.0/24 on $DEV1" route add 10.40.0.0/24 dev $DEV1 proto static
+ts_ip "$0" "Append route 10.40.0.0/24 on $DEV2" route append 10.40.0.0/24 dev $DEV2 proto static
+echo "10.40.0.0/24 dev $DEV2 proto static" >> $ROUTES
+ts_sync_diff "Diff routes sharing a key" route sync proto static $ROUTES
+test_on "0 added, 0 replaced, 1 deleted, 2 unchanged"
+ts_ip "$0" "Sync routes sharing a key" route sync proto static $ROUTES
+ts_ip "$0" "Show route 10.40.0.0/24" -4 route show 10.40.0.0/24
+test_on "dev $DEV2"
+test_lines_count 1
+
+: > $ROUTES
+ts_sync_diff "Diff an empty IPv6 table" -6 route sync proto static $ROUTES
+test_on "0 added, 0 replaced, 1 deleted, 0 unchanged"
+ts_ip "$0" "Sync an empty IPv6 table" -6 route sync proto static $ROUTES
+ts_ip "$0" "Show IPv6 route cafe:babe::/64" -6 route show cafe:babe::/64
+test_lines_count 0
+
+ts_ip "$0" "Show IPv4 route 10.30.0.0/24" -4 route show 10.30.0.0/24
+test_lines_count 3
+
+rm -f $ROUTES
+ts_ip "$0" "Del $DEV1 dummy interface" link del dev $DEV1
+ts_ip "$0" "Del $DEV2 dummy interface" link del dev $DEV2
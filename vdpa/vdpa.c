@@ -1056,7 +1056,7 @@ static void help(void)
 	fprintf(stderr,
 		"Usage: vdpa [ OPTIONS ] OBJECT { COMMAND | help }\n"
 		"where  OBJECT := { mgmtdev | dev }\n"
-		"       OPTIONS := { -V[ersion] | -n[o-nice-names] | -j[son] | -p[retty] }\n");
+		"       OPTIONS := { -V[ersion] | -n[o-nice-names] | -j[son] | --cbor | -p[retty] }\n");
 }
 
 static int vdpa_cmd(struct vdpa *vdpa, int argc, char **argv)
@@ -1117,11 +1117,14 @@ static void vdpa_free(struct vdpa *vdpa)
 	free(vdpa);
 }
 
+#define OPT_CBOR 256
+
 int main(int argc, char **argv)
 {
 	static const struct option long_options[] = {
 		{ "Version",		no_argument,	NULL, 'V' },
 		{ "json",		no_argument,	NULL, 'j' },
+		{ "cbor",		no_argument,	NULL, OPT_CBOR },
 		{ "pretty",		no_argument,	NULL, 'p' },
 		{ "help",		no_argument,	NULL, 'h' },
 		{ NULL, 0, NULL, 0 }
@@ -1146,6 +1149,10 @@ int main(int argc, char **argv)
 		case 'j':
 			vdpa->json_output = true;
 			break;
+		case OPT_CBOR:
+			vdpa->json_output = true;
+			cbor = 1;
+			break;
 		case 'p':
 			pretty = true;
 			break;